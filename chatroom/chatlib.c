@@ -1,4 +1,4 @@
-#define _POSIX_C_SOURCE 200112L
+#define _GNU_SOURCE
 #include "chatlib.h"
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -13,7 +13,10 @@
 #include <stdlib.h>
 #include <string.h>
 
-int CreateTCPServer(int port) {
+// 重连风暴时大量连接同时到达, 内核会把它截断到net.core.somaxconn
+#define LISTEN_BACKLOG 4096
+
+static int CreateListener(int port, int reuse_port) {
   int sock_fd;
   if ((sock_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
     perror("Create tcp server socket failed");
@@ -27,6 +30,15 @@ int CreateTCPServer(int port) {
     return -1;
   }
 
+  // 多个socket监听同一端口, 由内核把新连接分散到各个socket
+  if (reuse_port) {
+    ret = setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+    if (ret == -1) {
+      perror("Set tcp server socket reuse port opt failed");
+      return -1;
+    }
+  }
+
   struct sockaddr_in sa;
   memset(&sa, 0, sizeof(sa));
   sa.sin_family = AF_INET;
@@ -39,7 +51,7 @@ int CreateTCPServer(int port) {
     return -1;
   }
 
-  ret = listen(sock_fd, 511);
+  ret = listen(sock_fd, LISTEN_BACKLOG);
   if (ret == -1) {
     perror("Listen tcp server socket failed");
     return -1;
@@ -48,6 +60,14 @@ int CreateTCPServer(int port) {
   return sock_fd;
 }
 
+int CreateTCPServer(int port) {
+  return CreateListener(port, 0);
+}
+
+int CreateTCPServerReusePort(int port) {
+  return CreateListener(port, 1);
+}
+
 int SetSocketNonBlockNoDelay(int fd) {
   int flags = fcntl(fd, F_GETFL);
   if (flags == -1) {
@@ -61,8 +81,12 @@ int SetSocketNonBlockNoDelay(int fd) {
     return -1;
   }
 
+  return SetSocketNoDelay(fd);
+}
+
+int SetSocketNoDelay(int fd) {
   int yes = 1;
-  ret = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+  int ret = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
   if (ret == -1) {
     perror("Set tcp server socket no delay opt failed");
     return -1;
@@ -71,26 +95,33 @@ int SetSocketNonBlockNoDelay(int fd) {
   return 0;
 }
 
-int AcceptClient(int server_sock) {
-  int cli_sock;
-  while (1) {
-    struct sockaddr_in sa;
-    socklen_t sock_len = sizeof(sa);
-
-    cli_sock = accept(server_sock, (struct sockaddr*)&sa, &sock_len);
+int AcceptClients(int server_sock, int *fds, int max_fds) {
+  int count = 0;
+  while (count < max_fds) {
+    // 直接创建非阻塞的socket, 不需要再逐个fcntl; TCP_NODELAY从监听socket继承
+    int cli_sock = accept4(server_sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (cli_sock == -1) {
-      if (errno == EINTR || errno == EAGAIN) {
+      // 连接在accept之前就被对端重置了, 跳过它
+      if (errno == EINTR || errno == ECONNABORTED) {
         continue;
       }
 
+      // 非阻塞的监听socket上已经没有待接受的连接
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+
       perror("Accept client socket failed");
-      return -1;
+      if (count == 0) {
+        return -1;
+      }
+      break;
     }
 
-    break;
+    fds[count++] = cli_sock;
   }
 
-  return cli_sock;
+  return count;
 }
 
 int TCPConnect(const char *addr, int port, int nonblock) {
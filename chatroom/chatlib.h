@@ -4,8 +4,15 @@
 #include <stddef.h>
 
 int CreateTCPServer(int port);
+int CreateTCPServerReusePort(int port);
 int SetSocketNonBlockNoDelay(int fd);
-int AcceptClient(int server_socket);
+int SetSocketNoDelay(int fd);
+/*
+ * 从非阻塞的监听socket上最多接受max_fds个连接, 新连接已经是非阻塞的
+ *
+ * 返回接受的连接数, 没有待接受的连接时返回0, 出错返回-1
+ */
+int AcceptClients(int server_socket, int *fds, int max_fds);
 int TCPConnect(const char *addr, int port, int nonblock);
 
 void *ChatMalloc(size_t size);
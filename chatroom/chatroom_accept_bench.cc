@@ -0,0 +1,151 @@
+/*
+ * 建连风暴测试
+ *
+ * 每轮尽快发起指定数量的非阻塞连接, 直到所有连接都收到服务器的欢迎语(说明已经被accept并注册),
+ * 然后全部关闭, 模拟客户端集体断线重连. 每轮输出用时和每秒接受的连接数.
+ * 昵称长度大于0时每个连接收到欢迎语后先发送/nick再关闭.
+ *
+ * 用法: chatroom_accept_bench <host> <port> [每轮连接数] [轮数] [昵称长度]
+ */
+#include <errno.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "chatlib.h"
+#include "reactor.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr int kDefaultConns = 5000;
+  constexpr int kDefaultRounds = 5;
+  constexpr int kRoundTimeoutMs = 30000;
+
+  struct Conn {
+    int fd;
+    bool welcomed;
+  };
+
+  int welcomed = 0;
+  int failed = 0;
+  char nick_cmd[256];
+  int nick_cmd_len = 0;
+
+  long NowUs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+  }
+
+  // 收到欢迎语的第一个字节即可, 之后不再关心这个连接
+  void HandleConnEvent(Reactor *reactor, int fd, int events, void *data) {
+    Conn *conn = static_cast<Conn*>(data);
+    char buf[512];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n > 0) {
+      if (nick_cmd_len > 0) {
+        write(fd, nick_cmd, nick_cmd_len);
+      }
+      conn->welcomed = true;
+      ++welcomed;
+      ReactorRemove(reactor, fd);
+      return;
+    }
+
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) ||
+        (events & REACTOR_ERROR)) {
+      ++failed;
+      ReactorRemove(reactor, fd);
+    }
+  }
+
+  void RaiseFileLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &limit);
+    }
+  }
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    printf("Usage: %s <host> <port> [conns per round] [rounds] [nick bytes]\n", argv[0]);
+    exit(1);
+  }
+
+  const char *host = argv[1];
+  int port = atoi(argv[2]);
+  int num_conns = argc > 3 ? atoi(argv[3]) : kDefaultConns;
+  int rounds = argc > 4 ? atoi(argv[4]) : kDefaultRounds;
+  int nick_len = argc > 5 ? atoi(argv[5]) : 0;
+  if (nick_len > 200) {
+    nick_len = 200;
+  }
+  if (nick_len > 0) {
+    memcpy(nick_cmd, "/nick ", 6);
+    memset(nick_cmd + 6, 'n', nick_len);
+    nick_cmd[6 + nick_len] = '\n';
+    nick_cmd_len = 7 + nick_len;
+  }
+
+  RaiseFileLimit();
+  Reactor *reactor = CreateReactor();
+  if (reactor == nullptr) {
+    exit(1);
+  }
+
+  std::vector<Conn> conns(num_conns);
+  double total_us = 0;
+  long total_welcomed = 0;
+  for (int round = 0; round < rounds; ++round) {
+    welcomed = 0;
+    failed = 0;
+    long start = NowUs();
+    int opened = 0;
+    for (int i = 0; i < num_conns; ++i) {
+      int fd = TCPConnect(host, port, 1);
+      if (fd == -1) {
+        break;
+      }
+      conns[i] = Conn{fd, false};
+      ReactorAdd(reactor, fd, REACTOR_READABLE, HandleConnEvent, &conns[i]);
+      ++opened;
+    }
+
+    while (welcomed + failed < opened && NowUs() - start < kRoundTimeoutMs * 1000L) {
+      ReactorPoll(reactor, 10);
+    }
+    long elapsed = NowUs() - start;
+
+    printf("round %d: %d/%d accepted in %.1f ms, %.0f conns/s\n", round, welcomed, num_conns,
+           elapsed / 1e3, welcomed / (elapsed / 1e6));
+    total_us += elapsed;
+    total_welcomed += welcomed;
+
+    for (int i = 0; i < opened; ++i) {
+      if (!conns[i].welcomed) {
+        ReactorRemove(reactor, conns[i].fd);
+      }
+      close(conns[i].fd);
+    }
+    // 等服务器处理完断开, 避免和下一轮混在一起
+    usleep(500 * 1000);
+  }
+
+  printf("total: %.0f conns/s\n", total_welcomed / (total_us / 1e6));
+  FreeReactor(reactor);
+  return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * 广播开销测试
+ *
+ * 不经过网络, 直接测量一条广播放进N个客户端输出队列, 以及把队列写出去的开销.
+ * 对比两种方式:
+ *   copy   每个接收者复制一份消息(输出队列按字节缓冲时的做法)
+ *   shared 所有接收者共享同一条引用计数消息, 队列中只保存指针
+ * 每轮先向所有队列广播若干条消息, 记录堆内存的增长, 再把所有队列写到/dev/null.
+ *
+ * 用法: chatroom_broadcast_bench [接收者数] [消息长度] [每轮广播数] [轮数]
+ */
+#include <fcntl.h>
+#include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "message.h"
+#include "outbuf.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr int kDefaultBatch = 16;
+  constexpr int kDefaultRounds = 20;
+  constexpr size_t kDefaultMsgLen = 64;
+
+  double CpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+  }
+
+  size_t HeapInUse() {
+    return mallinfo2().uordblks;
+  }
+
+  void Run(const char *mode, bool shared, int recipients, size_t msg_len, int batch, int rounds) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    std::vector<OutputQueue> queues(recipients);
+    for (auto &queue : queues) {
+      OutputQueueInit(&queue);
+    }
+
+    std::vector<char> payload(msg_len, 'x');
+    double enqueue_ns = 0;
+    double flush_ns = 0;
+    double heap_bytes = 0;
+
+    // 第一轮让队列数组扩容到位, 不计入结果
+    for (int round = -1; round < rounds; ++round) {
+      size_t heap_before = HeapInUse();
+      double start = CpuNs();
+      for (int i = 0; i < batch; ++i) {
+        ChatMessage *msg = CreateChatMessageFrom(payload.data(), msg_len);
+        for (auto &queue : queues) {
+          if (shared) {
+            OutputQueuePush(&queue, msg, 0);
+          } else {
+            ChatMessage *copy = CreateChatMessageFrom(msg->data, msg->len);
+            OutputQueuePush(&queue, copy, 0);
+            ReleaseChatMessage(copy);
+          }
+        }
+        ReleaseChatMessage(msg);
+      }
+      double enqueued = CpuNs();
+      size_t heap_after = HeapInUse();
+
+      for (auto &queue : queues) {
+        OutputQueueFlush(&queue, null_fd);
+      }
+      double flushed = CpuNs();
+
+      if (round >= 0) {
+        enqueue_ns += enqueued - start;
+        flush_ns += flushed - enqueued;
+        heap_bytes += static_cast<double>(heap_after - heap_before);
+      }
+    }
+
+    double broadcasts = static_cast<double>(batch) * rounds;
+    printf("%-6s recipients=%-6d msg=%zuB  enqueue=%9.1f us/broadcast  flush=%9.1f us/broadcast  heap=%10.0f B/broadcast\n",
+           mode, recipients, msg_len, enqueue_ns / broadcasts / 1e3, flush_ns / broadcasts / 1e3,
+           heap_bytes / broadcasts);
+
+    for (auto &queue : queues) {
+      OutputQueueFree(&queue);
+    }
+    close(null_fd);
+  }
+}
+
+int main(int argc, char **argv) {
+  int recipients = argc > 1 ? atoi(argv[1]) : 0;
+  size_t msg_len = argc > 2 ? strtoul(argv[2], nullptr, 10) : kDefaultMsgLen;
+  int batch = argc > 3 ? atoi(argv[3]) : kDefaultBatch;
+  int rounds = argc > 4 ? atoi(argv[4]) : kDefaultRounds;
+
+  // 不指定接收者数时测1k和10k两档
+  std::vector<int> counts;
+  if (recipients > 0) {
+    counts.push_back(recipients);
+  } else {
+    counts = {1000, 10000};
+  }
+
+  for (int count : counts) {
+    Run("copy", false, count, msg_len, batch, rounds);
+    Run("shared", true, count, msg_len, batch, rounds);
+  }
+
+  return 0;
+}
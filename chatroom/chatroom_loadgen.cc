@@ -0,0 +1,319 @@
+/*
+ * 聊天服务器压测工具
+ *
+ * 建立指定数量的连接并保持, 其中一部分连接按固定速率发送消息, 所有连接都读取服务器广播的消息.
+ * 每秒输出一次当前保持的连接数, 发送和收到的消息数, 结束时输出平均值.
+ * 收到的消息数 = 发送数 x (连接数 - 1), 即服务器的扇出能力.
+ * 协议为line(默认)时发送以换行结尾的文本, 为frame时发送FRAME_MSG帧并按帧统计收到的消息.
+ * 频道数大于0时第i个连接加入频道c(i % 频道数), 消息只发给同一频道的连接.
+ *
+ * 用法: chatroom_loadgen <host> <port> [连接数] [发送连接数] [每个发送连接每秒消息数] [秒数] [line|frame]
+ *       [消息字节数] [频道数]
+ */
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "chatlib.h"
+#include "frame.h"
+#include "reactor.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr int kDefaultConns = 1000;
+  constexpr int kDefaultSenders = 10;
+  constexpr int kDefaultRate = 100;
+  constexpr int kDefaultSeconds = 10;
+  constexpr int kConnectTimeoutMs = 10000;
+  constexpr int kDefaultMsgBytes = 20;
+  constexpr int kMaxMsgBytes = 60000;
+
+  struct Conn {
+    int index;
+    int fd;
+    bool connected;
+    bool closed;
+    bool welcomed;  // 分帧协议下欢迎语之后的数据才是帧
+    FrameParser parser;
+  };
+
+  struct LoadState {
+    int connected = 0;
+    int closed = 0;
+    int disconnected = 0;  // 建立后又被关闭的连接
+    long received_msgs = 0;
+    long received_bytes = 0;
+    long sent_msgs = 0;
+  };
+
+  LoadState state;
+  bool use_frames = false;
+  int num_channels = 0;
+
+  // 连接建立后先设置昵称(分帧协议需要先发一帧让服务器切换协议), 再加入频道
+  void SendHello(Conn *conn) {
+    char buf[128];
+    int len = 0;
+    if (use_frames) {
+      int n = snprintf(buf + FRAME_HEADER_LEN, 32, "load%d", conn->index);
+      FrameEncodeHeader(buf, FRAME_NICK, n);
+      len = FRAME_HEADER_LEN + n;
+    }
+
+    if (num_channels > 0) {
+      int channel = conn->index % num_channels;
+      if (use_frames) {
+        int n = snprintf(buf + len + FRAME_HEADER_LEN, 32, "c%d", channel);
+        FrameEncodeHeader(buf + len, FRAME_JOIN, n);
+        len += FRAME_HEADER_LEN + n;
+      } else {
+        len += snprintf(buf + len, 32, "/join c%d\n", channel);
+      }
+    }
+
+    if (len > 0) {
+      write(conn->fd, buf, len);
+    }
+  }
+
+  void CountFrames(Conn *conn, const char *data, size_t len) {
+    if (!conn->welcomed) {
+      const char *p = static_cast<const char*>(memchr(data, '\n', len));
+      if (p == nullptr) {
+        return;
+      }
+      conn->welcomed = true;
+      ++state.received_msgs;
+      len -= p + 1 - data;
+      data = p + 1;
+    }
+
+    FrameEvent event;
+    do {
+      size_t consumed = FrameParse(&conn->parser, data, len, &event);
+      data += consumed;
+      len -= consumed;
+      if (event.kind == FRAME_EVENT_BEGIN && event.type == FRAME_PING) {
+        char pong[FRAME_HEADER_LEN];
+        FrameEncodeHeader(pong, FRAME_PONG, 0);
+        write(conn->fd, pong, sizeof(pong));
+      } else if (event.kind == FRAME_EVENT_END && event.type != FRAME_PING) {
+        ++state.received_msgs;
+      }
+    } while (event.kind != FRAME_EVENT_NONE && event.kind != FRAME_EVENT_ERROR);
+  }
+
+  long NowMs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+  }
+
+  void CloseConn(Reactor *reactor, Conn *conn) {
+    if (conn->closed) {
+      return;
+    }
+    conn->closed = true;
+    ++state.closed;
+    if (conn->connected) {
+      ++state.disconnected;
+    }
+    ReactorRemove(reactor, conn->fd);
+    close(conn->fd);
+  }
+
+  void HandleConnEvent(Reactor *reactor, int fd, int events, void *data) {
+    Conn *conn = static_cast<Conn*>(data);
+    if (!conn->connected && (events & REACTOR_WRITABLE)) {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if (err != 0) {
+        CloseConn(reactor, conn);
+        return;
+      }
+      conn->connected = true;
+      ++state.connected;
+      SendHello(conn);
+      ReactorModify(reactor, fd, REACTOR_READABLE);
+    }
+
+    char buf[16384];
+    while (true) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n > 0) {
+        state.received_bytes += n;
+        if (use_frames) {
+          CountFrames(conn, buf, n);
+          continue;
+        }
+        for (char *p = buf; (p = static_cast<char*>(memchr(p, '\n', buf + n - p))) != nullptr; ++p) {
+          ++state.received_msgs;
+        }
+        continue;
+      }
+
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) && !(events & REACTOR_ERROR)) {
+        return;
+      }
+
+      CloseConn(reactor, conn);
+      return;
+    }
+  }
+
+  void RaiseFileLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &limit);
+    }
+  }
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    printf("Usage: %s <host> <port> [conns] [senders] [msgs/s per sender] [seconds] [line|frame] [msg bytes] [channels]\n",
+           argv[0]);
+    exit(1);
+  }
+
+  const char *host = argv[1];
+  int port = atoi(argv[2]);
+  int num_conns = argc > 3 ? atoi(argv[3]) : kDefaultConns;
+  int num_senders = argc > 4 ? atoi(argv[4]) : kDefaultSenders;
+  int rate = argc > 5 ? atoi(argv[5]) : kDefaultRate;
+  int seconds = argc > 6 ? atoi(argv[6]) : kDefaultSeconds;
+  use_frames = argc > 7 && strcmp(argv[7], "frame") == 0;
+  int msg_bytes = argc > 8 ? atoi(argv[8]) : kDefaultMsgBytes;
+  num_channels = argc > 9 ? atoi(argv[9]) : 0;
+  if (msg_bytes < kDefaultMsgBytes) {
+    msg_bytes = kDefaultMsgBytes;
+  } else if (msg_bytes > kMaxMsgBytes) {
+    msg_bytes = kMaxMsgBytes;
+  }
+  if (num_senders > num_conns) {
+    num_senders = num_conns;
+  }
+
+  RaiseFileLimit();
+  Reactor *reactor = CreateReactor();
+  if (reactor == nullptr) {
+    exit(1);
+  }
+
+  // 连接建立前Conn的地址不能变, 一次分配好
+  std::vector<Conn> conns(num_conns);
+  long start = NowMs();
+  for (int i = 0; i < num_conns; ++i) {
+    int fd = TCPConnect(host, port, 1);
+    if (fd == -1) {
+      perror("Connect failed");
+      num_conns = i;
+      break;
+    }
+    conns[i] = Conn{i, fd, false, false, false, {}};
+    FrameParserInit(&conns[i].parser, kMaxMsgBytes * 2);
+    ReactorAdd(reactor, fd, REACTOR_READABLE | REACTOR_WRITABLE, HandleConnEvent, &conns[i]);
+
+    // 边建连边处理事件, 避免监听队列溢出
+    if (i % 256 == 255) {
+      ReactorPoll(reactor, 0);
+    }
+  }
+
+  while (state.connected + state.closed < num_conns && NowMs() - start < kConnectTimeoutMs) {
+    ReactorPoll(reactor, 10);
+  }
+  printf("connected %d/%d in %ld ms\n", state.connected, num_conns, NowMs() - start);
+
+  // 等欢迎消息收完再开始计数
+  long settle = NowMs();
+  while (NowMs() - settle < 500) {
+    ReactorPoll(reactor, 10);
+  }
+  state.received_msgs = 0;
+  state.received_bytes = 0;
+
+  printf("%-6s %-10s %-12s %-14s %-12s\n", "sec", "held", "sent/s", "received/s", "MB/s");
+  // 消息补齐到指定长度, 行协议以换行结尾, 分帧协议前面留出帧头
+  char msg[FRAME_HEADER_LEN + kMaxMsgBytes];
+  char *text = use_frames ? msg + FRAME_HEADER_LEN : msg;
+  memset(text, 'x', msg_bytes);
+  text[msg_bytes - 1] = '\n';
+  int text_len = use_frames ? msg_bytes - 1 : msg_bytes;
+  int len = use_frames ? FRAME_HEADER_LEN + text_len : text_len;
+  if (use_frames) {
+    FrameEncodeHeader(msg, FRAME_MSG, text_len);
+  }
+
+  long begin = NowMs();
+  long last_report = begin;
+  long last_sent = 0;
+  long last_received = 0;
+  long last_bytes = 0;
+  long sent_target = 0;
+  while (NowMs() - begin < seconds * 1000L) {
+    // 按经过的时间补齐应发送的消息, 轮流使用各个发送连接
+    long elapsed = NowMs() - begin;
+    long target = elapsed * rate * num_senders / 1000;
+    while (sent_target < target) {
+      Conn *conn = &conns[sent_target % num_senders];
+      ++sent_target;
+      if (!conn->connected || conn->closed) {
+        continue;
+      }
+      int n = snprintf(text, msg_bytes, "load message %ld", sent_target);
+      text[n] = 'x';
+      if (write(conn->fd, msg, len) == len) {
+        ++state.sent_msgs;
+      }
+    }
+
+    ReactorPoll(reactor, 1);
+
+    long now = NowMs();
+    if (now - last_report >= 1000) {
+      double secs = (now - last_report) / 1000.0;
+      printf("%-6ld %-10d %-12.0f %-14.0f %-12.2f\n", (now - begin) / 1000,
+             state.connected - state.disconnected, (state.sent_msgs - last_sent) / secs,
+             (state.received_msgs - last_received) / secs,
+             (state.received_bytes - last_bytes) / secs / 1e6);
+      last_report = now;
+      last_sent = state.sent_msgs;
+      last_received = state.received_msgs;
+      last_bytes = state.received_bytes;
+    }
+  }
+
+  double secs = (NowMs() - begin) / 1000.0;
+  long members = num_channels > 0 ? (num_conns + num_channels - 1) / num_channels : num_conns;
+  printf("total: held=%d, sent=%.0f msgs/s, received=%.0f msgs/s, expected fan-out=%ld\n",
+         state.connected - state.disconnected, state.sent_msgs / secs, state.received_msgs / secs,
+         members - 1);
+
+  for (Conn &conn : conns) {
+    if (!conn.closed && conn.fd > 0) {
+      close(conn.fd);
+    }
+  }
+  FreeReactor(reactor);
+  return 0;
+}
@@ -3,246 +3,1242 @@
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
-#include <sys/select.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
 #include <cassert>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include "chatlib.h"
+#include "frame.h"
+#include "inbuf.h"
+#include "mailbox.h"
+#include "message.h"
+#include "outbuf.h"
+#include "reactor.h"
+#include "slab.h"
+#include "slotmap.h"
+#include "timerwheel.h"
+#include "uring.h"
 
 #ifdef __cplusplus
 }
 #endif
 
 namespace {
-  constexpr auto kMaxClients = 1000;
   constexpr auto kServerPort = 8888;  // 聊天服务器端口
+  constexpr int kDefaultIdleTimeoutSec = 300;
+  constexpr uint64_t kTimerTickMs = 100;
+  constexpr size_t kMaxOutputBytes = 1 << 20;  // 积压超过这个大小的慢客户端会被断开
+  constexpr uint32_t kMaxFrameLen = 64 * 1024;
+  constexpr size_t kMaxLineLen = 64 * 1024;
+  constexpr size_t kReadBufSize = 16 * 1024;
+  constexpr int kAcceptBatch = 64;
+  constexpr int kAcceptBudget = 1024;  // 每轮最多接受的连接数, 超出的留到下一轮, 不让建连饿死已有连接
+  constexpr size_t kMaxChannelNameLen = 32;
+  constexpr int kMaxChannelsPerClient = 64;
+  constexpr size_t kInlineNicknameSize = 32;  // 包括结尾的0, 更长的昵称放到堆上
+  constexpr size_t kClientsPerChunk = 256;
+  constexpr char kDefaultChannel[] = "lobby";  // 新连接自动加入
+  constexpr unsigned kUringEntries = 4096;
+  constexpr unsigned kUringBufCount = 1024;  // 每个分片的接收缓冲数, 所有连接共享
+  constexpr int kUringMaxIov = 256;          // 每个写请求最多发送的消息数, 与writev路径相同
+  constexpr int kUringBatch = 256;           // 一次取出的完成事件数
+
+  // 连接使用的协议, 由收到的第一个字节决定
+  enum Protocol {
+    kProtocolUnknown,
+    kProtocolLine,
+    kProtocolFrame,
+  };
+
+  // io_uring请求的类型, 保存在user_data的低位, 高位是分片或者客户端的指针(至少按16字节对齐)
+  enum UringOp : uint64_t {
+    kUringCancel = 0,
+    kUringAccept,
+    kUringMailbox,
+    kUringRecv,
+    kUringWrite,
+  };
+  constexpr uint64_t kUringOpMask = 0x7;
 }
 
+struct Shard;
+struct Client;
+
+/*
+ * 所有分片共享的频道记录, 位图标记哪些分片有这个频道的成员, 发布时只投递给这些分片.
+ * 分片的频道创建时引用记录并置上自己的位, 删除时清掉位并释放引用; 查找和引用计数由
+ * ChatState::shared_mutex保护, 位图用原子操作读写. 发布者所在分片一定持有引用, 读位图不用加锁.
+ */
+typedef struct SharedChannel {
+  std::string name;
+  int refs;
+  std::vector<uint64_t> shards;  // 每个分片一位, 创建后不再改变大小
+} SharedChannel;
+
+typedef std::unordered_map<std::string, SharedChannel*> SharedChannelMap;
+
+/*
+ * 频道的订阅索引, 每个分片各有一份, 只包含本分片的客户端:
+ * 频道 -> 成员的稠密数组, 发布时只遍历订阅者; 客户端 -> 所在频道的数组, 记录自己在成员数组中的下标,
+ * 加入和离开都是O(1). 频道在分片中第一个成员加入时创建, 最后一个成员离开时删除.
+ */
+typedef struct Channel {
+  std::string name;
+  std::vector<Client*> members;
+  SharedChannel *shared;
+} Channel;
+
+typedef struct Subscription {
+  Channel *channel;
+  size_t member_index;  // 在channel->members中的下标
+} Subscription;
+
+typedef std::unordered_map<std::string, Channel*> ChannelMap;
+
+/*
+ * 发给客户端的消息先放进output, 在本轮事件处理完之后统一用writev发出,
+ * 同一轮里收到的多条广播只需要一次系统调用. 写不完时关注可写事件, 可写后继续发送.
+ */
 typedef struct Client {
   int fd;
-  char *nickname;
+  char *nickname;  // 指向inline_nickname, 或者堆上的长昵称
+  char inline_nickname[kInlineNicknameSize];
+  struct Shard *shard;
+  OutputQueue output;
+  Protocol protocol;
+  InputBuffer input;  // 行协议下还没收完的半行
+  FrameParser parser;
+  ChatMessage *frame_msg;  // 正在接收的FRAME_MSG, 内容直接拷贝到要广播的消息中
+  char *frame_arg;         // 正在接收的FRAME_NICK/FRAME_JOIN/FRAME_PART的参数
+  size_t frame_pos;        // 当前帧内容的写入位置
+  Subscription *subs;      // 按加入的先后排列
+  int num_subs;
+  int subs_cap;
+  Channel *active;         // 消息发往的频道, 即最后加入的频道
+  TimerNode idle_timer;  // 每次收到数据时重置
+  bool pinged;           // 空闲超过心跳间隔, 已经发送过FRAME_PING
+  bool flush_pending;  // 是否已在分片的待发送链表中
+  bool closing;        // 已断开或积压过多, 在下次发送时释放
+  bool recv_armed;      // io_uring: 多次接收的请求还在内核中
+  bool write_inflight;  // io_uring: 有一个写请求还没有完成
+  bool cancelled;       // io_uring: 关闭时已经取消了fd上的请求
+  struct Client *next_flush;
 } Client;
 
-typedef struct ChatState {
+/*
+ * 每个reactor线程拥有一个分片: 自己的SO_REUSEPORT监听socket, 由内核分配到这里的连接,
+ * 以及接收其他分片广播的邮箱. 分片内的数据只由所属线程访问, 分片之间只通过邮箱通信.
+ *
+ * 分片的I/O由reactor(epoll就绪通知, 自己读写)或者ring(io_uring, 内核完成读写后通知)之一负责,
+ * 另一个为nullptr. 两种后端共用协议解析, 频道, 输出队列和定时器, 只有收发和建连的方式不同.
+ */
+typedef struct Shard {
+  int index;
   int server_sock;
-  int num_clients;
-  int max_client_fd;
-  Client *clients[kMaxClients];
+  SlotMap clients;  // fd -> Client*
+  Slab client_slab;  // Client对象都从这里分配
+  Client *flush_list;  // 本轮有数据要发送或者需要释放的客户端
+  ChannelMap *channels;
+  ChatMessage *welcome_msg;  // 所有新连接共享
+  bool accept_pending;       // 上一轮用完了预算, 监听队列中可能还有连接
+  TimerWheel timers;
+  Reactor *reactor;
+  Uring *ring;
+  Mailbox mailbox;
+  uint64_t posts;          // 投递给其他分片的广播数
+  uint64_t skipped_posts;  // 因为目标分片没有频道成员而省掉的投递数
+  pthread_t thread;
+} Shard;
+
+/*
+ * 连接空闲heartbeat_ms后, 分帧客户端会收到FRAME_PING, 空闲idle_timeout_ms后断开.
+ * 行协议客户端没有心跳, 发送任意一行(包括命令)都算活跃.
+ */
+typedef struct ChatState {
+  int num_shards;
+  Shard *shards;
+  uint64_t idle_timeout_ms;
+  uint64_t heartbeat_ms;
+  bool use_uring;
+  SharedChannelMap *shared_channels;
+  pthread_mutex_t shared_mutex;
 } ChatState;
 
+// 投递给其他分片的广播, 只持有共享消息的一个引用, 由目标分片发给自己的频道订阅者
+typedef struct BroadcastMsg {
+  MailboxNode node;  // 必须是第一个成员
+  ChatMessage *msg;
+  size_t channel_len;
+  char channel[];
+} BroadcastMsg;
+
 ChatState *chatroom = nullptr;
+volatile bool stopped = false;
+
+void HandleClientEvent(Reactor *reactor, int fd, int events, void *data);
+void HandleIdleTimer(TimerWheel *wheel, TimerNode *node, void *data);
+void ScheduleFlush(Client *client);
+
+uint64_t NowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
 
-Client *CreateClient(int fd) {
-  assert(chatroom->clients[fd] == nullptr);
+Client *CreateClient(Shard *shard, int fd) {
+  assert(SlotMapGet(&shard->clients, fd) == nullptr);
 
-  Client *client = static_cast<Client*>(ChatMalloc(sizeof(*client)));
-  SetSocketNonBlockNoDelay(fd);
+  // epoll下fd由accept4创建时已经是非阻塞的, io_uring下保持阻塞; TCP_NODELAY从监听socket继承
+  Client *client = static_cast<Client*>(SlabAlloc(&shard->client_slab));
   client->fd = fd;
+  client->shard = shard;
+  OutputQueueInit(&client->output);
+  client->protocol = kProtocolUnknown;
+  InputBufferInit(&client->input);
+  FrameParserInit(&client->parser, kMaxFrameLen);
+  client->frame_msg = nullptr;
+  client->frame_arg = nullptr;
+  client->frame_pos = 0;
+  client->subs = nullptr;
+  client->num_subs = 0;
+  client->subs_cap = 0;
+  client->active = nullptr;
+  TimerInit(&client->idle_timer, HandleIdleTimer, client);
+  client->pinged = false;
+  client->flush_pending = false;
+  client->closing = false;
+  client->recv_armed = false;
+  client->write_inflight = false;
+  client->cancelled = false;
+  client->next_flush = nullptr;
 
-  char nickname[20];
-  int nickname_len = snprintf(nickname, sizeof(nickname), "user:%d", fd);
-  client->nickname = static_cast<char*>(ChatMalloc(nickname_len));
-  memcpy(client->nickname, nickname, nickname_len);
+  client->nickname = client->inline_nickname;
+  snprintf(client->inline_nickname, sizeof(client->inline_nickname), "user:%d", fd);
 
-  chatroom->clients[client->fd] = client;
+  SlotMapInsert(&shard->clients, fd, client);
+  TimerWheelSchedule(&shard->timers, &client->idle_timer, NowMs() + chatroom->heartbeat_ms);
 
-  if (client->fd > chatroom->max_client_fd) {
-    chatroom->max_client_fd = client->fd;
+  if (shard->ring != nullptr) {
+    // 在FlushClient中挂上接收请求
+    ScheduleFlush(client);
+  } else {
+    ReactorAdd(shard->reactor, fd, REACTOR_READABLE, HandleClientEvent, client);
   }
-  ++chatroom->num_clients;
-
   return client;
 }
 
+// 分片中频道的第一个成员加入时调用
+SharedChannel *AcquireSharedChannel(Shard *shard, const std::string &name) {
+  pthread_mutex_lock(&chatroom->shared_mutex);
+  SharedChannel *&shared = (*chatroom->shared_channels)[name];
+  if (shared == nullptr) {
+    shared = new SharedChannel();
+    shared->name = name;
+    shared->refs = 0;
+    shared->shards.assign((chatroom->num_shards + 63) / 64, 0);
+  }
+  ++shared->refs;
+  __atomic_fetch_or(&shared->shards[shard->index / 64], 1ULL << (shard->index % 64), __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&chatroom->shared_mutex);
+  return shared;
+}
+
+// 分片中频道的最后一个成员离开时调用
+void ReleaseSharedChannel(Shard *shard, SharedChannel *shared) {
+  pthread_mutex_lock(&chatroom->shared_mutex);
+  __atomic_fetch_and(&shared->shards[shard->index / 64], ~(1ULL << (shard->index % 64)), __ATOMIC_RELEASE);
+  if (--shared->refs == 0) {
+    chatroom->shared_channels->erase(shared->name);
+    delete shared;
+  }
+  pthread_mutex_unlock(&chatroom->shared_mutex);
+}
+
+bool IsValidChannelName(const char *name, size_t len) {
+  if (len == 0 || len > kMaxChannelNameLen) {
+    return false;
+  }
+
+  for (size_t i = 0; i < len; ++i) {
+    if (static_cast<unsigned char>(name[i]) <= ' ') {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+Channel *FindChannel(Shard *shard, const char *name, size_t len) {
+  auto it = shard->channels->find(std::string(name, len));
+  return it == shard->channels->end() ? nullptr : it->second;
+}
+
+int FindSubscription(Client *client, Channel *channel) {
+  for (int i = 0; i < client->num_subs; ++i) {
+    if (client->subs[i].channel == channel) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// 已经在频道中时只切换当前频道, 超过频道数限制返回false
+bool JoinChannel(Client *client, const char *name, size_t len) {
+  Shard *shard = client->shard;
+  Channel *channel = FindChannel(shard, name, len);
+  if (channel != nullptr && FindSubscription(client, channel) != -1) {
+    client->active = channel;
+    return true;
+  }
+
+  if (client->num_subs == kMaxChannelsPerClient) {
+    return false;
+  }
+
+  if (channel == nullptr) {
+    channel = new Channel();
+    channel->name.assign(name, len);
+    channel->shared = AcquireSharedChannel(shard, channel->name);
+    (*shard->channels)[channel->name] = channel;
+  }
+
+  if (client->num_subs == client->subs_cap) {
+    client->subs_cap = client->subs_cap ? client->subs_cap * 2 : 4;
+    client->subs = static_cast<Subscription*>(
+        ChatRealloc(client->subs, sizeof(Subscription) * client->subs_cap));
+  }
+
+  client->subs[client->num_subs++] = Subscription{channel, channel->members.size()};
+  channel->members.push_back(client);
+  client->active = channel;
+  return true;
+}
+
+void PartChannel(Client *client, Channel *channel) {
+  int sub = FindSubscription(client, channel);
+  if (sub == -1) {
+    return;
+  }
+
+  // 最后一个成员移到空出的位置, 同时修正它记录的下标
+  size_t index = client->subs[sub].member_index;
+  Client *last = channel->members.back();
+  channel->members[index] = last;
+  channel->members.pop_back();
+  if (last != client) {
+    last->subs[FindSubscription(last, channel)].member_index = index;
+  }
+
+  --client->num_subs;
+  memmove(client->subs + sub, client->subs + sub + 1,
+          sizeof(Subscription) * (client->num_subs - sub));
+  if (client->active == channel) {
+    client->active = client->num_subs > 0 ? client->subs[client->num_subs - 1].channel : nullptr;
+  }
+
+  if (channel->members.empty()) {
+    client->shard->channels->erase(channel->name);
+    ReleaseSharedChannel(client->shard, channel->shared);
+    delete channel;
+  }
+}
+
 void FreeClient(Client *client) {
-  free(client->nickname);
+  Shard *shard = client->shard;
+  while (client->num_subs > 0) {
+    PartChannel(client, client->subs[client->num_subs - 1].channel);
+  }
+  free(client->subs);
+
+  if (shard->reactor != nullptr) {
+    ReactorRemove(shard->reactor, client->fd);
+  }
+  TimerWheelCancel(&shard->timers, &client->idle_timer);
+  if (client->nickname != client->inline_nickname) {
+    free(client->nickname);
+  }
+  OutputQueueFree(&client->output);
+  InputBufferFree(&client->input);
+  if (client->frame_msg != nullptr) {
+    ReleaseChatMessage(client->frame_msg);
+  }
+  free(client->frame_arg);
   ::shutdown(client->fd, SHUT_RDWR);
   ::close(client->fd);
 
-  chatroom->clients[client->fd] = nullptr;
-  --chatroom->num_clients;
-  if (client->fd == chatroom->max_client_fd) {
-    int i = 0;
-    for (i = chatroom->max_client_fd; i >= 0; --i) {
-      if (chatroom->clients[i] != nullptr) {
-        chatroom->max_client_fd = i;
-        break;
-      }
+  SlotMapRemove(&shard->clients, client->fd);
+  SlabFree(&shard->client_slab, client);
+}
+
+void ScheduleFlush(Client *client) {
+  if (client->flush_pending) {
+    return;
+  }
+
+  client->flush_pending = true;
+  client->next_flush = client->shard->flush_list;
+  client->shard->flush_list = client;
+}
+
+// 客户端只在FlushPendingClients中释放, 这样事件回调和广播过程中拿到的指针一直有效
+void CloseClient(Client *client) {
+  client->closing = true;
+  ScheduleFlush(client);
+}
+
+/*
+ * 服务器发出的消息都带着帧头, 分帧客户端从头发送, 其他客户端跳过帧头,
+ * 同一条广播因此可以同时发给两种协议的客户端.
+ */
+ChatMessage *CreateFramedMessage(int type, size_t payload_len) {
+  ChatMessage *msg = CreateChatMessage(FRAME_HEADER_LEN + payload_len);
+  FrameEncodeHeader(msg->data, type, payload_len);
+  return msg;
+}
+
+// 广播内容为"[频道] 昵称> 正文", 返回的消息只填好了正文之前的部分
+ChatMessage *CreateBroadcastMsg(const Channel *channel, const char *nickname, size_t text_len,
+                                size_t *text_pos) {
+  size_t channel_len = channel->name.size();
+  size_t nickname_len = strlen(nickname);
+  size_t prefix_len = channel_len + 3 + nickname_len + 2;
+  ChatMessage *msg = CreateFramedMessage(FRAME_MSG, prefix_len + text_len);
+  char *p = msg->data + FRAME_HEADER_LEN;
+  p[0] = '[';
+  memcpy(p + 1, channel->name.data(), channel_len);
+  memcpy(p + 1 + channel_len, "] ", 2);
+  p += channel_len + 3;
+  memcpy(p, nickname, nickname_len);
+  memcpy(p + nickname_len, "> ", 2);
+  *text_pos = FRAME_HEADER_LEN + prefix_len;
+  return msg;
+}
+
+void SendToClient(Client *client, ChatMessage *msg) {
+  if (client->closing) {
+    return;
+  }
+
+  size_t start = client->protocol == kProtocolFrame ? 0 : FRAME_HEADER_LEN;
+  OutputQueuePush(&client->output, msg, start);
+  if (OutputQueueBytes(&client->output) > kMaxOutputBytes) {
+    printf("Dropped slow client fd=%d, nickname=%s\n", client->fd, client->nickname);
+    CloseClient(client);
+    return;
+  }
+
+  ScheduleFlush(client);
+}
 
+void SendTextToClient(Client *client, int type, const char *text) {
+  size_t text_len = strlen(text);
+  ChatMessage *msg = CreateFramedMessage(type, text_len);
+  memcpy(msg->data + FRAME_HEADER_LEN, text, text_len);
+  SendToClient(client, msg);
+  ReleaseChatMessage(msg);
+}
+
+uint64_t PackUserData(void *ptr, UringOp op) {
+  return reinterpret_cast<uintptr_t>(ptr) | op;
+}
+
+/*
+ * io_uring下每个连接同时最多有一个写请求在内核中, 完成后再发送之后排队的消息,
+ * 一轮中所有连接的写请求在下次等待时一起提交. 关闭时先把已经排队的数据提交一次,
+ * 再取消fd上的请求(写不完的就丢弃), 内核中的请求都结束后才能释放连接.
+ */
+void FlushClientUring(Client *client) {
+  Uring *ring = client->shard->ring;
+  if (!client->write_inflight && !client->cancelled && OutputQueueBytes(&client->output) > 0) {
+    struct iovec iov[kUringMaxIov];
+    int iovcnt = OutputQueuePrepare(&client->output, iov, kUringMaxIov);
+    if (UringSendmsg(ring, client->fd, iov, iovcnt, PackUserData(client, kUringWrite)) == 0) {
+      client->write_inflight = true;
+    } else {
+      client->closing = true;
     }
+  }
 
-    if (i == -1) {
-      chatroom->max_client_fd = -1;
+  if (client->closing) {
+    if (!client->recv_armed && !client->write_inflight) {
+      FreeClient(client);
+    } else if (!client->cancelled) {
+      client->cancelled = true;
+      UringCancelFd(ring, client->fd, PackUserData(nullptr, kUringCancel));
     }
+    return;
   }
 
-  free(client);
+  if (!client->recv_armed) {
+    if (UringRecvMultishot(ring, client->fd, PackUserData(client, kUringRecv)) == 0) {
+      client->recv_armed = true;
+    } else {
+      CloseClient(client);
+    }
+  }
 }
 
-void InitChatRoom() {
-  chatroom = static_cast<ChatState*>(ChatMalloc(sizeof(*chatroom)));
-  memset(chatroom, 0, sizeof(*chatroom));
+void FlushClient(Client *client) {
+  if (client->shard->ring != nullptr) {
+    FlushClientUring(client);
+    return;
+  }
 
-  chatroom->max_client_fd = -1;
-  chatroom->num_clients = 0;
-  chatroom->server_sock = CreateTCPServer(kServerPort);
-  if (chatroom->server_sock == -1) {
-    exit(1);
+  // 关闭前也尽量把已经排队的数据(例如超时提示)发出去, 写不完就丢弃
+  if (OutputQueueFlush(&client->output, client->fd) == -1) {
+    client->closing = true;
+  }
+
+  if (client->closing) {
+    FreeClient(client);
+    return;
+  }
+
+  // 还有数据没写完就等可写事件, 写完了就不再关注可写
+  int events = REACTOR_READABLE;
+  if (OutputQueueBytes(&client->output) > 0) {
+    events |= REACTOR_WRITABLE;
   }
+  ReactorModify(client->shard->reactor, client->fd, events);
 }
 
-void FreeChatRoom() {
-  for (int i = 0; i < chatroom->max_client_fd; ++i) {
-    if (chatroom->clients[i] != nullptr) {
-      FreeClient(chatroom->clients[i]);
+// 每轮事件处理完之后调用
+void FlushPendingClients(Shard *shard) {
+  while (shard->flush_list != nullptr) {
+    Client *client = shard->flush_list;
+    shard->flush_list = client->next_flush;
+    client->flush_pending = false;
+    client->next_flush = nullptr;
+    FlushClient(client);
+  }
+}
+
+// 只写给本分片中频道的订阅者, 每个订阅者只增加一个引用
+void SendMsgToShardChannelBut(Shard *shard, const char *channel_name, size_t channel_len,
+                              Client *excluded, ChatMessage *msg) {
+  Channel *channel = FindChannel(shard, channel_name, channel_len);
+  if (channel == nullptr) {
+    return;
+  }
+
+  for (Client *member : channel->members) {
+    if (member != excluded) {
+      SendToClient(member, msg);
     }
   }
+}
 
-  free(chatroom);
+// 本分片直接发送, 其他分片各投递一个引用到邮箱, 由它们自己的线程发给各自的订阅者
+void PublishToChannel(Client *sender, ChatMessage *msg) {
+  Shard *shard = sender->shard;
+  const std::string &name = sender->active->name;
+  SendMsgToShardChannelBut(shard, name.data(), name.size(), sender, msg);
+
+  /*
+   * 只投递给位图中有成员的分片. 位图可能稍微过时: 刚有成员加入的分片收不到这条消息,
+   * 等同于成员在消息之后加入; 刚变空的分片收到后找不到频道, 直接丢弃.
+   */
+  const std::vector<uint64_t> &words = sender->active->shared->shards;
+  int posted = 0;
+  for (size_t w = 0; w < words.size(); ++w) {
+    uint64_t bits = __atomic_load_n(&words[w], __ATOMIC_ACQUIRE);
+    while (bits != 0) {
+      int i = static_cast<int>(w * 64) + __builtin_ctzll(bits);
+      bits &= bits - 1;
+      Shard *target = &chatroom->shards[i];
+      if (target == shard) {
+        continue;
+      }
+
+      BroadcastMsg *broadcast = static_cast<BroadcastMsg*>(ChatMalloc(sizeof(*broadcast) + name.size()));
+      broadcast->msg = RetainChatMessage(msg);
+      broadcast->channel_len = name.size();
+      memcpy(broadcast->channel, name.data(), name.size());
+      MailboxPush(&target->mailbox, &broadcast->node);
+      ++posted;
+    }
+  }
+  shard->posts += posted;
+  shard->skipped_posts += chatroom->num_shards - 1 - posted;
 }
 
-void SendMsgToAllClientBut(int excluded_fd, char *msg, size_t msg_len) {
-  for (int i = 0; i <= chatroom->max_client_fd; ++i) {
-    if (chatroom->clients[i] == nullptr ||
-        i == excluded_fd) {
-      continue;
+void HandleMailbox(Reactor *reactor, int fd, int events, void *data) {
+  Shard *shard = static_cast<Shard*>(data);
+  MailboxClearWake(&shard->mailbox);
+
+  MailboxNode *node;
+  while ((node = MailboxPop(&shard->mailbox)) != nullptr) {
+    BroadcastMsg *broadcast = reinterpret_cast<BroadcastMsg*>(node);
+    SendMsgToShardChannelBut(shard, broadcast->channel, broadcast->channel_len, nullptr, broadcast->msg);
+    ReleaseChatMessage(broadcast->msg);
+    free(broadcast);
+  }
+}
+
+// 空闲超过心跳间隔时发送FRAME_PING, 之后到空闲超时还没有收到数据就断开
+void HandleIdleTimer(TimerWheel *wheel, TimerNode *node, void *data) {
+  Client *client = static_cast<Client*>(data);
+  if (client->closing) {
+    return;
+  }
+
+  if (!client->pinged) {
+    client->pinged = true;
+    if (client->protocol == kProtocolFrame) {
+      SendTextToClient(client, FRAME_PING, "");
+    }
+    TimerWheelSchedule(wheel, node, NowMs() + chatroom->idle_timeout_ms - chatroom->heartbeat_ms);
+    return;
+  }
+
+  printf("Idle timeout client fd=%d, nickname=%s\n", client->fd, client->nickname);
+  SendTextToClient(client, FRAME_ERROR, "Idle timeout\n");
+  CloseClient(client);
+}
+
+void AddClient(Shard *shard, int fd) {
+  Client *client = CreateClient(shard, fd);
+  JoinChannel(client, kDefaultChannel, strlen(kDefaultChannel));
+  SendToClient(client, shard->welcome_msg);
+  printf("Connected client fd=%d\n", fd);
+}
+
+/*
+ * 边沿触发下监听socket只通知一次, 这里批量接受直到队列为空或者用完本轮的预算.
+ * 用完预算时标记accept_pending, 事件循环在下一轮不等待直接回来继续接受.
+ */
+void AcceptPendingClients(Shard *shard) {
+  int fds[kAcceptBatch];
+  int accepted = 0;
+  shard->accept_pending = false;
+  while (accepted < kAcceptBudget) {
+    int count = AcceptClients(shard->server_sock, fds, kAcceptBatch);
+    for (int i = 0; i < count; ++i) {
+      AddClient(shard, fds[i]);
     }
 
-    write(i, msg, msg_len);
+    if (count < kAcceptBatch) {
+      return;
+    }
+    accepted += count;
   }
+
+  shard->accept_pending = true;
 }
 
-bool stopped = false;
+void HandleAccept(Reactor *reactor, int fd, int events, void *data) {
+  AcceptPendingClients(static_cast<Shard*>(data));
+}
+
+void SetNickname(Client *client, const char *nickname, size_t len) {
+  if (client->nickname != client->inline_nickname) {
+    free(client->nickname);
+  }
 
-void SigHandler(int sig) {
-  stopped = true;
+  if (len < sizeof(client->inline_nickname)) {
+    client->nickname = client->inline_nickname;
+  } else {
+    client->nickname = static_cast<char*>(ChatMalloc(len + 1));
+  }
+  memcpy(client->nickname, nickname, len);
+  client->nickname[len] = 0;
 }
 
-int main(int argc, char **argv) {
-  InitChatRoom();
-
-  struct sigaction sig_action;
-  sig_action.sa_handler = SigHandler;
-  sigaction(SIGINT, &sig_action, nullptr);
-  sigaction(SIGTERM, &sig_action, nullptr);
-  
-  while (!stopped) {
-    fd_set readfds;
-    FD_ZERO(&readfds);
-    FD_SET(chatroom->server_sock, &readfds);
-
-    for (int i = 0; i <= chatroom->max_client_fd; ++i) {
-      if (chatroom->clients[i] == nullptr) {
-        continue;
-      }
+void CommandJoin(Client *client, const char *name, size_t len) {
+  if (!IsValidChannelName(name, len)) {
+    SendTextToClient(client, FRAME_ERROR, "Invalid channel name\n");
+  } else if (!JoinChannel(client, name, len)) {
+    SendTextToClient(client, FRAME_ERROR, "Too many channels\n");
+  }
+}
+
+// 不指定频道时离开当前频道
+void CommandPart(Client *client, const char *name, size_t len) {
+  Channel *channel = len > 0 ? FindChannel(client->shard, name, len) : client->active;
+  if (channel == nullptr || FindSubscription(client, channel) == -1) {
+    SendTextToClient(client, FRAME_ERROR, "Not in channel\n");
+    return;
+  }
+
+  PartChannel(client, channel);
+}
+
+// 处理一行完整的输入, line以换行结尾, 不以0结尾
+void HandleLine(Client *client, const char *line, size_t len) {
+  if (line[0] == '/') {
+    size_t cmd_len = len - 1;
+    if (cmd_len > 0 && line[cmd_len - 1] == '\r') {
+      --cmd_len;
+    }
+
+    const char *arg = static_cast<const char*>(memchr(line, ' ', cmd_len));
+    size_t name_len = arg ? arg - line : cmd_len;
+    size_t arg_len = 0;
+    if (arg) {
+      ++arg;
+      arg_len = line + cmd_len - arg;
+    }
 
-      FD_SET(i, &readfds);
+    if (name_len == 5 && memcmp(line, "/nick", 5) == 0 && arg) {
+      SetNickname(client, arg, arg_len);
+    } else if (name_len == 5 && memcmp(line, "/join", 5) == 0) {
+      CommandJoin(client, arg, arg_len);
+    } else if (name_len == 5 && memcmp(line, "/part", 5) == 0) {
+      CommandPart(client, arg, arg_len);
+    } else {
+      const char *err_msg = "Unsupported command\n";
+      SendTextToClient(client, FRAME_ERROR, err_msg);
     }
 
-    struct timeval tv;
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
+    return;
+  }
+
+  if (client->active == nullptr) {
+    SendTextToClient(client, FRAME_ERROR, "Join a channel first\n");
+    return;
+  }
+
+  // 直接格式化到共享消息中, 之后所有接收者都不再复制
+  size_t text_pos;
+  ChatMessage *msg = CreateBroadcastMsg(client->active, client->nickname, len, &text_pos);
+  memcpy(msg->data + text_pos, line, len);
+  printf("%s", msg->data + FRAME_HEADER_LEN);
 
-    int max_fd = chatroom->max_client_fd;
-    if (max_fd < chatroom->server_sock) {
-      max_fd = chatroom->server_sock;
+  PublishToChannel(client, msg);
+  ReleaseChatMessage(msg);
+}
+
+/*
+ * 行协议, 处理一次read读到的数据中所有完整的行
+ *
+ * 完整的行直接在读缓冲中处理, 末尾不完整的部分留在连接的输入缓冲中,
+ * 下次先在新数据中找到第一个换行把它补全. 每个字节只被memchr扫描一次.
+ */
+bool HandleClientLines(Client *client, const char *data, size_t len) {
+  InputBuffer *input = &client->input;
+  const char *end = data + len;
+  const char *nl;
+
+  if (input->len > 0) {
+    nl = static_cast<const char*>(memchr(data, '\n', len));
+    const char *stop = nl ? nl + 1 : end;
+    if (input->len + (stop - data) > kMaxLineLen) {
+      return false;
     }
 
-    int ret = select(max_fd + 1, &readfds, nullptr, nullptr, &tv);
-    if (ret == -1) {
-      if (errno == EINTR) {
-        printf("interrputed by SIGINT\n");
+    InputBufferAppend(input, data, stop - data);
+    if (nl == nullptr) {
+      return true;
+    }
+
+    HandleLine(client, input->data, input->len);
+    InputBufferClear(input);
+    data = stop;
+  }
+
+  while ((nl = static_cast<const char*>(memchr(data, '\n', end - data))) != nullptr) {
+    HandleLine(client, data, nl + 1 - data);
+    data = nl + 1;
+  }
+
+  if (data < end) {
+    if (static_cast<size_t>(end - data) > kMaxLineLen) {
+      return false;
+    }
+    InputBufferAppend(input, data, end - data);
+  }
+
+  return true;
+}
+
+void HandleFrameBegin(Client *client, const FrameEvent &event) {
+  switch (event.type) {
+    case FRAME_MSG:
+      if (client->active == nullptr) {
+        SendTextToClient(client, FRAME_ERROR, "Join a channel first\n");
         break;
       }
-      perror("Select failed");
-      exit(1);
+      // 行协议的消息自带换行, 这里补上, 两种客户端收到的广播内容相同
+      client->frame_msg = CreateBroadcastMsg(client->active, client->nickname, event.len + 1,
+                                             &client->frame_pos);
+      break;
+    case FRAME_NICK:
+    case FRAME_JOIN:
+    case FRAME_PART:
+      client->frame_arg = static_cast<char*>(ChatMalloc(event.len + 1));
+      client->frame_pos = 0;
+      break;
+    case FRAME_PING:
+      SendTextToClient(client, FRAME_PONG, "");
+      break;
+    case FRAME_PONG:
+      // 收到数据时已经重置了空闲定时器
+      break;
+    default:
+      // 内容直接丢弃
+      SendTextToClient(client, FRAME_ERROR, "Unsupported frame type\n");
+      break;
+  }
+}
+
+void HandleFrameData(Client *client, const FrameEvent &event) {
+  if (client->frame_msg != nullptr) {
+    memcpy(client->frame_msg->data + client->frame_pos, event.data, event.data_len);
+  } else if (client->frame_arg != nullptr) {
+    memcpy(client->frame_arg + client->frame_pos, event.data, event.data_len);
+  }
+  client->frame_pos += event.data_len;
+}
+
+void HandleFrameEnd(Client *client, const FrameEvent &event) {
+  if (client->frame_msg != nullptr) {
+    ChatMessage *msg = client->frame_msg;
+    client->frame_msg = nullptr;
+    msg->data[client->frame_pos] = '\n';
+    printf("%s", msg->data + FRAME_HEADER_LEN);
+
+    PublishToChannel(client, msg);
+    ReleaseChatMessage(msg);
+    return;
+  }
+
+  if (client->frame_arg == nullptr) {
+    return;
+  }
+
+  char *arg = client->frame_arg;
+  size_t arg_len = client->frame_pos;
+  client->frame_arg = nullptr;
+  switch (event.type) {
+    case FRAME_NICK:
+      SetNickname(client, arg, arg_len);
+      break;
+    case FRAME_JOIN:
+      CommandJoin(client, arg, arg_len);
+      break;
+    case FRAME_PART:
+      CommandPart(client, arg, arg_len);
+      break;
+  }
+  free(arg);
+}
+
+// 分帧协议, 帧可以被切分在多次read中, 内容从读缓冲直接拷贝到最终位置
+bool HandleClientFrames(Client *client, const char *data, size_t len) {
+  FrameEvent event;
+  do {
+    size_t consumed = FrameParse(&client->parser, data, len, &event);
+    data += consumed;
+    len -= consumed;
+
+    switch (event.kind) {
+      case FRAME_EVENT_BEGIN:
+        HandleFrameBegin(client, event);
+        break;
+      case FRAME_EVENT_DATA:
+        HandleFrameData(client, event);
+        break;
+      case FRAME_EVENT_END:
+        HandleFrameEnd(client, event);
+        break;
+      case FRAME_EVENT_ERROR:
+        return false;
+    }
+  } while (event.kind != FRAME_EVENT_NONE);
+
+  return true;
+}
+
+// 返回false表示协议错误, 连接需要关闭
+bool HandleClientData(Client *client, const char *read_buf, int read_size) {
+  client->pinged = false;
+  TimerWheelSchedule(&client->shard->timers, &client->idle_timer, NowMs() + chatroom->heartbeat_ms);
+
+  if (client->protocol == kProtocolUnknown) {
+    client->protocol = read_buf[0] == FRAME_MAGIC ? kProtocolFrame : kProtocolLine;
+  }
+
+  if (client->protocol == kProtocolFrame) {
+    return HandleClientFrames(client, read_buf, read_size);
+  }
+
+  return HandleClientLines(client, read_buf, read_size);
+}
+
+void HandleClientEvent(Reactor *reactor, int fd, int events, void *data) {
+  Client *client = static_cast<Client*>(data);
+  if (client->closing) {
+    return;
+  }
+
+  if (events & REACTOR_WRITABLE) {
+    ScheduleFlush(client);
+  }
+
+  // 只是可写时不读, 省掉一次必然返回EAGAIN的read
+  if (!(events & (REACTOR_READABLE | REACTOR_ERROR))) {
+    return;
+  }
+
+  // 边沿触发, 一直读到EAGAIN; 对端关闭时先把已经到达的数据处理完
+  char read_buf[kReadBufSize];
+  while (true) {
+    int read_size = read(fd, read_buf, sizeof(read_buf));
+    if (read_size > 0) {
+      if (!HandleClientData(client, read_buf, read_size)) {
+        printf("Protocol error from client fd=%d, nickname=%s\n", fd, client->nickname);
+        CloseClient(client);
+        return;
+      }
+      continue;
     }
 
-    if (ret == 0) {
+    if (read_size == -1 && errno == EINTR) {
       continue;
     }
 
-    if (FD_ISSET(chatroom->server_sock, &readfds)) {
-      int fd = AcceptClient(chatroom->server_sock);
-      Client *client = CreateClient(fd);
-      const char *welcome_msg =
-        "Welcome to Chatroom! "
-        "Use /nick <nickname> to set your nickname.\n";
-      write(client->fd, welcome_msg, strlen(welcome_msg));
-      printf("Connected client fd=%d\n", fd);
+    if (read_size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+        !(events & REACTOR_ERROR)) {
+      return;
     }
 
-    char read_buf[256];
-    for (int i = 0; i <= chatroom->max_client_fd; ++i) {
-      if (chatroom->clients[i] == nullptr) {
-        continue;
+    printf("Disconnected client fd=%d, nickname=%s\n", fd, client->nickname);
+    CloseClient(client);
+    return;
+  }
+}
+
+// 多次接收的请求不带MORE标志时已经结束: 对端关闭或出错时关闭连接, 缓冲用完(ENOBUFS)时重新挂上
+void HandleUringRecv(Client *client, const io_uring_cqe &cqe) {
+  Uring *ring = client->shard->ring;
+  if (cqe.flags & IORING_CQE_F_BUFFER) {
+    unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    if (cqe.res > 0 && !client->closing && !HandleClientData(client, UringBuffer(ring, bid), cqe.res)) {
+      printf("Protocol error from client fd=%d, nickname=%s\n", client->fd, client->nickname);
+      CloseClient(client);
+    }
+    UringRecycleBuffer(ring, bid);
+  }
+
+  if (cqe.flags & IORING_CQE_F_MORE) {
+    return;
+  }
+
+  client->recv_armed = false;
+  if (!client->closing && (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS))) {
+    printf("Disconnected client fd=%d, nickname=%s\n", client->fd, client->nickname);
+    CloseClient(client);
+  }
+  ScheduleFlush(client);
+}
+
+void HandleUringWrite(Client *client, const io_uring_cqe &cqe) {
+  client->write_inflight = false;
+  if (cqe.res >= 0) {
+    OutputQueueConsume(&client->output, cqe.res);
+  } else if (!client->closing) {
+    printf("Disconnected client fd=%d, nickname=%s\n", client->fd, client->nickname);
+    CloseClient(client);
+  }
+
+  if (client->closing || OutputQueueBytes(&client->output) > 0) {
+    ScheduleFlush(client);
+  }
+}
+
+void HandleUringAccept(Shard *shard, const io_uring_cqe &cqe) {
+  if (cqe.res >= 0) {
+    AddClient(shard, cqe.res);
+  } else {
+    fprintf(stderr, "Accept client failed: %s\n", strerror(-cqe.res));
+  }
+
+  if (!(cqe.flags & IORING_CQE_F_MORE) &&
+      UringAcceptMultishot(shard->ring, shard->server_sock, SOCK_CLOEXEC,
+                           PackUserData(shard, kUringAccept)) == -1) {
+    exit(1);
+  }
+}
+
+void HandleCompletion(Shard *shard, const io_uring_cqe &cqe) {
+  void *ptr = reinterpret_cast<void*>(cqe.user_data & ~kUringOpMask);
+  switch (cqe.user_data & kUringOpMask) {
+    case kUringAccept:
+      HandleUringAccept(shard, cqe);
+      break;
+    case kUringMailbox:
+      HandleMailbox(nullptr, MailboxFd(&shard->mailbox), REACTOR_READABLE, shard);
+      if (!(cqe.flags & IORING_CQE_F_MORE) &&
+          UringPollMultishot(shard->ring, MailboxFd(&shard->mailbox), POLLIN,
+                             PackUserData(shard, kUringMailbox)) == -1) {
+        exit(1);
       }
+      break;
+    case kUringRecv:
+      HandleUringRecv(static_cast<Client*>(ptr), cqe);
+      break;
+    case kUringWrite:
+      HandleUringWrite(static_cast<Client*>(ptr), cqe);
+      break;
+    default:
+      // 取消请求自己的结果, 被取消的请求会各自产生完成事件
+      break;
+  }
+}
 
-      if (FD_ISSET(i, &readfds)) {
-        int read_size = read(i, read_buf, sizeof(read_buf));
-
-        if (read_size <= 0) {
-          printf("Disconnected client fd=%d, nickname=%s",
-            i, chatroom->clients[i]->nickname);
-          FreeClient(chatroom->clients[i]);
-          continue;
-        }
-
-        Client *client = chatroom->clients[i];
-        read_buf[read_size] = 0;
-
-        if (read_buf[0] == '/') {
-          char *p;
-          p = strchr(read_buf, '\r');
-          if (p) {
-            *p = 0;
-          }
-
-          p = strchr(read_buf, '\n');
-          if (p) {
-            *p = 0;
-          }
-
-          char *arg = strchr(read_buf, ' ');
-          if (arg) {
-            *arg = 0;
-            ++arg;
-          }
-
-          if (strcmp(read_buf, "/nick") == 0 && arg) {
-            free(client->nickname);
-            int nickname_len = strlen(arg);
-            client->nickname = static_cast<char*>(ChatMalloc(nickname_len));
-            memcpy(client->nickname, arg, nickname_len + 1);
-          } else {
-            const char *err_msg = "Unsupported command\n";
-            write(i, err_msg, strlen(err_msg));
-          }
-
-          continue;
-        }
-
-        char msg[256];
-        int msg_len =
-            snprintf(msg, sizeof(msg), "%s> %s", client->nickname, read_buf);
-        printf("%s", msg);
-
-        SendMsgToAllClientBut(i, msg, msg_len);
+// 失败时返回nullptr, 分片改用epoll
+Uring *CreateShardRing() {
+  Uring *ring = static_cast<Uring*>(ChatMalloc(sizeof(Uring)));
+  if (UringInit(ring, kUringEntries) == -1) {
+    free(ring);
+    return nullptr;
+  }
+
+  if (UringSetupBuffers(ring, kUringBufCount, kReadBufSize) == -1) {
+    UringFree(ring);
+    free(ring);
+    return nullptr;
+  }
+
+  return ring;
+}
+
+void InitShard(Shard *shard, int index) {
+  memset(shard, 0, sizeof(*shard));
+  shard->index = index;
+  SlotMapInit(&shard->clients);
+  SlabInit(&shard->client_slab, sizeof(Client), kClientsPerChunk);
+  TimerWheelInit(&shard->timers, kTimerTickMs, NowMs());
+
+  shard->channels = new ChannelMap();
+  const char *welcome_text =
+    "Welcome to Chatroom! "
+    "Use /nick <nickname> to set your nickname, "
+    "/join <channel> and /part [channel] to switch channels.\n";
+  shard->welcome_msg = CreateFramedMessage(FRAME_MSG, strlen(welcome_text));
+  memcpy(shard->welcome_msg->data + FRAME_HEADER_LEN, welcome_text, strlen(welcome_text));
+  if (chatroom->use_uring) {
+    shard->ring = CreateShardRing();
+    if (shard->ring == nullptr) {
+      fprintf(stderr, "io_uring unavailable, shard %d falls back to epoll\n", index);
+    }
+  }
+  if (shard->ring == nullptr) {
+    shard->reactor = CreateReactor();
+    if (shard->reactor == nullptr) {
+      exit(1);
+    }
+  }
+  if (MailboxInit(&shard->mailbox) == -1) {
+    exit(1);
+  }
+
+  shard->server_sock = CreateTCPServerReusePort(kServerPort);
+  if (shard->server_sock == -1) {
+    exit(1);
+  }
+
+  // io_uring在内核中等待就绪, 监听socket和连接都保持阻塞模式, 请求由分片线程自己提交
+  if (shard->ring != nullptr) {
+    SetSocketNoDelay(shard->server_sock);
+    return;
+  }
+
+  // 边沿触发, 监听socket也必须是非阻塞的, 每次事件都要接受到没有新连接为止;
+  // 在监听socket上设置TCP_NODELAY, 接受的连接会继承
+  SetSocketNonBlockNoDelay(shard->server_sock);
+  ReactorAdd(shard->reactor, shard->server_sock, REACTOR_READABLE, HandleAccept, shard);
+  ReactorAdd(shard->reactor, MailboxFd(&shard->mailbox), REACTOR_READABLE, HandleMailbox, shard);
+}
+
+void FreeShard(Shard *shard) {
+  // 先关闭ring, 内核取消所有未完成的请求
+  if (shard->ring != nullptr) {
+    UringFree(shard->ring);
+    free(shard->ring);
+    shard->ring = nullptr;
+  }
+
+  // FreeClient会把最后一个元素移到空位, 从后往前释放
+  while (SlotMapSize(&shard->clients) > 0) {
+    FreeClient(static_cast<Client*>(SlotMapAt(&shard->clients, SlotMapSize(&shard->clients) - 1)));
+  }
+
+  // 其他分片退出前可能还投递了消息
+  MailboxNode *node;
+  while ((node = MailboxPop(&shard->mailbox)) != nullptr) {
+    BroadcastMsg *broadcast = reinterpret_cast<BroadcastMsg*>(node);
+    ReleaseChatMessage(broadcast->msg);
+    free(broadcast);
+  }
+
+  delete shard->channels;
+  ReleaseChatMessage(shard->welcome_msg);
+  if (shard->reactor != nullptr) {
+    FreeReactor(shard->reactor);
+  }
+  MailboxDestroy(&shard->mailbox);
+  close(shard->server_sock);
+  SlotMapFree(&shard->clients);
+  SlabDestroy(&shard->client_slab);
+}
+
+/*
+ * io_uring下的事件循环: 上一轮填好的请求(接收, 写, 取消)和这一轮的等待合并在一次io_uring_enter中,
+ * 建连和接收都是多次请求, 只在内核结束它们时重新提交.
+ */
+void UringShardLoop(Shard *shard) {
+  Uring *ring = shard->ring;
+  if (UringEnable(ring) == -1 ||
+      UringAcceptMultishot(ring, shard->server_sock, SOCK_CLOEXEC, PackUserData(shard, kUringAccept)) == -1 ||
+      UringPollMultishot(ring, MailboxFd(&shard->mailbox), POLLIN, PackUserData(shard, kUringMailbox)) == -1) {
+    exit(1);
+  }
+
+  io_uring_cqe cqes[kUringBatch];
+  while (!__atomic_load_n(&stopped, __ATOMIC_RELAXED)) {
+    if (UringSubmit(ring, 1, TimerWheelTimeout(&shard->timers, NowMs())) == -1) {
+      exit(1);
+    }
+
+    int count;
+    while ((count = UringReap(ring, cqes, kUringBatch)) > 0) {
+      for (int i = 0; i < count; ++i) {
+        HandleCompletion(shard, cqes[i]);
       }
     }
+    TimerWheelAdvance(&shard->timers, NowMs());
+    FlushPendingClients(shard);
   }
+}
 
+void *ShardLoop(void *arg) {
+  Shard *shard = static_cast<Shard*>(arg);
+  if (shard->ring != nullptr) {
+    UringShardLoop(shard);
+    return nullptr;
+  }
+
+  while (!__atomic_load_n(&stopped, __ATOMIC_RELAXED)) {
+    // 等待时间由最近的定时器决定, 没有定时器时一直等到有事件或者被邮箱唤醒
+    int timeout = shard->accept_pending ? 0 : TimerWheelTimeout(&shard->timers, NowMs());
+    if (ReactorPoll(shard->reactor, timeout) == -1) {
+      exit(1);
+    }
+    if (shard->accept_pending) {
+      AcceptPendingClients(shard);
+    }
+    TimerWheelAdvance(&shard->timers, NowMs());
+    FlushPendingClients(shard);
+  }
+
+  return nullptr;
+}
+
+void InitChatRoom(int num_shards, int idle_timeout_sec, bool use_uring) {
+  chatroom = static_cast<ChatState*>(ChatMalloc(sizeof(*chatroom)));
+  chatroom->num_shards = num_shards;
+  chatroom->use_uring = use_uring;
+  chatroom->idle_timeout_ms = idle_timeout_sec * 1000ULL;
+  chatroom->heartbeat_ms = chatroom->idle_timeout_ms / 2;
+  chatroom->shared_channels = new SharedChannelMap();
+  pthread_mutex_init(&chatroom->shared_mutex, nullptr);
+  chatroom->shards = static_cast<Shard*>(ChatMalloc(sizeof(Shard) * num_shards));
+  for (int i = 0; i < num_shards; ++i) {
+    InitShard(&chatroom->shards[i], i);
+  }
+}
+
+void FreeChatRoom() {
+  for (int i = 0; i < chatroom->num_shards; ++i) {
+    FreeShard(&chatroom->shards[i]);
+  }
+
+  // 分片释放时所有频道都已删除, 共享记录也随之释放
+  assert(chatroom->shared_channels->empty());
+  delete chatroom->shared_channels;
+  pthread_mutex_destroy(&chatroom->shared_mutex);
+  free(chatroom->shards);
+  free(chatroom);
+}
+
+// 每个连接占用一个fd, 把软限制提到硬限制
+void RaiseFileLimit() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+int main(int argc, char **argv) {
+  int num_shards = argc > 1 ? atoi(argv[1]) : static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+  if (num_shards < 1) {
+    num_shards = 1;
+  }
+  int idle_timeout_sec = argc > 2 ? atoi(argv[2]) : kDefaultIdleTimeoutSec;
+  if (idle_timeout_sec < 1) {
+    idle_timeout_sec = kDefaultIdleTimeoutSec;
+  }
+
+  bool use_uring = argc > 3 && strcmp(argv[3], "uring") == 0;
+
+  RaiseFileLimit();
+  InitChatRoom(num_shards, idle_timeout_sec, use_uring);
+  signal(SIGPIPE, SIG_IGN);
+
+  // 信号只由主线程用sigwait处理, 分片线程继承屏蔽字
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+
+  printf("chatroom server listening on %d with %d reactor threads (%s), idle timeout %ds\n", kServerPort,
+         num_shards, chatroom->shards[0].ring != nullptr ? "io_uring" : "epoll", idle_timeout_sec);
+  for (int i = 0; i < num_shards; ++i) {
+    pthread_create(&chatroom->shards[i].thread, nullptr, ShardLoop, &chatroom->shards[i]);
+  }
+
+  int sig;
+  sigwait(&stop_signals, &sig);
+  __atomic_store_n(&stopped, true, __ATOMIC_RELAXED);
+
+  // 直接写邮箱的eventfd唤醒各线程, 让它们看到stopped
+  for (int i = 0; i < num_shards; ++i) {
+    uint64_t one = 1;
+    write(MailboxFd(&chatroom->shards[i].mailbox), &one, sizeof(one));
+  }
+  for (int i = 0; i < num_shards; ++i) {
+    pthread_join(chatroom->shards[i].thread, nullptr);
+  }
+
+  uint64_t posts = 0;
+  uint64_t skipped_posts = 0;
+  for (int i = 0; i < num_shards; ++i) {
+    posts += chatroom->shards[i].posts;
+    skipped_posts += chatroom->shards[i].skipped_posts;
+  }
+  printf("cross-shard broadcasts: %llu posted, %llu skipped (no members on target shard)\n",
+         static_cast<unsigned long long>(posts), static_cast<unsigned long long>(skipped_posts));
   printf("good bye\n");
 
   FreeChatRoom();
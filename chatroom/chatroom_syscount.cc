@@ -0,0 +1,180 @@
+/*
+ * 系统调用计数
+ *
+ * 用ptrace附加到进程的所有线程, 统计一段时间内每种系统调用的次数, 结束后分离, 进程继续正常运行.
+ * 用来比较服务器不同I/O后端每条消息的系统调用数: 先让chatroom_loadgen以固定速率压测,
+ * 再用这里输出的每秒调用数除以压测的每秒发送(或收到)的消息数.
+ * 跟踪会让被测进程明显变慢, 吞吐量要在不跟踪时单独测量, 压测速率也要低于跟踪下服务器的处理能力.
+ *
+ * 用法: chatroom_syscount <pid> [秒数]
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace {
+  constexpr int kDefaultSeconds = 5;
+
+  volatile sig_atomic_t timeout = 0;
+
+  void HandleAlarm(int) {
+    timeout = 1;
+  }
+
+  const char *SyscallName(long nr) {
+    switch (nr) {
+      case SYS_read: return "read";
+      case SYS_write: return "write";
+      case SYS_readv: return "readv";
+      case SYS_writev: return "writev";
+      case SYS_recvfrom: return "recvfrom";
+      case SYS_sendto: return "sendto";
+      case SYS_recvmsg: return "recvmsg";
+      case SYS_sendmsg: return "sendmsg";
+      case SYS_epoll_wait: return "epoll_wait";
+      case SYS_epoll_pwait: return "epoll_pwait";
+      case SYS_epoll_ctl: return "epoll_ctl";
+      case SYS_io_uring_enter: return "io_uring_enter";
+      case SYS_accept4: return "accept4";
+      case SYS_close: return "close";
+      case SYS_shutdown: return "shutdown";
+      case SYS_futex: return "futex";
+      case SYS_setsockopt: return "setsockopt";
+      case SYS_mmap: return "mmap";
+      case SYS_munmap: return "munmap";
+      case SYS_brk: return "brk";
+      default: return nullptr;
+    }
+  }
+
+  std::vector<pid_t> ListThreads(pid_t pid) {
+    std::vector<pid_t> tids;
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *dir = opendir(path);
+    if (dir == nullptr) {
+      return tids;
+    }
+
+    dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      if (entry->d_name[0] != '.') {
+        tids.push_back(atoi(entry->d_name));
+      }
+    }
+    closedir(dir);
+    return tids;
+  }
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: %s <pid> [seconds]\n", argv[0]);
+    exit(1);
+  }
+
+  pid_t pid = atoi(argv[1]);
+  int seconds = argc > 2 ? atoi(argv[2]) : kDefaultSeconds;
+
+  // 附加之后新建的线程不统计, 服务器的线程都在启动时创建
+  std::vector<pid_t> tids = ListThreads(pid);
+  for (pid_t tid : tids) {
+    if (ptrace(PTRACE_SEIZE, tid, nullptr, PTRACE_O_TRACESYSGOOD) == -1 ||
+        ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr) == -1) {
+      perror("Attach failed");
+      exit(1);
+    }
+  }
+
+  // 不设置SA_RESTART, 到时间后waitpid返回EINTR
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = HandleAlarm;
+  sigaction(SIGALRM, &action, nullptr);
+  alarm(seconds);
+
+  std::map<long, long> counts;
+  long total = 0;
+  while (!timeout) {
+    int status;
+    pid_t tid = waitpid(-1, &status, __WALL);
+    if (tid == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Wait failed");
+      break;
+    }
+    if (!WIFSTOPPED(status)) {
+      continue;
+    }
+
+    // 系统调用进入和返回都会停下, 只在进入时计数; 其他信号原样转交
+    int sig = WSTOPSIG(status);
+    int deliver = 0;
+    if (sig == (SIGTRAP | 0x80)) {
+      __ptrace_syscall_info info;
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) > 0 &&
+          info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        ++counts[info.entry.nr];
+        ++total;
+      }
+    } else if (status >> 16 != PTRACE_EVENT_STOP) {
+      deliver = sig;
+    }
+    ptrace(PTRACE_SYSCALL, tid, nullptr, deliver);
+  }
+
+  // 只能分离已经停下的线程: 先全部打断, 每个线程停下后分离
+  for (pid_t tid : tids) {
+    ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
+  }
+  size_t detached = 0;
+  while (detached < tids.size()) {
+    int status;
+    pid_t tid = waitpid(-1, &status, __WALL);
+    if (tid == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (WIFSTOPPED(status)) {
+      int sig = WSTOPSIG(status);
+      bool pass = sig != (SIGTRAP | 0x80) && status >> 16 != PTRACE_EVENT_STOP;
+      ptrace(PTRACE_DETACH, tid, nullptr, pass ? sig : 0);
+    }
+    ++detached;
+  }
+
+  std::vector<std::pair<long, long>> sorted(counts.begin(), counts.end());
+  std::sort(sorted.begin(), sorted.end(), [](const std::pair<long, long> &a, const std::pair<long, long> &b) {
+    return a.second > b.second;
+  });
+
+  printf("%-16s %-12s %-12s\n", "syscall", "calls", "calls/s");
+  for (const auto &[nr, count] : sorted) {
+    const char *name = SyscallName(nr);
+    char buf[32];
+    if (name == nullptr) {
+      snprintf(buf, sizeof(buf), "syscall %ld", nr);
+      name = buf;
+    }
+    printf("%-16s %-12ld %-12.0f\n", name, count, static_cast<double>(count) / seconds);
+  }
+  printf("total: %ld calls, %.0f calls/s in %d threads\n", total, static_cast<double>(total) / seconds,
+         static_cast<int>(tids.size()));
+  return 0;
+}
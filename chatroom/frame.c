@@ -0,0 +1,77 @@
+#include "frame.h"
+#include <string.h>
+
+void FrameParserInit(FrameParser *parser, uint32_t max_len) {
+  memset(parser, 0, sizeof(*parser));
+  parser->max_len = max_len;
+}
+
+size_t FrameParse(FrameParser *parser, const char *data, size_t len, FrameEvent *event) {
+  memset(event, 0, sizeof(*event));
+
+  if (!parser->in_payload) {
+    // 帧头可能跨越多次read, 只有这6个字节需要暂存
+    size_t n = FRAME_HEADER_LEN - parser->header_got;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(parser->header + parser->header_got, data, n);
+    parser->header_got += n;
+    if (parser->header_got < FRAME_HEADER_LEN) {
+      return n;
+    }
+
+    const unsigned char *h = parser->header;
+    uint32_t frame_len = ((uint32_t)h[2] << 24) | ((uint32_t)h[3] << 16) |
+                         ((uint32_t)h[4] << 8) | (uint32_t)h[5];
+    if (h[0] != FRAME_MAGIC || frame_len > parser->max_len) {
+      event->kind = FRAME_EVENT_ERROR;
+      return n;
+    }
+
+    parser->header_got = 0;
+    parser->in_payload = 1;
+    parser->type = h[1];
+    parser->len = frame_len;
+    parser->payload_got = 0;
+
+    event->kind = FRAME_EVENT_BEGIN;
+    event->type = parser->type;
+    event->len = parser->len;
+    return n;
+  }
+
+  event->type = parser->type;
+  event->len = parser->len;
+
+  if (parser->payload_got == parser->len) {
+    parser->in_payload = 0;
+    event->kind = FRAME_EVENT_END;
+    return 0;
+  }
+
+  if (len == 0) {
+    return 0;
+  }
+
+  size_t n = parser->len - parser->payload_got;
+  if (n > len) {
+    n = len;
+  }
+  parser->payload_got += n;
+
+  event->kind = FRAME_EVENT_DATA;
+  event->data = data;
+  event->data_len = n;
+  return n;
+}
+
+void FrameEncodeHeader(char *buf, int type, uint32_t len) {
+  unsigned char *h = (unsigned char*)buf;
+  h[0] = FRAME_MAGIC;
+  h[1] = (unsigned char)type;
+  h[2] = (unsigned char)(len >> 24);
+  h[3] = (unsigned char)(len >> 16);
+  h[4] = (unsigned char)(len >> 8);
+  h[5] = (unsigned char)len;
+}
@@ -0,0 +1,67 @@
+#ifndef CHATROOM_FRAME_H_
+#define CHATROOM_FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 与行协议并存的二进制分帧协议.
+ *
+ * 每帧: 1字节魔数(0x00) + 1字节类型 + 4字节大端长度 + 内容.
+ * 连接收到的第一个字节是魔数时按分帧协议处理, 否则按行协议处理, 之后不再切换.
+ * 在此之前服务器按行协议发送, 所以分帧客户端建立连接后应当先发一帧(通常是FRAME_NICK).
+ * 服务器连接建立时发送的欢迎语总是一行文本, 分帧客户端读到第一个换行后才开始解析帧.
+ *
+ * 解析器是增量的: 每次喂入read读到的任意一段数据, 帧头和内容都可以被切分在多次read中.
+ * 解析器自己不缓存内容, FRAME_EVENT_DATA直接指向调用者的读缓冲, 由调用者拷贝到最终位置.
+ */
+
+#define FRAME_MAGIC      0x00
+#define FRAME_HEADER_LEN 6
+
+// 帧类型
+#define FRAME_MSG   1  // 客户端发出的聊天内容, 服务器转发的广播(内容与行协议相同, 以换行结尾)
+#define FRAME_NICK  2  // 客户端设置昵称
+#define FRAME_ERROR 3  // 服务器返回的错误信息
+#define FRAME_JOIN  4  // 客户端加入频道, 内容为频道名
+#define FRAME_PART  5  // 客户端离开频道, 内容为频道名, 为空时离开当前频道
+#define FRAME_PING  6  // 心跳, 服务器在连接空闲时发送, 客户端也可以发送, 内容为空
+#define FRAME_PONG  7  // 心跳回复
+
+// 解析事件
+#define FRAME_EVENT_NONE  0  // 数据已经用完, 需要更多数据
+#define FRAME_EVENT_BEGIN 1  // 帧头解析完成, type和len有效
+#define FRAME_EVENT_DATA  2  // 一段内容, data和data_len有效, 可能被切成多段
+#define FRAME_EVENT_END   3  // 当前帧结束
+#define FRAME_EVENT_ERROR 4  // 魔数错误或者长度超过限制, 连接应当关闭
+
+typedef struct FrameEvent {
+  int kind;
+  int type;
+  uint32_t len;
+  const char *data;
+  size_t data_len;
+} FrameEvent;
+
+typedef struct FrameParser {
+  uint32_t max_len;
+  int in_payload;
+  unsigned char header[FRAME_HEADER_LEN];
+  size_t header_got;
+  int type;
+  uint32_t len;
+  uint32_t payload_got;
+} FrameParser;
+
+void FrameParserInit(FrameParser *parser, uint32_t max_len);
+
+/*
+ * 从data中解析出下一个事件
+ *
+ * 返回消耗的字节数, 调用者跳过这些字节后继续调用, 直到返回FRAME_EVENT_NONE
+ */
+size_t FrameParse(FrameParser *parser, const char *data, size_t len, FrameEvent *event);
+
+void FrameEncodeHeader(char *buf, int type, uint32_t len);
+
+#endif // CHATROOM_FRAME_H_
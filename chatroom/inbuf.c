@@ -0,0 +1,41 @@
+#include "inbuf.h"
+#include "chatlib.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INPUT_BUFFER_INIT_CAP 256
+#define INPUT_BUFFER_KEEP_CAP 4096  // 清空时超过这个大小的缓冲会被释放
+
+void InputBufferInit(InputBuffer *ib) {
+  ib->data = NULL;
+  ib->len = 0;
+  ib->cap = 0;
+}
+
+void InputBufferFree(InputBuffer *ib) {
+  free(ib->data);
+  InputBufferInit(ib);
+}
+
+void InputBufferAppend(InputBuffer *ib, const char *data, size_t len) {
+  if (ib->len + len > ib->cap) {
+    size_t cap = ib->cap ? ib->cap : INPUT_BUFFER_INIT_CAP;
+    while (cap < ib->len + len) {
+      cap <<= 1;
+    }
+    ib->data = ChatRealloc(ib->data, cap);
+    ib->cap = cap;
+  }
+
+  memcpy(ib->data + ib->len, data, len);
+  ib->len += len;
+}
+
+void InputBufferClear(InputBuffer *ib) {
+  if (ib->cap > INPUT_BUFFER_KEEP_CAP) {
+    InputBufferFree(ib);
+    return;
+  }
+
+  ib->len = 0;
+}
@@ -0,0 +1,23 @@
+#ifndef CHATROOM_INBUF_H_
+#define CHATROOM_INBUF_H_
+
+#include <stddef.h>
+
+/*
+ * 连接的输入缓冲, 只保存还没有收完的半行.
+ *
+ * 数据先读到线程的读缓冲中, 完整的行在原地处理, 只有末尾不完整的部分才追加到这里,
+ * 所以大多数连接的输入缓冲一直是空的, 不占内存. 清空时较大的缓冲会被释放.
+ */
+typedef struct InputBuffer {
+  char *data;
+  size_t len;
+  size_t cap;
+} InputBuffer;
+
+void InputBufferInit(InputBuffer *ib);
+void InputBufferFree(InputBuffer *ib);
+void InputBufferAppend(InputBuffer *ib, const char *data, size_t len);
+void InputBufferClear(InputBuffer *ib);
+
+#endif // CHATROOM_INBUF_H_
@@ -0,0 +1,84 @@
+#include "mailbox.h"
+#include <sys/eventfd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+int MailboxInit(Mailbox *mailbox) {
+  mailbox->stub.next = NULL;
+  mailbox->head = &mailbox->stub;
+  mailbox->tail = &mailbox->stub;
+  mailbox->wake_pending = 0;
+  mailbox->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (mailbox->event_fd == -1) {
+    perror("Create mailbox eventfd failed");
+    return -1;
+  }
+
+  return 0;
+}
+
+void MailboxDestroy(Mailbox *mailbox) {
+  close(mailbox->event_fd);
+  mailbox->event_fd = -1;
+}
+
+void MailboxPush(Mailbox *mailbox, MailboxNode *node) {
+  __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+  MailboxNode *prev = __atomic_exchange_n(&mailbox->tail, node, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+
+  // 消费者在取消息前清除wake_pending, 之后入队的投递者一定会再写一次eventfd
+  if (!__atomic_exchange_n(&mailbox->wake_pending, 1, __ATOMIC_ACQ_REL)) {
+    uint64_t one = 1;
+    write(mailbox->event_fd, &one, sizeof(one));
+  }
+}
+
+int MailboxFd(const Mailbox *mailbox) {
+  return mailbox->event_fd;
+}
+
+void MailboxClearWake(Mailbox *mailbox) {
+  uint64_t count;
+  read(mailbox->event_fd, &count, sizeof(count));
+  __atomic_store_n(&mailbox->wake_pending, 0, __ATOMIC_SEQ_CST);
+}
+
+MailboxNode *MailboxPop(Mailbox *mailbox) {
+  MailboxNode *head = mailbox->head;
+  MailboxNode *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+
+  // 跳过哨兵节点
+  if (head == &mailbox->stub) {
+    if (next == NULL) {
+      return NULL;
+    }
+    mailbox->head = next;
+    head = next;
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+  }
+
+  if (next != NULL) {
+    mailbox->head = next;
+    return head;
+  }
+
+  // head是最后一个节点, 把哨兵重新放回队尾后才能取出它
+  MailboxNode *tail = __atomic_load_n(&mailbox->tail, __ATOMIC_ACQUIRE);
+  if (head != tail) {
+    return NULL;
+  }
+
+  __atomic_store_n(&mailbox->stub.next, NULL, __ATOMIC_RELAXED);
+  MailboxNode *prev = __atomic_exchange_n(&mailbox->tail, &mailbox->stub, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&prev->next, &mailbox->stub, __ATOMIC_RELEASE);
+
+  next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+  if (next != NULL) {
+    mailbox->head = next;
+    return head;
+  }
+
+  return NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef CHATROOM_MAILBOX_H_
+#define CHATROOM_MAILBOX_H_
+
+/*
+ * 多生产者单消费者的无锁邮箱, 用于把消息投递给另一个reactor线程.
+ *
+ * 节点是侵入式的, 由调用者分配并嵌入自己的消息结构中(Vyukov MPSC队列).
+ * 投递者无锁入队, 邮箱由空闲变为有待处理消息时才写一次eventfd唤醒消费者,
+ * 消费者把MailboxFd注册到自己的reactor上, 可读时调用MailboxClearWake后用MailboxPop取完所有消息.
+ */
+
+typedef struct MailboxNode {
+  struct MailboxNode *next;
+} MailboxNode;
+
+typedef struct Mailbox {
+  MailboxNode *head;  // 只由消费者访问
+  MailboxNode stub;
+  char pad[64];       // 把生产者竞争的字段和消费者的字段隔开
+  MailboxNode *tail;
+  int wake_pending;
+  int event_fd;
+} Mailbox;
+
+int MailboxInit(Mailbox *mailbox);
+void MailboxDestroy(Mailbox *mailbox);
+
+// 任意线程调用
+void MailboxPush(Mailbox *mailbox, MailboxNode *node);
+
+// 以下只由消费者线程调用
+int MailboxFd(const Mailbox *mailbox);
+void MailboxClearWake(Mailbox *mailbox);
+
+// 邮箱为空, 或者有生产者入队到一半时返回NULL, 后者完成入队后会再次唤醒消费者
+MailboxNode *MailboxPop(Mailbox *mailbox);
+
+#endif // CHATROOM_MAILBOX_H_
@@ -0,0 +1,25 @@
+#include "message.h"
+#include "chatlib.h"
+#include <stdlib.h>
+#include <string.h>
+
+ChatMessage *CreateChatMessage(size_t len) {
+  ChatMessage *msg = ChatMalloc(sizeof(*msg) + len + 1);
+  msg->refcount = 1;
+  msg->len = len;
+  msg->data[len] = 0;
+  return msg;
+}
+
+ChatMessage *CreateChatMessageFrom(const char *data, size_t len) {
+  ChatMessage *msg = CreateChatMessage(len);
+  memcpy(msg->data, data, len);
+  return msg;
+}
+
+void ReleaseChatMessage(ChatMessage *msg) {
+  // 最后一个引用释放前, 其他线程对消息的使用必须对这里可见
+  if (__atomic_sub_fetch(&msg->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(msg);
+  }
+}
@@ -0,0 +1,29 @@
+#ifndef CHATROOM_MESSAGE_H_
+#define CHATROOM_MESSAGE_H_
+
+#include <stddef.h>
+
+/*
+ * 不可变的引用计数消息.
+ *
+ * 一条广播只分配一次, 所有接收者的输出队列和投递到其他分片的邮箱节点都只持有指针.
+ * 创建后填好data就不能再修改, 引用计数用原子操作维护, 可以在线程之间共享.
+ */
+typedef struct ChatMessage {
+  int refcount;
+  size_t len;
+  char data[];  // 末尾多分配一个字节, 方便当作字符串打印
+} ChatMessage;
+
+// 返回的消息引用计数为1, 属于调用者
+ChatMessage *CreateChatMessage(size_t len);
+ChatMessage *CreateChatMessageFrom(const char *data, size_t len);
+
+static inline ChatMessage *RetainChatMessage(ChatMessage *msg) {
+  __atomic_add_fetch(&msg->refcount, 1, __ATOMIC_RELAXED);
+  return msg;
+}
+
+void ReleaseChatMessage(ChatMessage *msg);
+
+#endif // CHATROOM_MESSAGE_H_
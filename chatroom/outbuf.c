@@ -0,0 +1,115 @@
+#include "outbuf.h"
+#include "chatlib.h"
+#include <sys/uio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#define OUTPUT_QUEUE_INIT_CAP 16
+
+// 一次writev最多提交的消息数
+#ifdef IOV_MAX
+#define OUTPUT_QUEUE_MAX_IOV (IOV_MAX < 256 ? IOV_MAX : 256)
+#else
+#define OUTPUT_QUEUE_MAX_IOV 16
+#endif
+
+void OutputQueueInit(OutputQueue *queue) {
+  queue->entries = NULL;
+  queue->cap = 0;
+  queue->head = 0;
+  queue->count = 0;
+  queue->bytes = 0;
+}
+
+void OutputQueueFree(OutputQueue *queue) {
+  for (size_t i = 0; i < queue->count; ++i) {
+    ReleaseChatMessage(queue->entries[(queue->head + i) & (queue->cap - 1)].msg);
+  }
+
+  free(queue->entries);
+  OutputQueueInit(queue);
+}
+
+// 扩容时把元素搬到新数组的开头, 环形回绕也随之消除
+static void OutputQueueGrow(OutputQueue *queue) {
+  size_t cap = queue->cap ? queue->cap * 2 : OUTPUT_QUEUE_INIT_CAP;
+  OutputEntry *entries = ChatMalloc(sizeof(OutputEntry) * cap);
+  for (size_t i = 0; i < queue->count; ++i) {
+    entries[i] = queue->entries[(queue->head + i) & (queue->cap - 1)];
+  }
+
+  free(queue->entries);
+  queue->entries = entries;
+  queue->cap = cap;
+  queue->head = 0;
+}
+
+void OutputQueuePush(OutputQueue *queue, ChatMessage *msg, size_t start) {
+  if (start >= msg->len) {
+    return;
+  }
+
+  if (queue->count == queue->cap) {
+    OutputQueueGrow(queue);
+  }
+
+  OutputEntry *entry = &queue->entries[(queue->head + queue->count) & (queue->cap - 1)];
+  entry->msg = RetainChatMessage(msg);
+  entry->start = start;
+  ++queue->count;
+  queue->bytes += msg->len - start;
+}
+
+int OutputQueuePrepare(const OutputQueue *queue, struct iovec *iov, int max_iov) {
+  int iovcnt = 0;
+  for (size_t i = 0; i < queue->count && iovcnt < max_iov; ++i) {
+    OutputEntry *entry = &queue->entries[(queue->head + i) & (queue->cap - 1)];
+    iov[iovcnt].iov_base = entry->msg->data + entry->start;
+    iov[iovcnt].iov_len = entry->msg->len - entry->start;
+    ++iovcnt;
+  }
+
+  return iovcnt;
+}
+
+void OutputQueueConsume(OutputQueue *queue, size_t written) {
+  queue->bytes -= written;
+  while (written > 0) {
+    OutputEntry *entry = &queue->entries[queue->head];
+    size_t remain = entry->msg->len - entry->start;
+    if (written < remain) {
+      entry->start += written;
+      break;
+    }
+
+    written -= remain;
+    ReleaseChatMessage(entry->msg);
+    queue->head = (queue->head + 1) & (queue->cap - 1);
+    --queue->count;
+  }
+}
+
+ssize_t OutputQueueFlush(OutputQueue *queue, int fd) {
+  ssize_t total = 0;
+  while (queue->count > 0) {
+    struct iovec iov[OUTPUT_QUEUE_MAX_IOV];
+    int iovcnt = OutputQueuePrepare(queue, iov, OUTPUT_QUEUE_MAX_IOV);
+
+    ssize_t written = writev(fd, iov, iovcnt);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return -1;
+    }
+
+    OutputQueueConsume(queue, written);
+    total += written;
+  }
+
+  return total;
+}
@@ -0,0 +1,56 @@
+#ifndef CHATROOM_OUTBUF_H_
+#define CHATROOM_OUTBUF_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "message.h"
+
+/*
+ * 连接的输出队列, 容量为2的幂的环形队列, 写满时翻倍扩容.
+ *
+ * 队列中只保存共享消息的引用和起始偏移, 不复制内容. 起始偏移让同一条消息可以
+ * 带着帧头发给分帧客户端, 跳过帧头发给行协议客户端; 队首消息部分写出后也只是推进偏移.
+ * 发送时把待发送的消息拼成iovec, 一次writev发出多条消息.
+ */
+typedef struct OutputEntry {
+  ChatMessage *msg;
+  size_t start;  // 从消息的这个位置开始发送
+} OutputEntry;
+
+typedef struct OutputQueue {
+  OutputEntry *entries;
+  size_t cap;
+  size_t head;
+  size_t count;
+  size_t bytes;  // 还没发送的总字节数
+} OutputQueue;
+
+void OutputQueueInit(OutputQueue *queue);
+void OutputQueueFree(OutputQueue *queue);
+
+static inline size_t OutputQueueBytes(const OutputQueue *queue) {
+  return queue->bytes;
+}
+
+// 发送msg中从start开始的内容, 队列持有一个新的引用, 调用者的引用不受影响
+void OutputQueuePush(OutputQueue *queue, ChatMessage *msg, size_t start);
+
+/*
+ * 把队首最多max_iov条消息的未发送部分填到iov中, 返回填写的数量, 队列不变.
+ * 用于由调用者自己发起写操作(例如io_uring), 写完后用OutputQueueConsume释放.
+ */
+int OutputQueuePrepare(const OutputQueue *queue, struct iovec *iov, int max_iov);
+
+// 释放已经写出的written字节, 完整写出的消息释放引用, 队首剩下的部分推进起始偏移
+void OutputQueueConsume(OutputQueue *queue, size_t written);
+
+/*
+ * 把队列中的数据写到非阻塞的fd, 直到写完或者EAGAIN
+ *
+ * 返回本次写出的字节数, 出错(不包括EAGAIN)返回-1
+ */
+ssize_t OutputQueueFlush(OutputQueue *queue, int fd);
+
+#endif // CHATROOM_OUTBUF_H_
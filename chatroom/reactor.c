@@ -0,0 +1,195 @@
+#include "reactor.h"
+#include "chatlib.h"
+#include <sys/epoll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define REACTOR_MAX_EVENTS 1024
+#define REACTOR_INIT_SLOTS 1024
+
+typedef struct ReactorSlot {
+  ReactorHandler *handler;  // 为NULL表示fd未注册
+  void *data;
+  int events;
+  uint32_t generation;
+} ReactorSlot;
+
+struct Reactor {
+  int epoll_fd;
+  int num_fds;
+  int num_slots;
+  ReactorSlot *slots;  // 按fd索引, 按需扩容
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+};
+
+static uint32_t ToEpollEvents(int events) {
+  uint32_t ep = EPOLLET | EPOLLRDHUP;
+  if (events & REACTOR_READABLE) {
+    ep |= EPOLLIN;
+  }
+  if (events & REACTOR_WRITABLE) {
+    ep |= EPOLLOUT;
+  }
+  return ep;
+}
+
+static int FromEpollEvents(uint32_t ep) {
+  int events = 0;
+  if (ep & EPOLLIN) {
+    events |= REACTOR_READABLE;
+  }
+  if (ep & EPOLLOUT) {
+    events |= REACTOR_WRITABLE;
+  }
+  if (ep & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+    events |= REACTOR_ERROR;
+  }
+  return events;
+}
+
+// epoll_event.data中同时保存fd和注册时的代数
+static uint64_t PackEventData(int fd, uint32_t generation) {
+  return ((uint64_t)generation << 32) | (uint32_t)fd;
+}
+
+static int EnsureSlot(Reactor *reactor, int fd) {
+  if (fd < reactor->num_slots) {
+    return 0;
+  }
+
+  int num_slots = reactor->num_slots;
+  while (num_slots <= fd) {
+    num_slots *= 2;
+  }
+
+  reactor->slots = ChatRealloc(reactor->slots, sizeof(ReactorSlot) * num_slots);
+  memset(reactor->slots + reactor->num_slots, 0,
+         sizeof(ReactorSlot) * (num_slots - reactor->num_slots));
+  reactor->num_slots = num_slots;
+  return 0;
+}
+
+Reactor *CreateReactor(void) {
+  Reactor *reactor = ChatMalloc(sizeof(*reactor));
+  reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (reactor->epoll_fd == -1) {
+    perror("Create epoll instance failed");
+    free(reactor);
+    return NULL;
+  }
+
+  reactor->num_fds = 0;
+  reactor->num_slots = REACTOR_INIT_SLOTS;
+  reactor->slots = ChatMalloc(sizeof(ReactorSlot) * reactor->num_slots);
+  memset(reactor->slots, 0, sizeof(ReactorSlot) * reactor->num_slots);
+  return reactor;
+}
+
+void FreeReactor(Reactor *reactor) {
+  if (reactor == NULL) {
+    return;
+  }
+
+  close(reactor->epoll_fd);
+  free(reactor->slots);
+  free(reactor);
+}
+
+int ReactorAdd(Reactor *reactor, int fd, int events, ReactorHandler *handler, void *data) {
+  if (fd < 0 || handler == NULL) {
+    return -1;
+  }
+
+  EnsureSlot(reactor, fd);
+  ReactorSlot *slot = &reactor->slots[fd];
+  if (slot->handler != NULL) {
+    return -1;
+  }
+
+  struct epoll_event ev;
+  ev.events = ToEpollEvents(events);
+  ev.data.u64 = PackEventData(fd, slot->generation + 1);
+  if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    perror("Add fd to epoll failed");
+    return -1;
+  }
+
+  ++slot->generation;
+  slot->handler = handler;
+  slot->data = data;
+  slot->events = events;
+  ++reactor->num_fds;
+  return 0;
+}
+
+int ReactorModify(Reactor *reactor, int fd, int events) {
+  if (fd < 0 || fd >= reactor->num_slots || reactor->slots[fd].handler == NULL) {
+    return -1;
+  }
+
+  ReactorSlot *slot = &reactor->slots[fd];
+  if (slot->events == events) {
+    return 0;
+  }
+
+  struct epoll_event ev;
+  ev.events = ToEpollEvents(events);
+  ev.data.u64 = PackEventData(fd, slot->generation);
+  if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+    perror("Modify epoll fd failed");
+    return -1;
+  }
+
+  slot->events = events;
+  return 0;
+}
+
+int ReactorRemove(Reactor *reactor, int fd) {
+  if (fd < 0 || fd >= reactor->num_slots || reactor->slots[fd].handler == NULL) {
+    return -1;
+  }
+
+  // fd可能已经被关闭, 关闭时内核会自动把它移出epoll, 忽略错误
+  epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+  ReactorSlot *slot = &reactor->slots[fd];
+  slot->handler = NULL;
+  slot->data = NULL;
+  slot->events = 0;
+  --reactor->num_fds;
+  return 0;
+}
+
+int ReactorPoll(Reactor *reactor, int timeout_ms) {
+  int num = epoll_wait(reactor->epoll_fd, reactor->events, REACTOR_MAX_EVENTS, timeout_ms);
+  if (num == -1) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    perror("Epoll wait failed");
+    return -1;
+  }
+
+  for (int i = 0; i < num; ++i) {
+    uint64_t packed = reactor->events[i].data.u64;
+    int fd = (int)(uint32_t)packed;
+    uint32_t generation = (uint32_t)(packed >> 32);
+
+    // 前面的回调可能已经删除了fd, 或者fd关闭后被新连接复用
+    ReactorSlot *slot = &reactor->slots[fd];
+    if (slot->handler == NULL || slot->generation != generation) {
+      continue;
+    }
+
+    slot->handler(reactor, fd, FromEpollEvents(reactor->events[i].events), slot->data);
+  }
+
+  return num;
+}
+
+int ReactorSize(const Reactor *reactor) {
+  return reactor->num_fds;
+}
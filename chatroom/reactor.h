@@ -0,0 +1,35 @@
+#ifndef CHATROOM_REACTOR_H_
+#define CHATROOM_REACTOR_H_
+
+#include <stdint.h>
+
+/*
+ * 基于epoll的边沿触发事件循环.
+ *
+ * 每个fd只在加入时注册一次, 之后只有关心的事件变化时才调用epoll_ctl.
+ * 边沿触发下回调必须一直读(写)到EAGAIN, 否则剩余的数据不会再产生事件.
+ * 回调中可以删除任意fd(包括其他已就绪的fd), 同一批事件中fd被关闭后又被复用时,
+ * 旧连接的事件通过代数(generation)过滤掉, 不会分发给新连接.
+ */
+
+#define REACTOR_READABLE 0x1
+#define REACTOR_WRITABLE 0x2
+#define REACTOR_ERROR    0x4  // 对端关闭或连接出错, 总是会上报
+
+typedef struct Reactor Reactor;
+typedef void ReactorHandler(Reactor *reactor, int fd, int events, void *data);
+
+Reactor *CreateReactor(void);
+void FreeReactor(Reactor *reactor);
+
+int ReactorAdd(Reactor *reactor, int fd, int events, ReactorHandler *handler, void *data);
+int ReactorModify(Reactor *reactor, int fd, int events);
+int ReactorRemove(Reactor *reactor, int fd);
+
+// 等待一批事件并分发, 返回分发的事件数量, 超时返回0, 被信号打断返回0, 出错返回-1
+int ReactorPoll(Reactor *reactor, int timeout_ms);
+
+// 已注册的fd数量
+int ReactorSize(const Reactor *reactor);
+
+#endif // CHATROOM_REACTOR_H_
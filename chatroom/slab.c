@@ -0,0 +1,72 @@
+#include "slab.h"
+#include "chatlib.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+// 块头占一个对齐单位, 之后的对象都按max_align_t对齐
+typedef union SlabChunk {
+  union SlabChunk *next;
+  max_align_t align;
+} SlabChunk;
+
+static size_t AlignUp(size_t size, size_t align) {
+  return (size + align - 1) / align * align;
+}
+
+void SlabInit(Slab *slab, size_t obj_size, size_t objs_per_chunk) {
+  if (obj_size < sizeof(void*)) {
+    obj_size = sizeof(void*);
+  }
+  slab->obj_size = AlignUp(obj_size, _Alignof(max_align_t));
+  slab->objs_per_chunk = objs_per_chunk;
+  slab->free_list = NULL;
+  slab->chunks = NULL;
+  slab->num_chunks = 0;
+  slab->num_used = 0;
+}
+
+void SlabDestroy(Slab *slab) {
+  SlabChunk *chunk = slab->chunks;
+  while (chunk != NULL) {
+    SlabChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  slab->free_list = NULL;
+  slab->chunks = NULL;
+  slab->num_chunks = 0;
+  slab->num_used = 0;
+}
+
+// 新块中的对象按地址顺序挂到空闲链表上
+static void SlabGrow(Slab *slab) {
+  SlabChunk *chunk = ChatMalloc(sizeof(SlabChunk) + slab->obj_size * slab->objs_per_chunk);
+  chunk->next = slab->chunks;
+  slab->chunks = chunk;
+  ++slab->num_chunks;
+
+  char *objs = (char*)(chunk + 1);
+  for (size_t i = slab->objs_per_chunk; i > 0; --i) {
+    void **obj = (void**)(objs + (i - 1) * slab->obj_size);
+    *obj = slab->free_list;
+    slab->free_list = obj;
+  }
+}
+
+void *SlabAlloc(Slab *slab) {
+  if (slab->free_list == NULL) {
+    SlabGrow(slab);
+  }
+
+  void **obj = slab->free_list;
+  slab->free_list = *obj;
+  ++slab->num_used;
+  return obj;
+}
+
+void SlabFree(Slab *slab, void *obj) {
+  *(void**)obj = slab->free_list;
+  slab->free_list = obj;
+  --slab->num_used;
+}
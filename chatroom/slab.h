@@ -0,0 +1,29 @@
+#ifndef CHATROOM_SLAB_H_
+#define CHATROOM_SLAB_H_
+
+#include <stddef.h>
+
+/*
+ * 固定大小对象的slab分配器, 不是线程安全的, 每个分片一个.
+ *
+ * 一次向堆申请一块能放下objs_per_chunk个对象的内存, 空闲对象用侵入式链表串起来,
+ * 分配和释放都只是链表头的一次操作. 释放的对象留给下次分配复用, 块在销毁时才归还给堆,
+ * 所以大量连接反复建立断开时不会在堆上留下碎片, 占用的内存以连接数的峰值为上限.
+ */
+typedef struct Slab {
+  size_t obj_size;
+  size_t objs_per_chunk;
+  void *free_list;
+  void *chunks;  // 已申请的块的链表
+  size_t num_chunks;
+  size_t num_used;
+} Slab;
+
+void SlabInit(Slab *slab, size_t obj_size, size_t objs_per_chunk);
+// 释放所有块, 调用者需要保证没有对象还在使用
+void SlabDestroy(Slab *slab);
+
+void *SlabAlloc(Slab *slab);
+void SlabFree(Slab *slab, void *obj);
+
+#endif // CHATROOM_SLAB_H_
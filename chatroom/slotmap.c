@@ -0,0 +1,94 @@
+#include "slotmap.h"
+#include "chatlib.h"
+#include <stdlib.h>
+
+#define SLOT_MAP_EMPTY     UINT32_MAX
+#define SLOT_MAP_INIT_SIZE 1024
+
+void SlotMapInit(SlotMap *map) {
+  map->values = NULL;
+  map->keys = NULL;
+  map->size = 0;
+  map->capacity = 0;
+  map->slots = NULL;
+  map->num_slots = 0;
+}
+
+void SlotMapFree(SlotMap *map) {
+  free(map->values);
+  free(map->keys);
+  free(map->slots);
+  SlotMapInit(map);
+}
+
+static void SlotMapEnsureSlot(SlotMap *map, int fd) {
+  if ((size_t)fd < map->num_slots) {
+    return;
+  }
+
+  size_t num_slots = map->num_slots ? map->num_slots : SLOT_MAP_INIT_SIZE;
+  while (num_slots <= (size_t)fd) {
+    num_slots <<= 1;
+  }
+
+  map->slots = ChatRealloc(map->slots, sizeof(SlotMapSlot) * num_slots);
+  for (size_t i = map->num_slots; i < num_slots; ++i) {
+    map->slots[i].dense_index = SLOT_MAP_EMPTY;
+    map->slots[i].generation = 0;
+  }
+  map->num_slots = num_slots;
+}
+
+SlotHandle SlotMapInsert(SlotMap *map, int fd, void *value) {
+  SlotMapEnsureSlot(map, fd);
+  if (map->size == map->capacity) {
+    map->capacity = map->capacity ? map->capacity * 2 : SLOT_MAP_INIT_SIZE;
+    map->values = ChatRealloc(map->values, sizeof(void*) * map->capacity);
+    map->keys = ChatRealloc(map->keys, sizeof(int) * map->capacity);
+  }
+
+  SlotMapSlot *slot = &map->slots[fd];
+  slot->dense_index = (uint32_t)map->size;
+  map->values[map->size] = value;
+  map->keys[map->size] = fd;
+  ++map->size;
+  return ((SlotHandle)slot->generation << 32) | (uint32_t)fd;
+}
+
+void SlotMapRemove(SlotMap *map, int fd) {
+  if (fd < 0 || (size_t)fd >= map->num_slots ||
+      map->slots[fd].dense_index == SLOT_MAP_EMPTY) {
+    return;
+  }
+
+  // 最后一个元素移到空出的位置
+  SlotMapSlot *slot = &map->slots[fd];
+  size_t index = slot->dense_index;
+  size_t last = map->size - 1;
+  map->values[index] = map->values[last];
+  map->keys[index] = map->keys[last];
+  map->slots[map->keys[index]].dense_index = (uint32_t)index;
+  --map->size;
+
+  slot->dense_index = SLOT_MAP_EMPTY;
+  ++slot->generation;
+}
+
+void *SlotMapGet(const SlotMap *map, int fd) {
+  if (fd < 0 || (size_t)fd >= map->num_slots ||
+      map->slots[fd].dense_index == SLOT_MAP_EMPTY) {
+    return NULL;
+  }
+
+  return map->values[map->slots[fd].dense_index];
+}
+
+void *SlotMapGetByHandle(const SlotMap *map, SlotHandle handle) {
+  int fd = (int)(uint32_t)handle;
+  uint32_t generation = (uint32_t)(handle >> 32);
+  if ((size_t)fd >= map->num_slots || map->slots[fd].generation != generation) {
+    return NULL;
+  }
+
+  return SlotMapGet(map, fd);
+}
@@ -0,0 +1,50 @@
+#ifndef CHATROOM_SLOTMAP_H_
+#define CHATROOM_SLOTMAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 以fd为键的槽位表.
+ *
+ * 值保存在稠密数组中, 遍历只访问存在的元素; 另有按fd索引的槽位记录值在稠密数组中的下标.
+ * 删除时把最后一个元素移到空出的位置, 插入和删除都是O(1), 两个数组都按需翻倍扩容.
+ * 每个槽位有一个代数, fd每次被删除时加一, 句柄(代数<<32 | fd)可以识别出fd已被复用的过期引用.
+ */
+
+typedef uint64_t SlotHandle;
+
+typedef struct SlotMapSlot {
+  uint32_t dense_index;  // SLOT_MAP_EMPTY表示不存在
+  uint32_t generation;
+} SlotMapSlot;
+
+typedef struct SlotMap {
+  void **values;  // 稠密数组
+  int *keys;      // values[i]对应的fd
+  size_t size;
+  size_t capacity;
+  SlotMapSlot *slots;  // 按fd索引
+  size_t num_slots;
+} SlotMap;
+
+void SlotMapInit(SlotMap *map);
+void SlotMapFree(SlotMap *map);
+
+// fd必须不在表中, 返回新值的句柄
+SlotHandle SlotMapInsert(SlotMap *map, int fd, void *value);
+void SlotMapRemove(SlotMap *map, int fd);
+
+void *SlotMapGet(const SlotMap *map, int fd);
+// 句柄过期时返回NULL
+void *SlotMapGetByHandle(const SlotMap *map, SlotHandle handle);
+
+static inline size_t SlotMapSize(const SlotMap *map) {
+  return map->size;
+}
+
+static inline void *SlotMapAt(const SlotMap *map, size_t index) {
+  return map->values[index];
+}
+
+#endif // CHATROOM_SLOTMAP_H_
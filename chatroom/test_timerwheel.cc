@@ -0,0 +1,334 @@
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "timerwheel.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr uint64_t kBaseMs = 1000000;
+  constexpr uint64_t kWheelRange = 1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);  // 不需要截断的最大tick数
+  constexpr int kRandomTimers = 20000;
+  constexpr int kRandomSteps = 200000;
+
+  /*
+   * 记录每个定时器应该在哪个tick触发, 回调中检查触发时时间轮正好处理到这个tick:
+   * 早于它是提前触发, 晚于它是推迟触发. 时间轮按tick逐个推进, 没有触发的定时器在最后统一检查.
+   */
+  struct TestTimer {
+    TimerNode node;
+    struct Tester *tester;
+    uint64_t fire_tick;
+    int fired;
+    int rearm;  // 触发时在回调中重新加入的剩余次数
+  };
+
+  struct Tester {
+    TimerWheel wheel;
+    std::vector<TestTimer> timers;
+    std::set<std::pair<uint64_t, TestTimer*>> pending;  // (fire_tick, timer), 用来检查TimerWheelTimeout
+    uint64_t now_ms;
+    int errors;
+    std::mt19937_64 rng;
+
+    Tester(uint64_t tick_ms, int num_timers) : timers(num_timers), now_ms(kBaseMs), errors(0), rng(20240601) {
+      TimerWheelInit(&wheel, tick_ms, now_ms);
+    }
+
+    // 与TimerWheelSchedule相同的取整: 向上取整到tick, 且至少是下一个tick
+    uint64_t ExpectedTick(uint64_t expires_ms) const {
+      uint64_t elapsed = expires_ms > wheel.base_ms ? expires_ms - wheel.base_ms : 0;
+      uint64_t tick = (elapsed + wheel.tick_ms - 1) / wheel.tick_ms;
+      return tick > wheel.current ? tick : wheel.current + 1;
+    }
+
+    void Schedule(TestTimer *timer, uint64_t expires_ms) {
+      if (TimerPending(&timer->node)) {
+        pending.erase({timer->fire_tick, timer});
+      }
+      timer->fire_tick = ExpectedTick(expires_ms);
+      pending.insert({timer->fire_tick, timer});
+      TimerWheelSchedule(&wheel, &timer->node, expires_ms);
+    }
+
+    void Cancel(TestTimer *timer) {
+      if (TimerPending(&timer->node)) {
+        pending.erase({timer->fire_tick, timer});
+      }
+      TimerWheelCancel(&wheel, &timer->node);
+    }
+
+    // 按对数分布选择延迟, 覆盖每一层以及超出时间轮范围的情况
+    uint64_t RandomDelay() {
+      int bits = static_cast<int>(rng() % 28);
+      return rng() & ((1ULL << bits) - 1);
+    }
+  };
+
+  void CheckFire(TimerWheel *wheel, TimerNode *node, void *data) {
+    TestTimer *timer = static_cast<TestTimer*>(data);
+    Tester *tester = timer->tester;
+    if (wheel->current != timer->fire_tick) {
+      ++tester->errors;
+    }
+    tester->pending.erase({timer->fire_tick, timer});
+    ++timer->fired;
+
+    if (timer->rearm > 0) {
+      --timer->rearm;
+      tester->Schedule(timer, tester->now_ms + tester->rng() % 200);
+    }
+  }
+
+  // 推进到now_ms, 推进前检查TimerWheelTimeout不会晚于最早的定时器
+  void AdvanceTo(Tester *tester, uint64_t now_ms) {
+    TimerWheel *wheel = &tester->wheel;
+    int timeout = TimerWheelTimeout(wheel, tester->now_ms);
+    if (tester->pending.empty()) {
+      EXPECT_EQ(timeout, -1);
+    } else {
+      uint64_t first_ms = wheel->base_ms + tester->pending.begin()->first * wheel->tick_ms;
+      EXPECT_GE(timeout, 0);
+      EXPECT_LE(tester->now_ms + timeout, first_ms);
+    }
+
+    tester->now_ms = now_ms;
+    TimerWheelAdvance(wheel, now_ms);
+  }
+
+  void RecordFire(TimerWheel *wheel, TimerNode *node, void *data) {
+    static_cast<std::vector<uint64_t>*>(data)->push_back(wheel->current);
+  }
+
+  // 绕过TimerWheelSchedule直接挂到指定的槽, 用来构造正常调度不会出现的状态
+  void InsertIntoSlot(TimerWheel *wheel, int level, int slot, TimerNode *node, uint64_t expires) {
+    TimerNode *head = &wheel->slots[level][slot];
+    node->expires = expires;
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+    ++wheel->count;
+  }
+} // namespace
+
+TEST(timerWheelTest, timeoutWithoutTimers) {
+  TimerWheel wheel;
+  TimerWheelInit(&wheel, 10, kBaseMs);
+  EXPECT_EQ(TimerWheelTimeout(&wheel, kBaseMs), -1);
+
+  std::vector<uint64_t> fires;
+  TimerNode node;
+  TimerInit(&node, RecordFire, &fires);
+  TimerWheelSchedule(&wheel, &node, kBaseMs + 100);
+  EXPECT_TRUE(TimerPending(&node));
+  TimerWheelCancel(&wheel, &node);
+  EXPECT_FALSE(TimerPending(&node));
+  EXPECT_EQ(TimerWheelTimeout(&wheel, kBaseMs), -1);
+
+  TimerWheelAdvance(&wheel, kBaseMs + 1000);
+  EXPECT_TRUE(fires.empty());
+}
+
+TEST(timerWheelTest, timeoutRoundsUpToTick) {
+  TimerWheel wheel;
+  TimerWheelInit(&wheel, 10, kBaseMs);
+
+  std::vector<uint64_t> fires;
+  TimerNode node;
+  TimerInit(&node, RecordFire, &fires);
+  TimerWheelSchedule(&wheel, &node, kBaseMs + 35);  // 第4个tick
+  EXPECT_EQ(TimerWheelTimeout(&wheel, kBaseMs), 40);
+  EXPECT_EQ(TimerWheelTimeout(&wheel, kBaseMs + 39), 1);
+  EXPECT_EQ(TimerWheelTimeout(&wheel, kBaseMs + 45), 0);
+
+  // 时钟早于创建时间轮的时间时什么都不做
+  TimerWheelAdvance(&wheel, kBaseMs - 100);
+  EXPECT_EQ(wheel.current, 0u);
+
+  TimerWheelAdvance(&wheel, kBaseMs + 39);
+  EXPECT_TRUE(fires.empty());
+  TimerWheelAdvance(&wheel, kBaseMs + 40);
+  ASSERT_EQ(fires.size(), 1u);
+  EXPECT_EQ(fires[0], 4u);
+  EXPECT_EQ(TimerWheelTimeout(&wheel, kBaseMs + 40), -1);
+}
+
+// 只有高层定时器时, 按TimerWheelTimeout睡眠会在每次重新分配时醒来, 最后正好在到期时触发
+TEST(timerWheelTest, timeoutFollowsCascade) {
+  TimerWheel wheel;
+  TimerWheelInit(&wheel, 1, kBaseMs);
+
+  std::vector<uint64_t> fires;
+  TimerNode node;
+  TimerInit(&node, RecordFire, &fires);
+  constexpr uint64_t kDelay = 5000;
+  TimerWheelSchedule(&wheel, &node, kBaseMs + kDelay);
+  EXPECT_EQ(TimerWheelTimeout(&wheel, kBaseMs), TIMER_WHEEL_SLOTS);
+
+  uint64_t now = kBaseMs;
+  int wakeups = 0;
+  while (fires.empty()) {
+    int timeout = TimerWheelTimeout(&wheel, now);
+    ASSERT_GT(timeout, 0);
+    now += timeout;
+    ASSERT_LE(now, kBaseMs + kDelay);
+    TimerWheelAdvance(&wheel, now);
+    ++wakeups;
+  }
+
+  EXPECT_EQ(now, kBaseMs + kDelay);
+  EXPECT_EQ(fires[0], kDelay);
+  EXPECT_LE(wakeups, static_cast<int>(kDelay / TIMER_WHEEL_SLOTS) + TIMER_WHEEL_SLOTS);
+}
+
+// 每一层的边界两侧, 都要在重新分配到第0层后正好在到期的tick触发
+TEST(timerWheelTest, cascadeAcrossLevels) {
+  TimerWheel wheel;
+  TimerWheelInit(&wheel, 1, kBaseMs);
+
+  std::vector<uint64_t> delays;
+  for (int level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+    uint64_t boundary = 1ULL << (TIMER_WHEEL_BITS * level);
+    delays.push_back(boundary - 1);
+    delays.push_back(boundary);
+    delays.push_back(boundary + 1);
+    delays.push_back(boundary * 3 + 7);
+  }
+  delays.push_back(1);
+  delays.push_back(kWheelRange - 1);
+
+  std::vector<std::vector<uint64_t>> fires(delays.size());
+  std::vector<TimerNode> nodes(delays.size());
+  for (size_t i = 0; i < delays.size(); ++i) {
+    TimerInit(&nodes[i], RecordFire, &fires[i]);
+    TimerWheelSchedule(&wheel, &nodes[i], kBaseMs + delays[i]);
+  }
+
+  TimerWheelAdvance(&wheel, kBaseMs + kWheelRange);
+  for (size_t i = 0; i < delays.size(); ++i) {
+    ASSERT_EQ(fires[i].size(), 1u) << "delay " << delays[i];
+    EXPECT_EQ(fires[i][0], delays[i]);
+  }
+  EXPECT_EQ(TimerWheelTimeout(&wheel, kBaseMs + kWheelRange), -1);
+}
+
+// 超出时间轮范围的定时器先放在最远的位置, 到那个tick时还没到期, 要重新放回时间轮而不是触发
+TEST(timerWheelTest, beyondRangeIsReplaced) {
+  TimerWheel wheel;
+  TimerWheelInit(&wheel, 1, kBaseMs);
+
+  std::vector<uint64_t> delays = {kWheelRange, kWheelRange + 1000, kWheelRange * 3 + 5};
+  std::vector<std::vector<uint64_t>> fires(delays.size());
+  std::vector<TimerNode> nodes(delays.size());
+  for (size_t i = 0; i < delays.size(); ++i) {
+    TimerInit(&nodes[i], RecordFire, &fires[i]);
+    TimerWheelSchedule(&wheel, &nodes[i], kBaseMs + delays[i]);
+  }
+
+  TimerWheelAdvance(&wheel, kBaseMs + kWheelRange - 1);
+  for (size_t i = 0; i < delays.size(); ++i) {
+    EXPECT_TRUE(fires[i].empty());
+    EXPECT_TRUE(TimerPending(&nodes[i]));
+  }
+
+  TimerWheelAdvance(&wheel, kBaseMs + kWheelRange * 4);
+  for (size_t i = 0; i < delays.size(); ++i) {
+    ASSERT_EQ(fires[i].size(), 1u) << "delay " << delays[i];
+    EXPECT_EQ(fires[i][0], delays[i]);
+  }
+}
+
+/*
+ * 第0层槽中的定时器在这个tick还没到期时要按剩余时间重新放回, 不能提前触发.
+ * 按当前的分层规则, 重新分配总是把定时器放进它到期的那个槽, 正常调度到不了这个分支, 这里手工构造.
+ */
+TEST(timerWheelTest, notYetExpiredInSlotIsReplaced) {
+  TimerWheel wheel;
+  TimerWheelInit(&wheel, 1, kBaseMs);
+
+  std::vector<uint64_t> fires;
+  TimerNode node;
+  TimerInit(&node, RecordFire, &fires);
+  InsertIntoSlot(&wheel, 0, 5, &node, 100);
+
+  TimerWheelAdvance(&wheel, kBaseMs + 5);
+  EXPECT_TRUE(fires.empty());
+  EXPECT_TRUE(TimerPending(&node));
+  EXPECT_EQ(wheel.count, 1u);
+
+  TimerWheelAdvance(&wheel, kBaseMs + 99);
+  EXPECT_TRUE(fires.empty());
+  TimerWheelAdvance(&wheel, kBaseMs + 100);
+  ASSERT_EQ(fires.size(), 1u);
+  EXPECT_EQ(fires[0], 100u);
+  EXPECT_EQ(wheel.count, 0u);
+}
+
+/*
+ * 随机加入, 重置, 取消和推进, 部分定时器在回调中重新加入自己.
+ * 每个定时器都必须正好在预期的tick触发, 每次推进前TimerWheelTimeout都不能晚于最早的定时器.
+ */
+TEST(timerWheelTest, randomizedNeverEarlyOrLate) {
+  Tester tester(2, kRandomTimers);
+  for (auto &timer : tester.timers) {
+    TimerInit(&timer.node, CheckFire, &timer);
+    timer.tester = &tester;
+    timer.fired = 0;
+    timer.rearm = static_cast<int>(tester.rng() % 4);
+    tester.Schedule(&timer, tester.now_ms + tester.RandomDelay());
+  }
+
+  int scheduled = kRandomTimers;
+  for (int step = 0; step < kRandomSteps; ++step) {
+    TestTimer *timer = &tester.timers[tester.rng() % kRandomTimers];
+    int op = static_cast<int>(tester.rng() % 10);
+    if (op < 6) {
+      tester.Schedule(timer, tester.now_ms + tester.RandomDelay());
+      ++scheduled;
+    } else if (op < 7) {
+      tester.Cancel(timer);
+    }
+
+    // 大多是几毫秒的小步, 偶尔跳过一大段时间
+    uint64_t step_ms = tester.rng() % 16 == 0 ? tester.rng() % 5000 : tester.rng() % 8;
+    AdvanceTo(&tester, tester.now_ms + step_ms);
+    ASSERT_EQ(tester.errors, 0) << "step " << step;
+    ASSERT_EQ(tester.wheel.count, tester.pending.size());
+  }
+
+  // 剩下的定时器全部推进到期
+  while (!tester.pending.empty()) {
+    uint64_t last_tick = tester.pending.rbegin()->first;
+    AdvanceTo(&tester, tester.wheel.base_ms + last_tick * tester.wheel.tick_ms);
+  }
+  EXPECT_EQ(tester.errors, 0);
+  EXPECT_EQ(tester.wheel.count, 0u);
+  EXPECT_EQ(TimerWheelTimeout(&tester.wheel, tester.now_ms), -1);
+
+  int fired = 0;
+  for (auto &timer : tester.timers) {
+    EXPECT_FALSE(TimerPending(&timer.node));
+    fired += timer.fired;
+  }
+  printf("scheduled %d, fired %d, final tick %llu\n", scheduled, fired,
+         static_cast<unsigned long long>(tester.wheel.current));
+}
+
+int main(int argc, char **argv) {
+  printf("Running main() from %s\n\n", __FILE__);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,184 @@
+#include "timerwheel.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_MAX_DELTA (((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+static void ListInit(TimerNode *head) {
+  head->prev = head;
+  head->next = head;
+}
+
+static int ListEmpty(const TimerNode *head) {
+  return head->next == head;
+}
+
+static void ListAppend(TimerNode *head, TimerNode *node) {
+  node->prev = head->prev;
+  node->next = head;
+  head->prev->next = node;
+  head->prev = node;
+}
+
+static void ListUnlink(TimerNode *node) {
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  node->prev = NULL;
+  node->next = NULL;
+}
+
+// 把整个槽的链表转移到另一个哨兵下
+static void ListMove(TimerNode *from, TimerNode *to) {
+  if (ListEmpty(from)) {
+    ListInit(to);
+    return;
+  }
+
+  to->next = from->next;
+  to->prev = from->prev;
+  to->next->prev = to;
+  to->prev->next = to;
+  ListInit(from);
+}
+
+void TimerWheelInit(TimerWheel *wheel, uint64_t tick_ms, uint64_t now_ms) {
+  wheel->base_ms = now_ms;
+  wheel->tick_ms = tick_ms > 0 ? tick_ms : 1;
+  wheel->current = 0;
+  wheel->count = 0;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+    for (int slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+      ListInit(&wheel->slots[level][slot]);
+    }
+  }
+}
+
+void TimerInit(TimerNode *node, TimerCallback *callback, void *data) {
+  node->prev = NULL;
+  node->next = NULL;
+  node->expires = 0;
+  node->callback = callback;
+  node->data = data;
+}
+
+/*
+ * 按距离到期的tick数选择层, 超出范围的暂时放在最高层, 重新分配时再放到正确的位置
+ *
+ * earliest是还会被处理的最早的tick: 新加入的定时器是current + 1,
+ * 推进时重新分配的定时器是正在处理的current, 它们还能在这个tick中触发.
+ */
+static void TimerWheelPlace(TimerWheel *wheel, TimerNode *node, uint64_t earliest) {
+  uint64_t expires = node->expires;
+  if (expires < earliest) {
+    expires = earliest;
+  }
+
+  uint64_t delta = expires - wheel->current;
+  if (delta > TIMER_WHEEL_MAX_DELTA) {
+    expires = wheel->current + TIMER_WHEEL_MAX_DELTA;
+    delta = TIMER_WHEEL_MAX_DELTA;
+  }
+
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 &&
+         delta >= ((uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1)))) {
+    ++level;
+  }
+
+  int slot = (int)((expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+  ListAppend(&wheel->slots[level][slot], node);
+}
+
+void TimerWheelSchedule(TimerWheel *wheel, TimerNode *node, uint64_t expires_ms) {
+  if (TimerPending(node)) {
+    ListUnlink(node);
+  } else {
+    ++wheel->count;
+  }
+
+  // 向上取整, 保证不会提前触发
+  uint64_t elapsed = expires_ms > wheel->base_ms ? expires_ms - wheel->base_ms : 0;
+  node->expires = (elapsed + wheel->tick_ms - 1) / wheel->tick_ms;
+  TimerWheelPlace(wheel, node, wheel->current + 1);
+}
+
+void TimerWheelCancel(TimerWheel *wheel, TimerNode *node) {
+  if (!TimerPending(node)) {
+    return;
+  }
+
+  ListUnlink(node);
+  --wheel->count;
+}
+
+int TimerWheelTimeout(const TimerWheel *wheel, uint64_t now_ms) {
+  if (wheel->count == 0) {
+    return -1;
+  }
+
+  // 第0层中最近的非空槽, 找不到时等到第1层下一次重新分配
+  uint64_t next = (wheel->current | TIMER_WHEEL_MASK) + 1;
+  for (uint64_t tick = wheel->current + 1; tick < next; ++tick) {
+    if (!ListEmpty(&wheel->slots[0][tick & TIMER_WHEEL_MASK])) {
+      next = tick;
+      break;
+    }
+  }
+
+  uint64_t next_ms = wheel->base_ms + next * wheel->tick_ms;
+  if (next_ms <= now_ms) {
+    return 0;
+  }
+
+  uint64_t timeout = next_ms - now_ms;
+  return timeout > INT32_MAX ? INT32_MAX : (int)timeout;
+}
+
+// 高层的槽到期时, 其中的定时器按剩余时间重新放到低层
+static void TimerWheelCascade(TimerWheel *wheel, uint64_t tick) {
+  for (int level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+    int shift = TIMER_WHEEL_BITS * level;
+    if ((tick & (((uint64_t)1 << shift) - 1)) != 0) {
+      break;
+    }
+
+    TimerNode pending;
+    ListMove(&wheel->slots[level][(tick >> shift) & TIMER_WHEEL_MASK], &pending);
+    while (!ListEmpty(&pending)) {
+      TimerNode *node = pending.next;
+      ListUnlink(node);
+      TimerWheelPlace(wheel, node, tick);
+    }
+  }
+}
+
+void TimerWheelAdvance(TimerWheel *wheel, uint64_t now_ms) {
+  if (now_ms < wheel->base_ms) {
+    return;
+  }
+
+  uint64_t target = (now_ms - wheel->base_ms) / wheel->tick_ms;
+  if (wheel->count == 0) {
+    wheel->current = target > wheel->current ? target : wheel->current;
+    return;
+  }
+
+  while (wheel->current < target) {
+    uint64_t tick = ++wheel->current;
+    TimerWheelCascade(wheel, tick);
+
+    // 先把槽整个摘下, 回调中加入的定时器不会在这一轮被触发
+    TimerNode expired;
+    ListMove(&wheel->slots[0][tick & TIMER_WHEEL_MASK], &expired);
+    while (!ListEmpty(&expired)) {
+      TimerNode *node = expired.next;
+      ListUnlink(node);
+      if (node->expires > tick) {
+        TimerWheelPlace(wheel, node, tick + 1);
+        continue;
+      }
+
+      --wheel->count;
+      node->callback(wheel, node, node->data);
+    }
+  }
+}
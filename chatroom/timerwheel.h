@@ -0,0 +1,62 @@
+#ifndef CHATROOM_TIMERWHEEL_H_
+#define CHATROOM_TIMERWHEEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 分层时间轮, 不是线程安全的, 每个分片一个.
+ *
+ * 4层, 每层64个槽, 第0层每槽一个tick, 第n层每槽64^n个tick, 覆盖2^24个tick.
+ * 定时器节点是侵入式的双向链表节点, 加入, 重置和取消都是O(1).
+ * 推进时间时先把高层到期的槽重新分配到低层, 再触发第0层当前槽中的定时器.
+ * 定时器不会提前触发, 最多推迟一个tick.
+ */
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+
+struct TimerWheel;
+struct TimerNode;
+typedef void TimerCallback(struct TimerWheel *wheel, struct TimerNode *node, void *data);
+
+typedef struct TimerNode {
+  struct TimerNode *prev;
+  struct TimerNode *next;  // 为NULL表示没有加入时间轮
+  uint64_t expires;        // 到期的tick
+  TimerCallback *callback;
+  void *data;
+} TimerNode;
+
+typedef struct TimerWheel {
+  uint64_t base_ms;  // tick 0对应的时间
+  uint64_t tick_ms;
+  uint64_t current;  // 已经处理完的tick
+  size_t count;
+  TimerNode slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];  // 每个槽是一个带哨兵的环形链表
+} TimerWheel;
+
+void TimerWheelInit(TimerWheel *wheel, uint64_t tick_ms, uint64_t now_ms);
+
+void TimerInit(TimerNode *node, TimerCallback *callback, void *data);
+
+static inline int TimerPending(const TimerNode *node) {
+  return node->next != NULL;
+}
+
+// 定时器已经在时间轮中时先摘下再重新加入
+void TimerWheelSchedule(TimerWheel *wheel, TimerNode *node, uint64_t expires_ms);
+void TimerWheelCancel(TimerWheel *wheel, TimerNode *node);
+
+/*
+ * 距离下一次需要推进时间轮的毫秒数, 可以直接作为事件循环的等待时间
+ *
+ * 没有定时器时返回-1. 只有高层的定时器时返回下一次重新分配的时间, 不会晚于任何定时器到期.
+ */
+int TimerWheelTimeout(const TimerWheel *wheel, uint64_t now_ms);
+
+// 触发所有在now_ms之前到期的定时器, 回调中可以加入或取消任意定时器
+void TimerWheelAdvance(TimerWheel *wheel, uint64_t now_ms);
+
+#endif // CHATROOM_TIMERWHEEL_H_
@@ -0,0 +1,358 @@
+#include "uring.h"
+#include "chatlib.h"
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define URING_IOV_CAP 65536
+#define URING_BUF_GROUP 0
+
+static int SysSetup(unsigned entries, struct io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int SysEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg,
+                    size_t arg_size) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int SysRegister(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * 完成事件只在事件循环等待时处理(DEFER_TASKRUN), 这要求只有一个线程提交(SINGLE_ISSUER),
+ * 而提交线程在启用时才确定, 所以先以禁用状态创建. 旧内核不支持这些标志时退回默认模式.
+ */
+static int SetupRing(unsigned entries, struct io_uring_params *params) {
+  memset(params, 0, sizeof(*params));
+  params->flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER |
+                  IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED;
+  params->cq_entries = entries * 4;
+  int fd = SysSetup(entries, params);
+  if (fd >= 0 || errno != EINVAL) {
+    return fd;
+  }
+
+  memset(params, 0, sizeof(*params));
+  params->flags = IORING_SETUP_CQSIZE;
+  params->cq_entries = entries * 4;
+  return SysSetup(entries, params);
+}
+
+int UringInit(Uring *ring, unsigned entries) {
+  memset(ring, 0, sizeof(*ring));
+  ring->ring_fd = -1;
+
+  struct io_uring_params params;
+  int fd = SetupRing(entries, &params);
+  if (fd == -1) {
+    perror("Create io_uring failed");
+    return -1;
+  }
+  ring->ring_fd = fd;
+  ring->flags = params.flags;
+
+  // 等待需要带超时(EXT_ARG), 完成队列满时内核不能丢弃事件(NODROP)
+  unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE |
+                      IORING_FEAT_EXT_ARG;
+  if ((params.features & required) != required) {
+    fprintf(stderr, "io_uring features %#x not supported\n", params.features);
+    UringFree(ring);
+    return -1;
+  }
+
+  // SINGLE_MMAP: 提交队列和完成队列在同一块映射中
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (ring->cq_ring_size > ring->sq_ring_size) {
+    ring->sq_ring_size = ring->cq_ring_size;
+  }
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED) {
+    ring->sq_ring = NULL;
+    perror("Map io_uring failed");
+    UringFree(ring);
+    return -1;
+  }
+  ring->cq_ring = ring->sq_ring;
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                    IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    perror("Map io_uring sqes failed");
+    UringFree(ring);
+    return -1;
+  }
+
+  char *sq = ring->sq_ring;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->sqe_tail = *ring->sq_tail;
+
+  // 请求在sqes中的位置固定对应提交队列中的位置
+  unsigned *array = (unsigned *)(sq + params.sq_off.array);
+  for (unsigned i = 0; i < params.sq_entries; ++i) {
+    array[i] = i;
+  }
+
+  char *cq = ring->cq_ring;
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  ring->iovs = ChatMalloc(sizeof(struct iovec) * URING_IOV_CAP);
+  ring->msgs = ChatMalloc(sizeof(struct msghdr) * params.sq_entries);
+  ring->iov_cap = URING_IOV_CAP;
+  return 0;
+}
+
+void UringFree(Uring *ring) {
+  if (ring->buffers != NULL) {
+    munmap(ring->buffers, (size_t)ring->buf_count * ring->buf_size);
+  }
+  if (ring->buf_ring != NULL) {
+    munmap(ring->buf_ring, ring->buf_ring_size);
+  }
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->sq_ring != NULL) {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+  if (ring->ring_fd != -1) {
+    close(ring->ring_fd);
+  }
+  free(ring->iovs);
+  free(ring->msgs);
+  memset(ring, 0, sizeof(*ring));
+  ring->ring_fd = -1;
+}
+
+int UringEnable(Uring *ring) {
+  if (!(ring->flags & IORING_SETUP_R_DISABLED)) {
+    return 0;
+  }
+
+  if (SysRegister(ring->ring_fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0) == -1) {
+    perror("Enable io_uring failed");
+    return -1;
+  }
+  return 0;
+}
+
+int UringSetupBuffers(Uring *ring, unsigned count, unsigned size) {
+  ring->buf_ring_size = count * sizeof(struct io_uring_buf);
+  ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->buf_ring == MAP_FAILED) {
+    ring->buf_ring = NULL;
+    perror("Map io_uring buffer ring failed");
+    return -1;
+  }
+
+  // 缓冲按需分页, 只有收到过数据的缓冲才占用内存
+  ring->buffers = mmap(NULL, (size_t)count * size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->buffers == MAP_FAILED) {
+    ring->buffers = NULL;
+    perror("Map io_uring buffers failed");
+    return -1;
+  }
+  ring->buf_count = count;
+  ring->buf_size = size;
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+  reg.ring_entries = count;
+  reg.bgid = URING_BUF_GROUP;
+  if (SysRegister(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+    perror("Register io_uring buffer ring failed");
+    return -1;
+  }
+
+  for (unsigned bid = 0; bid < count; ++bid) {
+    UringRecycleBuffer(ring, bid);
+  }
+  return 0;
+}
+
+void UringRecycleBuffer(Uring *ring, unsigned bid) {
+  struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->buf_count - 1)];
+  buf->addr = (uint64_t)(uintptr_t)UringBuffer(ring, bid);
+  buf->len = ring->buf_size;
+  buf->bid = bid;
+  ++ring->buf_tail;
+  __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+// 返回清零的请求, 提交队列满时先提交
+static struct io_uring_sqe *UringGetSqe(Uring *ring) {
+  if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries) {
+    if (UringSubmit(ring, 0, -1) == -1 ||
+        ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries) {
+      return NULL;
+    }
+  }
+
+  struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+  ++ring->sqe_tail;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int UringAcceptMultishot(Uring *ring, int fd, int flags, uint64_t user_data) {
+  struct io_uring_sqe *sqe = UringGetSqe(ring);
+  if (sqe == NULL) {
+    return -1;
+  }
+
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->accept_flags = flags;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = user_data;
+  return 0;
+}
+
+int UringRecvMultishot(Uring *ring, int fd, uint64_t user_data) {
+  struct io_uring_sqe *sqe = UringGetSqe(ring);
+  if (sqe == NULL) {
+    return -1;
+  }
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUF_GROUP;
+  sqe->user_data = user_data;
+  return 0;
+}
+
+int UringPollMultishot(Uring *ring, int fd, unsigned events, uint64_t user_data) {
+  struct io_uring_sqe *sqe = UringGetSqe(ring);
+  if (sqe == NULL) {
+    return -1;
+  }
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = user_data;
+  return 0;
+}
+
+int UringSendmsg(Uring *ring, int fd, const struct iovec *iov, int iovcnt, uint64_t user_data) {
+  if ((unsigned)iovcnt > ring->iov_cap) {
+    return -1;
+  }
+
+  // 先腾出iovec的空间再取请求, 否则提交时会把还没填好的请求交给内核
+  if (ring->iov_used + iovcnt > ring->iov_cap) {
+    if (UringSubmit(ring, 0, -1) == -1 || ring->iov_used + iovcnt > ring->iov_cap) {
+      return -1;
+    }
+  }
+
+  struct io_uring_sqe *sqe = UringGetSqe(ring);
+  if (sqe == NULL) {
+    return -1;
+  }
+
+  struct iovec *copy = ring->iovs + ring->iov_used;
+  memcpy(copy, iov, sizeof(struct iovec) * iovcnt);
+  ring->iov_used += iovcnt;
+
+  struct msghdr *msg = &ring->msgs[(sqe - ring->sqes)];
+  memset(msg, 0, sizeof(*msg));
+  msg->msg_iov = copy;
+  msg->msg_iovlen = iovcnt;
+
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)msg;
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = user_data;
+  return 0;
+}
+
+int UringCancelFd(Uring *ring, int fd, uint64_t user_data) {
+  struct io_uring_sqe *sqe = UringGetSqe(ring);
+  if (sqe == NULL) {
+    return -1;
+  }
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->user_data = user_data;
+  return 0;
+}
+
+int UringSubmit(Uring *ring, unsigned wait_nr, int timeout_ms) {
+  unsigned to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+  if (to_submit == 0 && wait_nr == 0) {
+    return 0;
+  }
+
+  unsigned flags = 0;
+  void *arg = NULL;
+  size_t arg_size = 0;
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg getevents;
+  if (wait_nr > 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+    if (timeout_ms >= 0) {
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+      memset(&getevents, 0, sizeof(getevents));
+      getevents.sigmask_sz = _NSIG / 8;
+      getevents.ts = (uint64_t)(uintptr_t)&ts;
+      flags |= IORING_ENTER_EXT_ARG;
+      arg = &getevents;
+      arg_size = sizeof(getevents);
+    }
+  }
+
+  int ret = SysEnter(ring->ring_fd, to_submit, wait_nr, flags, arg, arg_size);
+  if (ret == -1 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+    perror("Enter io_uring failed");
+    return -1;
+  }
+
+  // 内核取走了所有请求后iovec才能复用; EBUSY等情况下没取完的请求留到下次提交
+  if (__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sqe_tail) {
+    ring->iov_used = 0;
+  }
+  return 0;
+}
+
+int UringReap(Uring *ring, struct io_uring_cqe *cqes, int max) {
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  int count = 0;
+  while (head != tail && count < max) {
+    cqes[count++] = ring->cqes[head & ring->cq_mask];
+    ++head;
+  }
+
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  return count;
+}
@@ -0,0 +1,101 @@
+#ifndef CHATROOM_URING_H_
+#define CHATROOM_URING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/*
+ * 直接基于io_uring系统调用的最小封装, 不依赖liburing.
+ *
+ * 提交队列中填好的请求只在UringSubmit(或者提交队列满)时才通过一次io_uring_enter交给内核,
+ * 一轮事件循环中产生的所有写请求因此只需要一次系统调用. 读使用内核提供的缓冲环:
+ * 多次接收(multishot recv)的请求由内核从环中挑一块缓冲, 完成事件中带回缓冲编号,
+ * 处理完后用UringRecycleBuffer还回环中.
+ *
+ * 完成事件的user_data由调用者定义, 原样返回. 只允许一个线程使用, 这个线程要先调用UringEnable.
+ */
+
+typedef struct Uring {
+  int ring_fd;
+  unsigned flags;  // 创建时使用的IORING_SETUP_*
+
+  // 提交队列, 填好的请求在sqe_tail之前, 提交时才发布给内核
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sqe_tail;
+  struct io_uring_sqe *sqes;
+
+  // 完成队列
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+
+  // 还没提交的写请求的iovec, 内核在提交时才读取, 提交后整块复用; msghdr按请求的位置存放
+  struct iovec *iovs;
+  struct msghdr *msgs;
+  unsigned iov_cap;
+  unsigned iov_used;
+
+  // 提供给接收请求的缓冲环
+  struct io_uring_buf_ring *buf_ring;
+  size_t buf_ring_size;
+  char *buffers;
+  unsigned buf_count;
+  unsigned buf_size;
+  unsigned short buf_tail;
+} Uring;
+
+// 队列长度entries会被内核向上取整为2的幂, 失败返回-1(例如内核不支持或者被禁用)
+int UringInit(Uring *ring, unsigned entries);
+void UringFree(Uring *ring);
+
+// 在使用的线程上调用一次
+int UringEnable(Uring *ring);
+
+// 注册count块大小为size的接收缓冲, count必须是2的幂
+int UringSetupBuffers(Uring *ring, unsigned count, unsigned size);
+
+static inline char *UringBuffer(const Uring *ring, unsigned bid) {
+  return ring->buffers + (size_t)bid * ring->buf_size;
+}
+
+void UringRecycleBuffer(Uring *ring, unsigned bid);
+
+/*
+ * 以下函数只是填好请求, 由下一次UringSubmit提交, 提交队列满时会先提交已有的请求.
+ * 成功返回0, 提交失败返回-1.
+ */
+
+// 监听socket上的多次接受, 每个新连接产生一个完成事件, res为新连接的fd
+int UringAcceptMultishot(Uring *ring, int fd, int flags, uint64_t user_data);
+// 多次接收, 数据放在缓冲环中, 完成事件带IORING_CQE_F_BUFFER
+int UringRecvMultishot(Uring *ring, int fd, uint64_t user_data);
+// 多次poll, fd每次就绪产生一个完成事件
+int UringPollMultishot(Uring *ring, int fd, unsigned events, uint64_t user_data);
+// 把iov中的数据发到socket, 带MSG_NOSIGNAL; iov在调用后就可以释放, 内容复制到ring中直到提交
+int UringSendmsg(Uring *ring, int fd, const struct iovec *iov, int iovcnt, uint64_t user_data);
+// 取消fd上所有未完成的请求
+int UringCancelFd(Uring *ring, int fd, uint64_t user_data);
+
+/*
+ * 提交所有填好的请求, 并等待至少wait_nr个完成事件, timeout_ms为-1时一直等待.
+ * 超时和被信号打断都返回0, 出错返回-1.
+ */
+int UringSubmit(Uring *ring, unsigned wait_nr, int timeout_ms);
+
+// 取出最多max个完成事件复制到cqes中, 返回取出的数量
+int UringReap(Uring *ring, struct io_uring_cqe *cqes, int max);
+
+#endif // CHATROOM_URING_H_
@@ -0,0 +1,111 @@
+/**
+ * 批量提交任务的开销测试
+ *
+ * 主线程以不同的批大小提交同样数量的空任务, 分别统计单个提交(addThreadPoolTask)
+ * 和批量提交(addThreadPoolTasks)时每个任务在提交侧的平均耗时.
+ *
+ * 用法: benchBatchSubmit [任务数量] [worker数量]
+ */
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr int kDefaultTaskNum = 1 << 18;
+  constexpr int kDefaultWorkerNum = 4;
+  constexpr int kBatchSizes[] = {1, 16, 256, 4096};
+
+  std::atomic<long> done{0};
+
+  void EmptyTask(void *arg) {
+    (void)arg;
+    done.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // 返回每个任务在提交侧的平均耗时(ns)
+  double RunOnce(threadPoolMode mode, int worker_num, int task_num, int batch_size, bool batched) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = worker_num;
+    attr.mode = mode;
+
+    threadPool pool;
+    if (createThreadPoolWithAttr(&pool, &attr) != 0) {
+      fprintf(stderr, "Create thread pool failed\n");
+      exit(1);
+    }
+
+    std::vector<threadTask> tasks(task_num);
+    for (auto &task : tasks) {
+      task.func = EmptyTask;
+      task.userData = nullptr;
+    }
+    done.store(0);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < task_num; i += batch_size) {
+      int num = task_num - i < batch_size ? task_num - i : batch_size;
+      if (batched) {
+        addThreadPoolTasks(&pool, &tasks[i], num);
+      } else {
+        for (int j = 0; j < num; ++j) {
+          addThreadPoolTask(&pool, &tasks[i + j]);
+        }
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    while (done.load(std::memory_order_acquire) < task_num) {
+      usleep(50);
+    }
+    destoryThreadPool(&pool);
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / task_num;
+  }
+} // namespace
+
+int main(int argc, char **argv) {
+  int task_num = argc > 1 ? atoi(argv[1]) : kDefaultTaskNum;
+  int worker_num = argc > 2 ? atoi(argv[2]) : kDefaultWorkerNum;
+  if (task_num < 1) {
+    task_num = kDefaultTaskNum;
+  }
+  if (worker_num < 1) {
+    worker_num = kDefaultWorkerNum;
+  }
+
+  struct {
+    const char *name;
+    threadPoolMode mode;
+  } modes[] = {
+    {"global", THREAD_POOL_GLOBAL_QUEUE},
+    {"stealing", THREAD_POOL_WORK_STEALING},
+    {"ring", THREAD_POOL_MPMC_RING},
+  };
+
+  printf("tasks=%d, workers=%d, submit cost in ns/task\n", task_num, worker_num);
+  printf("%-10s %-8s %-14s %-14s\n", "mode", "batch", "single", "batched");
+  for (auto &mode : modes) {
+    for (int batch_size : kBatchSizes) {
+      double single = RunOnce(mode.mode, worker_num, task_num, batch_size, false);
+      double batched = RunOnce(mode.mode, worker_num, task_num, batch_size, true);
+      printf("%-10s %-8d %-14.1f %-14.1f\n", mode.name, batch_size, single, batched);
+    }
+  }
+
+  return 0;
+}
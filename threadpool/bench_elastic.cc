@@ -0,0 +1,102 @@
+/**
+ * 弹性线程池在突发负载下的表现
+ *
+ * 负载由若干轮突发组成, 每轮提交一批阻塞型任务(usleep模拟IO), 然后空闲一段时间.
+ * 对比固定最小数量, 固定最大数量和弹性伸缩三种配置的平均/最大排队时间,
+ * 平均存活worker数量和利用率. 固定配置通过minPoolNum == maxPoolNum开启统计.
+ *
+ * 用法: benchElastic [轮数] [每轮任务数] [任务阻塞时间us] [空闲时间ms]
+ */
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr int kDefaultRounds = 5;
+  constexpr int kDefaultBurstTasks = 200;
+  constexpr int kDefaultTaskUs = 2000;
+  constexpr int kDefaultIdleMs = 300;
+  constexpr int kMinWorkers = 2;
+  constexpr int kMaxWorkers = 32;
+
+  std::atomic<long> done{0};
+  int task_us = kDefaultTaskUs;
+
+  void BlockingTask(void *arg) {
+    (void)arg;
+    usleep(task_us);
+    done.fetch_add(1, std::memory_order_release);
+  }
+
+  void RunConfig(const char *name, int min_workers, int max_workers,
+                 int rounds, int burst_tasks, int idle_ms) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = min_workers;
+    attr.minPoolNum = min_workers;
+    attr.maxPoolNum = max_workers;
+    attr.spawnWaitUs = 1000;
+    attr.idleTimeoutMs = idle_ms / 3;
+
+    threadPool pool;
+    if (createThreadPoolWithAttr(&pool, &attr) != 0) {
+      fprintf(stderr, "Create thread pool failed\n");
+      exit(1);
+    }
+
+    done.store(0);
+    double burst_ms = 0;
+    for (int round = 0; round < rounds; ++round) {
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < burst_tasks; ++i) {
+        submitThreadPoolTask(&pool, BlockingTask, nullptr);
+      }
+      while (done.load(std::memory_order_acquire) < static_cast<long>(burst_tasks) * (round + 1)) {
+        usleep(100);
+      }
+      burst_ms += std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start).count();
+      usleep(idle_ms * 1000);
+    }
+
+    threadPoolStats stats;
+    getThreadPoolStats(&pool, &stats);
+    destoryThreadPool(&pool);
+
+    double mean_wait_us = stats.dequeuedTasks ? stats.queueWaitNs / 1e3 / stats.dequeuedTasks : 0;
+    printf("%-10s %-12.1f %-14.1f %-14.1f %-12.2f %-10.1f %-8lu %-8lu\n", name,
+           burst_ms / rounds, mean_wait_us, stats.maxQueueWaitNs / 1e3,
+           static_cast<double>(stats.aliveNs) / stats.elapsedNs,
+           100.0 * stats.busyNs / stats.aliveNs,
+           stats.spawnedWorkers, stats.retiredWorkers);
+  }
+} // namespace
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : kDefaultRounds;
+  int burst_tasks = argc > 2 ? atoi(argv[2]) : kDefaultBurstTasks;
+  task_us = argc > 3 ? atoi(argv[3]) : kDefaultTaskUs;
+  int idle_ms = argc > 4 ? atoi(argv[4]) : kDefaultIdleMs;
+
+  printf("rounds=%d, burst=%d tasks, task=%dus, idle=%dms\n", rounds, burst_tasks, task_us, idle_ms);
+  printf("%-10s %-12s %-14s %-14s %-12s %-10s %-8s %-8s\n", "config", "burst ms",
+         "mean wait us", "max wait us", "avg workers", "util %", "spawned", "retired");
+  RunConfig("fixed-min", kMinWorkers, kMinWorkers, rounds, burst_tasks, idle_ms);
+  RunConfig("fixed-max", kMaxWorkers, kMaxWorkers, rounds, burst_tasks, idle_ms);
+  RunConfig("elastic", kMinWorkers, kMaxWorkers, rounds, burst_tasks, idle_ms);
+
+  return 0;
+}
@@ -0,0 +1,159 @@
+/**
+ * 空闲策略的唤醒延迟测试(ping-pong)
+ *
+ * 调用线程每隔一段时间提交一个任务(ping), 任务记下开始执行的时间并置位完成标志(pong),
+ * 调用线程等到完成标志后再进入下一轮. 间隔期间worker处于空闲状态,
+ * 因此提交到开始执行的时间就是唤醒延迟. 每种调度模式下分别测试只休眠, 先自旋, 先让出CPU
+ * 和自旋+让出四种策略, 输出唤醒延迟的百分位数(ns), worker在各阶段等到任务的次数,
+ * 以及整个进程消耗的CPU时间(自旋和让出的代价).
+ *
+ * 用法: benchIdle [往返次数] [间隔us] [自旋us] [让出次数]
+ */
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr int kDefaultRounds = 2000;
+  constexpr int kDefaultGapUs = 200;
+  constexpr int kDefaultSpinUs = 50;
+  constexpr int kDefaultYields = 100;
+
+  struct Ping {
+    std::atomic<long> start_ns{0};
+    std::atomic<bool> done{false};
+  };
+
+  long NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  double CpuSeconds() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+
+  void Pong(void *arg) {
+    Ping *ping = static_cast<Ping*>(arg);
+    ping->start_ns.store(NowNs(), std::memory_order_relaxed);
+    ping->done.store(true, std::memory_order_release);
+  }
+
+  struct Result {
+    long p50;
+    long p99;
+    double avg;
+    double cpu_ms;
+    threadPoolStats stats;
+  };
+
+  Result RunOnce(threadPoolMode mode, unsigned long spin_us, int yields, int rounds, int gap_us) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = 1;
+    attr.mode = mode;
+    attr.idleSpinUs = spin_us;
+    attr.idleYields = yields;
+
+    threadPool pool;
+    if (createThreadPoolWithAttr(&pool, &attr) != 0) {
+      fprintf(stderr, "Create thread pool failed\n");
+      exit(1);
+    }
+
+    std::vector<long> latency;
+    latency.reserve(rounds);
+    Ping ping;
+    double cpu_start = CpuSeconds();
+    for (int i = 0; i < rounds; ++i) {
+      usleep(gap_us);
+      ping.done.store(false, std::memory_order_relaxed);
+      long submit_ns = NowNs();
+      submitThreadPoolTask(&pool, Pong, &ping);
+      // 让出CPU等待, 单核机器上也不会挡住worker
+      while (!ping.done.load(std::memory_order_acquire)) {
+        sched_yield();
+      }
+      latency.push_back(ping.start_ns.load(std::memory_order_relaxed) - submit_ns);
+    }
+
+    Result result;
+    result.cpu_ms = (CpuSeconds() - cpu_start) * 1e3;
+    getThreadPoolStats(&pool, &result.stats);
+    destoryThreadPool(&pool);
+
+    std::sort(latency.begin(), latency.end());
+    result.p50 = latency[latency.size() / 2];
+    result.p99 = latency[latency.size() * 99 / 100];
+    double sum = 0;
+    for (long value : latency) {
+      sum += value;
+    }
+    result.avg = sum / latency.size();
+    return result;
+  }
+
+  const char *ModeName(threadPoolMode mode) {
+    switch (mode) {
+      case THREAD_POOL_WORK_STEALING: return "stealing";
+      case THREAD_POOL_MPMC_RING: return "ring";
+      default: return "global";
+    }
+  }
+} // namespace
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : kDefaultRounds;
+  int gap_us = argc > 2 ? atoi(argv[2]) : kDefaultGapUs;
+  unsigned long spin_us = argc > 3 ? strtoul(argv[3], nullptr, 10) : kDefaultSpinUs;
+  int yields = argc > 4 ? atoi(argv[4]) : kDefaultYields;
+
+  printf("rounds=%d, gap=%dus, spin=%luus, yields=%d\n", rounds, gap_us, spin_us, yields);
+  printf("%-10s %-12s %-10s %-10s %-10s %-8s %-8s %-8s %-10s\n", "mode", "strategy", "avg ns",
+         "p50 ns", "p99 ns", "spin", "yield", "park", "cpu ms");
+
+  struct Strategy {
+    const char *name;
+    unsigned long spin_us;
+    int yields;
+  } strategies[] = {
+    {"park", 0, 0},
+    {"spin", spin_us, 0},
+    {"yield", 0, yields},
+    {"spin+yield", spin_us, yields},
+  };
+
+  threadPoolMode modes[] = {THREAD_POOL_GLOBAL_QUEUE, THREAD_POOL_WORK_STEALING,
+                            THREAD_POOL_MPMC_RING};
+  for (threadPoolMode mode : modes) {
+    for (const Strategy &strategy : strategies) {
+      Result result = RunOnce(mode, strategy.spin_us, strategy.yields, rounds, gap_us);
+      printf("%-10s %-12s %-10.0f %-10ld %-10ld %-8lu %-8lu %-8lu %-10.1f\n", ModeName(mode),
+             strategy.name, result.avg, result.p50, result.p99,
+             result.stats.idleWakeups[THREAD_POOL_IDLE_SPIN],
+             result.stats.idleWakeups[THREAD_POOL_IDLE_YIELD],
+             result.stats.idleWakeups[THREAD_POOL_IDLE_PARK], result.cpu_ms);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * 对比全局链表队列与无锁环形队列的任务提交开销
+ *
+ * 多个外部生产者线程同时提交空任务, 统计每个任务在生产者侧的平均提交耗时
+ * 以及从开始提交到全部执行完成的吞吐量.
+ *
+ * 用法: benchMpmcRing [每个生产者的任务数量] [worker数量]
+ */
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr int kDefaultTaskNum = 1 << 18;
+  constexpr int kDefaultWorkerNum = 4;
+  constexpr int kProducerNums[] = {1, 2, 4, 8};
+
+  std::atomic<long> done{0};
+
+  void EmptyTask(void *arg) {
+    (void)arg;
+    done.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  struct BenchResult {
+    double submit_ns;   // 生产者侧每个任务的平均提交耗时
+    double throughput;  // 端到端吞吐量, 任务/秒
+  };
+
+  BenchResult RunOnce(threadPoolMode mode, int worker_num, int producer_num, int task_num) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = worker_num;
+    attr.mode = mode;
+
+    threadPool pool;
+    if (createThreadPoolWithAttr(&pool, &attr) != 0) {
+      fprintf(stderr, "Create thread pool failed\n");
+      exit(1);
+    }
+
+    long total = static_cast<long>(task_num) * producer_num;
+    std::vector<threadTask> tasks(total);
+    for (auto &task : tasks) {
+      task.func = EmptyTask;
+      task.userData = nullptr;
+    }
+    done.store(0);
+
+    std::vector<double> submit_ns(producer_num);
+    std::vector<std::thread> producers;
+    auto start = std::chrono::steady_clock::now();
+    for (int p = 0; p < producer_num; ++p) {
+      producers.emplace_back([&, p]() {
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < task_num; ++i) {
+          addThreadPoolTask(&pool, &tasks[static_cast<long>(p) * task_num + i]);
+        }
+        auto end = std::chrono::steady_clock::now();
+        submit_ns[p] = std::chrono::duration<double, std::nano>(end - begin).count() / task_num;
+      });
+    }
+    for (auto &producer : producers) {
+      producer.join();
+    }
+
+    while (done.load(std::memory_order_acquire) < total) {
+      usleep(50);
+    }
+    auto end = std::chrono::steady_clock::now();
+    destoryThreadPool(&pool);
+
+    BenchResult result;
+    result.submit_ns = 0;
+    for (double ns : submit_ns) {
+      result.submit_ns += ns / producer_num;
+    }
+    result.throughput = total / std::chrono::duration<double>(end - start).count();
+    return result;
+  }
+} // namespace
+
+int main(int argc, char **argv) {
+  int task_num = argc > 1 ? atoi(argv[1]) : kDefaultTaskNum;
+  int worker_num = argc > 2 ? atoi(argv[2]) : kDefaultWorkerNum;
+  if (task_num < 1) {
+    task_num = kDefaultTaskNum;
+  }
+  if (worker_num < 1) {
+    worker_num = kDefaultWorkerNum;
+  }
+
+  printf("tasks/producer=%d, workers=%d\n", task_num, worker_num);
+  printf("%-10s %-18s %-18s %-18s %-18s\n", "producers",
+         "global ns/task", "ring ns/task", "global Mtasks/s", "ring Mtasks/s");
+  for (int producer_num : kProducerNums) {
+    BenchResult global = RunOnce(THREAD_POOL_GLOBAL_QUEUE, worker_num, producer_num, task_num);
+    BenchResult ring = RunOnce(THREAD_POOL_MPMC_RING, worker_num, producer_num, task_num);
+    printf("%-10d %-18.1f %-18.1f %-18.3f %-18.3f\n", producer_num,
+           global.submit_ns, ring.submit_ns, global.throughput / 1e6, ring.throughput / 1e6);
+  }
+
+  return 0;
+}
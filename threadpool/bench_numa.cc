@@ -0,0 +1,192 @@
+/**
+ * NUMA感知调度下内存密集型任务的吞吐量
+ *
+ * 每个节点上分配若干数据块(由该节点的worker首次写入, 物理页落在该节点),
+ * 任务顺序读取一个数据块并求和. 对比以下配置的总吞吐量和每个节点的吞吐量:
+ *   local:    任务提交到数据所在的节点
+ *   remote:   任务提交到下一个节点, 单节点机器上与local相同
+ *   no-hint:  不指定节点, 外部提交的任务轮流分配到各节点
+ *   floating: 不设置亲和性的线程池, 只统计总吞吐量
+ *
+ * 用法: benchNuma [worker数量] [每个节点的数据块数] [数据块大小KB] [轮数]
+ */
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr int kDefaultChunks = 64;
+  constexpr int kDefaultChunkKb = 1024;
+  constexpr int kDefaultRounds = 10;
+  constexpr int kMaxNodes = 64;
+
+  struct Chunk {
+    long *data;
+    size_t words;
+    long sum;
+  };
+
+  int node_ids[kMaxNodes];
+  int node_num = 0;
+  std::atomic<long> node_bytes[kMaxNodes];
+  std::atomic<long> done{0};
+
+  int NodeIndex(int node) {
+    for (int i = 0; i < node_num; ++i) {
+      if (node_ids[i] == node) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  void TouchTask(void *arg) {
+    Chunk *chunk = static_cast<Chunk*>(arg);
+    for (size_t i = 0; i < chunk->words; ++i) {
+      chunk->data[i] = static_cast<long>(i);
+    }
+    done.fetch_add(1, std::memory_order_release);
+  }
+
+  void SumTask(void *arg) {
+    Chunk *chunk = static_cast<Chunk*>(arg);
+    long sum = 0;
+    for (size_t i = 0; i < chunk->words; ++i) {
+      sum += chunk->data[i];
+    }
+    chunk->sum = sum;
+
+    int index = NodeIndex(getThreadPoolCurrentNode());
+    if (index >= 0) {
+      node_bytes[index].fetch_add(chunk->words * sizeof(long), std::memory_order_relaxed);
+    }
+    done.fetch_add(1, std::memory_order_release);
+  }
+
+  void WaitDone(long expected) {
+    while (done.load(std::memory_order_acquire) < expected) {
+      usleep(50);
+    }
+  }
+
+  // hint_shift为-1表示不指定节点, 否则提交到数据所在节点之后的第hint_shift个节点
+  void RunConfig(const char *name, threadPool *pool, std::vector<std::vector<Chunk>> &chunks,
+                 int rounds, int hint_shift, bool per_node) {
+    for (int i = 0; i < node_num; ++i) {
+      node_bytes[i].store(0);
+    }
+    done.store(0);
+
+    long total = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round) {
+      for (size_t i = 0; i < chunks[0].size(); ++i) {
+        for (int node = 0; node < node_num; ++node) {
+          Chunk *chunk = &chunks[node][i];
+          if (hint_shift < 0) {
+            submitThreadPoolTask(pool, SumTask, chunk);
+          } else {
+            submitThreadPoolTaskOnNode(pool, SumTask, chunk,
+                                       node_ids[(node + hint_shift) % node_num]);
+          }
+          ++total;
+        }
+      }
+    }
+    WaitDone(total);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double bytes = static_cast<double>(total) * chunks[0][0].words * sizeof(long);
+    printf("%-10s %-12.2f", name, bytes / seconds / 1e9);
+    for (int i = 0; i < node_num; ++i) {
+      if (!per_node) {
+        printf(" %-12s", "-");
+      } else {
+        printf(" %-12.2f", node_bytes[i].load() / seconds / 1e9);
+      }
+    }
+    printf("\n");
+  }
+} // namespace
+
+int main(int argc, char **argv) {
+  int workers = argc > 1 ? atoi(argv[1]) : static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+  int chunk_num = argc > 2 ? atoi(argv[2]) : kDefaultChunks;
+  int chunk_kb = argc > 3 ? atoi(argv[3]) : kDefaultChunkKb;
+  int rounds = argc > 4 ? atoi(argv[4]) : kDefaultRounds;
+
+  threadPoolAttr attr;
+  initThreadPoolAttr(&attr);
+  attr.poolNum = workers;
+  attr.pinWorkers = 1;
+  attr.numaAware = 1;
+
+  threadPool pool;
+  if (createThreadPoolWithAttr(&pool, &attr) != 0) {
+    fprintf(stderr, "Create thread pool failed\n");
+    return 1;
+  }
+  node_num = getThreadPoolNodes(&pool, node_ids, kMaxNodes);
+  if (node_num <= 0 || node_num > kMaxNodes) {
+    fprintf(stderr, "No NUMA nodes found\n");
+    return 1;
+  }
+
+  // 由各节点的worker首次写入数据块
+  size_t words = static_cast<size_t>(chunk_kb) * 1024 / sizeof(long);
+  std::vector<std::vector<Chunk>> chunks(node_num, std::vector<Chunk>(chunk_num));
+  done.store(0);
+  for (int node = 0; node < node_num; ++node) {
+    for (Chunk &chunk : chunks[node]) {
+      chunk.data = static_cast<long*>(malloc(words * sizeof(long)));
+      chunk.words = words;
+      submitThreadPoolTaskOnNode(&pool, TouchTask, &chunk, node_ids[node]);
+    }
+  }
+  WaitDone(static_cast<long>(node_num) * chunk_num);
+
+  printf("workers=%d, nodes=%d, chunks=%d x %dKB per node, rounds=%d\n", workers, node_num,
+         chunk_num, chunk_kb, rounds);
+  printf("%-10s %-12s", "config", "total GB/s");
+  for (int i = 0; i < node_num; ++i) {
+    char title[32];
+    snprintf(title, sizeof(title), "node%d GB/s", node_ids[i]);
+    printf(" %-12s", title);
+  }
+  printf("\n");
+
+  RunConfig("local", &pool, chunks, rounds, 0, true);
+  RunConfig("remote", &pool, chunks, rounds, 1, true);
+  RunConfig("no-hint", &pool, chunks, rounds, -1, true);
+  destoryThreadPool(&pool);
+
+  threadPool floating;
+  if (createThreadPool(&floating, workers) != 0) {
+    fprintf(stderr, "Create thread pool failed\n");
+    return 1;
+  }
+  RunConfig("floating", &floating, chunks, rounds, -1, false);
+  destoryThreadPool(&floating);
+
+  for (auto &node_chunks : chunks) {
+    for (Chunk &chunk : node_chunks) {
+      free(chunk.data);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,141 @@
+/**
+ * 优先级通道在批量负载下的排队延迟
+ *
+ * 后台线程持续提交批量任务, 让队列始终处于饱和状态; 同时按固定间隔提交探测任务,
+ * 记录探测任务从提交到开始执行的时间. 对比探测任务分别以批量优先级(和后台任务同一通道,
+ * 等价于只有一个队列), 普通优先级, 延迟敏感优先级, 带截止时间的批量优先级,
+ * 以及带很远截止时间的延迟敏感优先级提交时的p50/p99排队延迟.
+ *
+ * 用法: benchPriority [worker数量] [探测任务数] [批量任务耗时us] [积压上限]
+ */
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr int kDefaultWorkers = 4;
+  constexpr int kDefaultProbes = 2000;
+  constexpr int kDefaultBulkUs = 50;
+  constexpr int kDefaultBacklog = 2000;
+  constexpr int kProbeIntervalUs = 200;
+  constexpr unsigned long kProbeDeadlineUs = 500;
+  constexpr unsigned long kFarDeadlineUs = 10ul * 1000 * 1000;
+
+  int bulk_us = kDefaultBulkUs;
+  std::atomic<long> bulk_pending{0};
+
+  long NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void BulkTask(void *arg) {
+    (void)arg;
+    long end = NowNs() + bulk_us * 1000l;
+    while (NowNs() < end) {
+    }
+    bulk_pending.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  struct Probe {
+    long submit_ns;
+    long start_ns;
+    std::atomic<bool> done{false};
+  };
+
+  void ProbeTask(void *arg) {
+    Probe *probe = static_cast<Probe*>(arg);
+    probe->start_ns = NowNs();
+    probe->done.store(true, std::memory_order_release);
+  }
+
+  void RunConfig(const char *name, int workers, int probes, int backlog,
+                 threadTaskPriority priority, unsigned long deadline_us) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = workers;
+
+    threadPool pool;
+    if (createThreadPoolWithAttr(&pool, &attr) != 0) {
+      fprintf(stderr, "Create thread pool failed\n");
+      exit(1);
+    }
+
+    // 批量任务生产者, 把积压维持在backlog附近
+    std::atomic<bool> stop{false};
+    bulk_pending.store(0);
+    std::thread producer([&] {
+      while (!stop.load(std::memory_order_relaxed)) {
+        if (bulk_pending.load(std::memory_order_relaxed) < backlog) {
+          bulk_pending.fetch_add(1, std::memory_order_relaxed);
+          submitThreadPoolTaskWithPriority(&pool, BulkTask, nullptr, THREAD_TASK_PRIORITY_BULK, 0);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+    while (bulk_pending.load() < backlog) {
+      usleep(100);
+    }
+
+    std::vector<Probe> samples(probes);
+    for (int i = 0; i < probes; ++i) {
+      samples[i].submit_ns = NowNs();
+      submitThreadPoolTaskWithPriority(&pool, ProbeTask, &samples[i], priority, deadline_us);
+      usleep(kProbeIntervalUs);
+    }
+    for (int i = 0; i < probes; ++i) {
+      while (!samples[i].done.load(std::memory_order_acquire)) {
+        usleep(100);
+      }
+    }
+
+    stop.store(true);
+    producer.join();
+    destoryThreadPool(&pool);
+
+    std::vector<double> waits(probes);
+    for (int i = 0; i < probes; ++i) {
+      waits[i] = (samples[i].start_ns - samples[i].submit_ns) / 1e3;
+    }
+    std::sort(waits.begin(), waits.end());
+    printf("%-18s %-12.1f %-12.1f %-12.1f\n", name, waits[probes / 2],
+           waits[std::min(probes - 1, probes * 99 / 100)], waits[probes - 1]);
+  }
+} // namespace
+
+int main(int argc, char **argv) {
+  int workers = argc > 1 ? atoi(argv[1]) : kDefaultWorkers;
+  int probes = argc > 2 ? atoi(argv[2]) : kDefaultProbes;
+  bulk_us = argc > 3 ? atoi(argv[3]) : kDefaultBulkUs;
+  int backlog = argc > 4 ? atoi(argv[4]) : kDefaultBacklog;
+
+  printf("workers=%d, probes=%d, bulk task=%dus, backlog=%d\n", workers, probes, bulk_us, backlog);
+  printf("%-18s %-12s %-12s %-12s\n", "probe priority", "p50 us", "p99 us", "max us");
+  RunConfig("bulk", workers, probes, backlog, THREAD_TASK_PRIORITY_BULK, 0);
+  RunConfig("normal", workers, probes, backlog, THREAD_TASK_PRIORITY_NORMAL, 0);
+  RunConfig("latency", workers, probes, backlog, THREAD_TASK_PRIORITY_LATENCY, 0);
+  RunConfig("bulk+deadline", workers, probes, backlog, THREAD_TASK_PRIORITY_BULK,
+            kProbeDeadlineUs);
+  // 截止时间远大于排队时间, 只能提前不能推后, 结果应与latency相同
+  RunConfig("latency+far dl", workers, probes, backlog, THREAD_TASK_PRIORITY_LATENCY,
+            kFarDeadlineUs);
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+/**
+ * 任务统计的开销测试
+ *
+ * 每种调度模式下分别关闭和开启enableStats, 提交同样数量的小任务(固定次数的空循环),
+ * 比较从提交到全部完成时每个任务的平均耗时, 差值即为统计带来的额外开销.
+ * 开启时同时打印合并后的排队/执行时间百分位数(ns).
+ *
+ * 用法: benchStats [任务数量] [worker数量] [重复次数] [任务循环次数]
+ */
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr int kDefaultTaskNum = 1 << 18;
+  constexpr int kDefaultWorkerNum = 4;
+  constexpr int kDefaultRepeat = 3;
+  constexpr int kDefaultTaskSpins = 1000;
+
+  std::atomic<long> done{0};
+  int task_spins = kDefaultTaskSpins;
+
+  void SmallTask(void *arg) {
+    (void)arg;
+    volatile int sink = 0;
+    for (int i = 0; i < task_spins; ++i) {
+      sink += i;
+    }
+    done.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // 返回每个任务的平均耗时(ns), 开启统计时输出合并后的统计
+  double RunOnce(threadPoolMode mode, int worker_num, int task_num, bool stats_on,
+                 threadWorkerStats *merged) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = worker_num;
+    attr.mode = mode;
+    attr.enableStats = stats_on;
+
+    threadPool pool;
+    if (createThreadPoolWithAttr(&pool, &attr) != 0) {
+      fprintf(stderr, "Create thread pool failed\n");
+      exit(1);
+    }
+
+    done.store(0);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < task_num; ++i) {
+      submitThreadPoolTask(&pool, SmallTask, nullptr);
+    }
+    while (done.load(std::memory_order_acquire) < task_num) {
+      usleep(50);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (stats_on) {
+      // 等最后几个任务的统计写完
+      do {
+        getThreadPoolTaskStats(&pool, merged);
+      } while (merged->tasks < static_cast<unsigned long>(task_num));
+    }
+    destoryThreadPool(&pool);
+    return seconds * 1e9 / task_num;
+  }
+
+  const char *ModeName(threadPoolMode mode) {
+    switch (mode) {
+      case THREAD_POOL_WORK_STEALING: return "stealing";
+      case THREAD_POOL_MPMC_RING: return "ring";
+      default: return "global";
+    }
+  }
+} // namespace
+
+int main(int argc, char **argv) {
+  int task_num = argc > 1 ? atoi(argv[1]) : kDefaultTaskNum;
+  int worker_num = argc > 2 ? atoi(argv[2]) : kDefaultWorkerNum;
+  int repeat = argc > 3 ? atoi(argv[3]) : kDefaultRepeat;
+  task_spins = argc > 4 ? atoi(argv[4]) : kDefaultTaskSpins;
+
+  printf("tasks=%d, workers=%d, spins=%d, best of %d runs\n", task_num, worker_num, task_spins,
+         repeat);
+  printf("%-10s %-10s %-10s %-10s %-10s %-10s %-10s %-10s %-10s\n", "mode", "off ns", "on ns",
+         "delta ns", "overhead", "wait p50", "wait p99", "run p50", "run p99");
+
+  threadPoolMode modes[] = {THREAD_POOL_GLOBAL_QUEUE, THREAD_POOL_WORK_STEALING,
+                            THREAD_POOL_MPMC_RING};
+  for (threadPoolMode mode : modes) {
+    double off = 1e18;
+    double on = 1e18;
+    static threadWorkerStats merged;
+    for (int i = 0; i < repeat; ++i) {
+      off = std::min(off, RunOnce(mode, worker_num, task_num, false, nullptr));
+      on = std::min(on, RunOnce(mode, worker_num, task_num, true, &merged));
+    }
+
+    printf("%-10s %-10.1f %-10.1f %-10.1f %-9.1f%% %-10lu %-10lu %-10lu %-10lu\n", ModeName(mode),
+           off, on, on - off, 100.0 * (on - off) / off,
+           getThreadPoolHistogramPercentile(&merged.queueWait, 50),
+           getThreadPoolHistogramPercentile(&merged.queueWait, 99),
+           getThreadPoolHistogramPercentile(&merged.runTime, 50),
+           getThreadPoolHistogramPercentile(&merged.runTime, 99));
+  }
+
+  return 0;
+}
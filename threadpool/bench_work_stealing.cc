@@ -0,0 +1,124 @@
+/**
+ * 对比全局队列模式与工作窃取模式的任务吞吐量
+ *
+ * external: 主线程提交全部任务
+ * fanout:   根任务在worker线程内以二叉树形式递归提交子任务
+ *
+ * 用法: benchWorkStealing [任务数量]
+ */
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr int kDefaultTaskNum = 1 << 18;
+  constexpr int kThreadNums[] = {1, 2, 4, 8, 16, 32, 64};
+  constexpr int kSpinWork = 64;  // 每个任务的模拟计算量
+
+  struct BenchContext {
+    threadPool *pool;
+    std::vector<threadTask> tasks;
+    std::atomic<int> done{0};
+  };
+
+  inline void SimulateWork(int index) {
+    volatile int sink = index;
+    for (int i = 0; i < kSpinWork; ++i) {
+      sink = sink * 31 + i;
+    }
+  }
+
+  BenchContext *bench_ctx = nullptr;
+
+  void FlatTask(void *arg) {
+    SimulateWork(static_cast<int>(reinterpret_cast<intptr_t>(arg)));
+    bench_ctx->done.fetch_add(1, std::memory_order_release);
+  }
+
+  void TreeTask(void *arg) {
+    int index = static_cast<int>(reinterpret_cast<intptr_t>(arg));
+    int size = static_cast<int>(bench_ctx->tasks.size());
+    for (int child = index * 2 + 1; child <= index * 2 + 2 && child < size; ++child) {
+      addThreadPoolTask(bench_ctx->pool, &bench_ctx->tasks[child]);
+    }
+
+    SimulateWork(index);
+    bench_ctx->done.fetch_add(1, std::memory_order_release);
+  }
+
+  double RunOnce(threadPoolMode mode, int thread_num, int task_num, bool fanout) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = thread_num;
+    attr.mode = mode;
+
+    threadPool pool;
+    if (createThreadPoolWithAttr(&pool, &attr) != 0) {
+      fprintf(stderr, "Create thread pool failed\n");
+      exit(1);
+    }
+
+    BenchContext ctx;
+    ctx.pool = &pool;
+    ctx.tasks.resize(task_num);
+    for (int i = 0; i < task_num; ++i) {
+      ctx.tasks[i].func = fanout ? TreeTask : FlatTask;
+      ctx.tasks[i].userData = reinterpret_cast<void*>(static_cast<intptr_t>(i));
+    }
+    bench_ctx = &ctx;
+
+    auto start = std::chrono::steady_clock::now();
+    if (fanout) {
+      addThreadPoolTask(&pool, &ctx.tasks[0]);
+    } else {
+      for (auto &task : ctx.tasks) {
+        addThreadPoolTask(&pool, &task);
+      }
+    }
+
+    while (ctx.done.load(std::memory_order_acquire) < task_num) {
+      usleep(50);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    destoryThreadPool(&pool);
+    bench_ctx = nullptr;
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    return task_num / seconds;
+  }
+} // namespace
+
+int main(int argc, char **argv) {
+  int task_num = argc > 1 ? atoi(argv[1]) : kDefaultTaskNum;
+  if (task_num < 1) {
+    task_num = kDefaultTaskNum;
+  }
+
+  printf("tasks=%d, throughput in Mtasks/s\n", task_num);
+  printf("%-8s %-10s %-14s %-14s\n", "threads", "workload", "global", "stealing");
+  for (int thread_num : kThreadNums) {
+    for (bool fanout : {false, true}) {
+      double global = RunOnce(THREAD_POOL_GLOBAL_QUEUE, thread_num, task_num, fanout);
+      double stealing = RunOnce(THREAD_POOL_WORK_STEALING, thread_num, task_num, fanout);
+      printf("%-8d %-10s %-14.3f %-14.3f\n", thread_num, fanout ? "fanout" : "external",
+             global / 1e6, stealing / 1e6);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,387 @@
+/**
+ * @file coroutine.h
+ * @author Nick
+ * @brief 在threadPool的worker上调度的C++20协程
+ * @version 0.1
+ * @date 2023-05-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Task<T>是惰性启动的协程, 被co_await时才开始执行, 结束后通过对称转移直接恢复等待者.
+ * co_await scheduler.Schedule()把当前协程挂起并作为任务提交到线程池, 由worker恢复执行;
+ * co_await event在事件触发前挂起, 不占用worker线程, 事件触发后所有等待者被提交到线程池恢复.
+ * 挂起点使用的threadTask内联在协程帧中的awaiter里, 调度本身不分配内存.
+ *
+ * 需要使用-std=c++20编译.
+ */
+
+#ifndef THREADPOOL_COROUTINE_H_
+#define THREADPOOL_COROUTINE_H_
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+template <typename T = void>
+class Task;
+
+namespace coroutine_internal {
+
+// 把协程句柄包装成线程池任务, 必须位于挂起期间一直有效的awaiter中
+struct ResumeTask {
+  threadTask task;
+  std::coroutine_handle<> handle;
+
+  void Submit(threadPool *pool, std::coroutine_handle<> next) {
+    handle = next;
+    task.func = &ResumeTask::Run;
+    task.userData = this;
+    // 有界队列拒绝时在当前线程恢复, 协程不会丢失
+    if (addThreadPoolTask(pool, &task) != 0) {
+      next.resume();
+    }
+  }
+
+  // 恢复后awaiter可能随协程帧一起销毁, 之后不能再访问this
+  static void Run(void *arg) { static_cast<ResumeTask*>(arg)->handle.resume(); }
+};
+
+struct FinalAwaiter {
+  bool await_ready() noexcept { return false; }
+
+  template <typename Promise>
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+    std::coroutine_handle<> continuation = handle.promise().continuation_;
+    return continuation ? continuation : std::noop_coroutine();
+  }
+
+  void await_resume() noexcept {}
+};
+
+class PromiseBase {
+ public:
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { error_ = std::current_exception(); }
+
+ protected:
+  friend struct FinalAwaiter;
+  template <typename T>
+  friend class ::Task;
+
+  std::coroutine_handle<> continuation_;
+  std::exception_ptr error_;
+};
+
+template <typename T>
+class Promise : public PromiseBase {
+ public:
+  Task<T> get_return_object() noexcept;
+
+  template <typename U>
+  void return_value(U &&value) {
+    value_.emplace(std::forward<U>(value));
+  }
+
+  T Take() {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    return std::move(*value_);
+  }
+
+ private:
+  std::optional<T> value_;
+};
+
+template <>
+class Promise<void> : public PromiseBase {
+ public:
+  Task<void> get_return_object() noexcept;
+
+  void return_void() noexcept {}
+
+  void Take() {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+};
+
+// 立即开始执行, 结束后自行销毁的协程, 用于Spawn和SyncWait
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+// 一次性的完成标志, 设置后在标志字上futex唤醒等待者
+class Latch {
+ public:
+  void Set() {
+    done_.store(1, std::memory_order_release);
+    // 等待者看到标志后可能立即返回并销毁Latch, futex唤醒不会解引用该地址
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&done_), FUTEX_WAKE_PRIVATE,
+            INT32_MAX, nullptr, nullptr, 0);
+  }
+
+  void Wait() {
+    while (done_.load(std::memory_order_acquire) == 0) {
+      syscall(SYS_futex, reinterpret_cast<uint32_t*>(&done_), FUTEX_WAIT_PRIVATE,
+              0, nullptr, nullptr, 0);
+    }
+  }
+
+ private:
+  std::atomic<uint32_t> done_{0};
+};
+
+} // namespace coroutine_internal
+
+/**
+ * @brief 惰性启动的协程任务, 只能移动, 只能被co_await一次
+ *
+ * 协程体中抛出的异常在co_await处重新抛出
+ */
+template <typename T>
+class Task {
+ public:
+  using promise_type = coroutine_internal::Promise<T>;
+
+  Task() = default;
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  ~Task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (handle_) {
+        handle_.destroy();
+      }
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+  bool Valid() const { return static_cast<bool>(handle_); }
+
+  auto operator co_await() && noexcept {
+    struct Awaiter {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready() noexcept { return !handle || handle.done(); }
+
+      // 记下等待者后直接转到子协程执行, 子协程结束时再转回来
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation_ = awaiting;
+        return handle;
+      }
+
+      T await_resume() {
+        if (!handle) {
+          throw std::logic_error("co_await on an invalid task");
+        }
+        return handle.promise().Take();
+      }
+    };
+    return Awaiter{handle_};
+  }
+
+ private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+namespace coroutine_internal {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() noexcept {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept {
+  return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // namespace coroutine_internal
+
+/**
+ * @brief 把协程调度到threadPool上执行
+ */
+class Scheduler {
+ public:
+  explicit Scheduler(threadPool *pool) : pool_(pool) {
+    if (!pool_) {
+      throw std::invalid_argument("Scheduler needs a thread pool");
+    }
+  }
+
+  threadPool *pool() const { return pool_; }
+
+  /**
+   * @brief co_await scheduler.Schedule()挂起当前协程, 由线程池的worker恢复执行
+   */
+  auto Schedule() noexcept {
+    struct Awaiter {
+      threadPool *pool;
+      coroutine_internal::ResumeTask resume;
+
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> handle) noexcept { resume.Submit(pool, handle); }
+      void await_resume() noexcept {}
+    };
+    return Awaiter{pool_, {}};
+  }
+
+  /**
+   * @brief 在线程池上启动task, 不等待结果; task结束后自动释放.
+   *        task抛出的异常无法传递, 会调用std::terminate
+   */
+  void Spawn(Task<void> task) { SpawnImpl(*this, std::move(task)); }
+
+ private:
+  static coroutine_internal::Detached SpawnImpl(Scheduler scheduler, Task<void> task) {
+    co_await scheduler.Schedule();
+    co_await std::move(task);
+  }
+
+  threadPool *pool_;
+};
+
+/**
+ * @brief 阻塞当前线程直到task完成并返回结果, 用于从普通代码进入协程.
+ *
+ * task在调用线程上开始执行, 直到第一次挂起; 不要在worker线程中调用, 否则会占住该worker
+ */
+template <typename T>
+T SyncWait(Task<T> task) {
+  coroutine_internal::Latch latch;
+  std::exception_ptr error;
+
+  if constexpr (std::is_void_v<T>) {
+    [](Task<T> task, coroutine_internal::Latch &latch,
+       std::exception_ptr &error) -> coroutine_internal::Detached {
+      try {
+        co_await std::move(task);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      latch.Set();
+    }(std::move(task), latch, error);
+
+    latch.Wait();
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  } else {
+    std::optional<T> result;
+    [](Task<T> task, coroutine_internal::Latch &latch, std::exception_ptr &error,
+       std::optional<T> &result) -> coroutine_internal::Detached {
+      try {
+        result.emplace(co_await std::move(task));
+      } catch (...) {
+        error = std::current_exception();
+      }
+      latch.Set();
+    }(std::move(task), latch, error, result);
+
+    latch.Wait();
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    return std::move(*result);
+  }
+}
+
+/**
+ * @brief 一次性事件, 例如I/O就绪通知. 等待者挂起时不占用线程,
+ *        Set()之后所有等待者被提交到线程池恢复, 之后的co_await立即返回
+ *
+ * 等待者链表使用无锁栈, 状态为this表示已触发
+ */
+class Event {
+ public:
+  explicit Event(Scheduler scheduler) : pool_(scheduler.pool()) {}
+
+  Event(const Event &) = delete;
+  Event &operator=(const Event &) = delete;
+
+  bool IsSet() const { return state_.load(std::memory_order_acquire) == this; }
+
+  void Set() {
+    void *old = state_.exchange(this, std::memory_order_acq_rel);
+    if (old == this) {
+      return;
+    }
+
+    Awaiter *waiter = static_cast<Awaiter*>(old);
+    while (waiter) {
+      // 提交后等待者可能立即恢复并销毁awaiter, 先取出next
+      Awaiter *next = waiter->next;
+      waiter->resume.Submit(pool_, waiter->handle);
+      waiter = next;
+    }
+  }
+
+  struct Awaiter {
+    Event *event;
+    std::coroutine_handle<> handle;
+    Awaiter *next = nullptr;
+    coroutine_internal::ResumeTask resume{};
+
+    bool await_ready() const noexcept { return event->IsSet(); }
+
+    bool await_suspend(std::coroutine_handle<> awaiting) noexcept {
+      handle = awaiting;
+      void *old = event->state_.load(std::memory_order_acquire);
+      do {
+        if (old == event) {
+          return false;
+        }
+        next = static_cast<Awaiter*>(old);
+      } while (!event->state_.compare_exchange_weak(old, this, std::memory_order_release,
+                                                    std::memory_order_acquire));
+      return true;
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  Awaiter operator co_await() noexcept { return Awaiter{this, {}}; }
+
+ private:
+  threadPool *pool_;
+  std::atomic<void*> state_{nullptr};
+};
+
+#endif // THREADPOOL_COROUTINE_H_
@@ -0,0 +1,517 @@
+/**
+ * @file future.h
+ * @author Nick
+ * @brief 基于threadPool的轻量future
+ * @version 0.1
+ * @date 2023-05-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * 每个任务只分配一次: 任务节点, 状态字和结果都内联在同一个状态对象中.
+ * 状态字低位保存就绪/有后续任务/有等待者标志, 高位保存引用计数,
+ * 等待者直接在状态字上futex休眠.
+ *
+ * Future只能移动, Get和Then都会消耗Future; 每个Future最多挂一个后续任务.
+ */
+
+#ifndef THREADPOOL_FUTURE_H_
+#define THREADPOOL_FUTURE_H_
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+template <typename T>
+class Future;
+
+namespace future_internal {
+
+constexpr uint32_t kReady = 1u << 0;
+constexpr uint32_t kHasContinuation = 1u << 1;
+constexpr uint32_t kWaiting = 1u << 2;
+constexpr uint32_t kRefShift = 3;
+constexpr uint32_t kRefOne = 1u << kRefShift;
+constexpr int kWaitSpins = 128;
+
+// void结果用空结构代替, 内部统一按值存储
+struct Unit {};
+
+template <typename T>
+using Stored = std::conditional_t<std::is_void_v<T>, Unit, T>;
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+inline void FutexWait(std::atomic<uint32_t> *word, uint32_t expected) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE,
+          expected, nullptr, nullptr, 0);
+}
+
+inline void FutexWakeAll(std::atomic<uint32_t> *word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE,
+          INT32_MAX, nullptr, nullptr, 0);
+}
+
+class StateBase {
+ public:
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                "futex needs a plain 32-bit state word");
+
+  explicit StateBase(threadPool *pool) : pool_(pool), state_(kRefOne) {
+    task_.func = &StateBase::RunTask;
+    task_.userData = this;
+  }
+  virtual ~StateBase() = default;
+
+  StateBase(const StateBase &) = delete;
+  StateBase &operator=(const StateBase &) = delete;
+
+  void AddRef() { state_.fetch_add(kRefOne, std::memory_order_relaxed); }
+
+  void Release() {
+    uint32_t old = state_.fetch_sub(kRefOne, std::memory_order_acq_rel);
+    if ((old >> kRefShift) == 1) {
+      delete this;
+    }
+  }
+
+  bool IsReady() const {
+    return (state_.load(std::memory_order_acquire) & kReady) != 0;
+  }
+
+  void Wait() {
+    for (int i = 0; i < kWaitSpins; ++i) {
+      if (IsReady()) {
+        return;
+      }
+      CpuRelax();
+    }
+
+    uint32_t state = state_.load(std::memory_order_acquire);
+    while (!(state & kReady)) {
+      if (!(state & kWaiting)) {
+        if (!state_.compare_exchange_weak(state, state | kWaiting,
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_acquire)) {
+          continue;
+        }
+        state |= kWaiting;
+      }
+
+      FutexWait(&state_, state);
+      state = state_.load(std::memory_order_acquire);
+    }
+  }
+
+  /**
+   * @brief 把自己作为任务提交到线程池, 执行期间持有一个引用
+   */
+  void Schedule() {
+    AddRef();
+    Submit();
+  }
+
+  /**
+   * @brief 挂上后续状态, 本状态就绪时调用next->OnDependencyReady().
+   *        调用者需要事先为next增加一个引用, 由OnDependencyReady接管
+   */
+  void SetContinuation(StateBase *next) {
+    continuation_ = next;
+    uint32_t state = state_.load(std::memory_order_acquire);
+    while (true) {
+      if (state & kReady) {
+        next->OnDependencyReady();
+        return;
+      }
+
+      if (state_.compare_exchange_weak(state, state | kHasContinuation,
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_acquire)) {
+        return;
+      }
+    }
+  }
+
+  threadPool *pool() const { return pool_; }
+
+ protected:
+  virtual void Run() = 0;
+
+  // 依赖的状态就绪后的动作, 默认把自己提交到线程池执行, 沿用挂载时持有的引用
+  virtual void OnDependencyReady() { Submit(); }
+
+  // 有界队列拒绝时在当前线程执行, 保证状态总能就绪
+  void Submit() {
+    if (addThreadPoolTask(pool_, &task_) != 0) {
+      RunTask(this);
+    }
+  }
+
+  void Complete() {
+    uint32_t old = state_.fetch_or(kReady, std::memory_order_acq_rel);
+    if (old & kWaiting) {
+      FutexWakeAll(&state_);
+    }
+
+    if (old & kHasContinuation) {
+      continuation_->OnDependencyReady();
+    }
+  }
+
+ private:
+  static void RunTask(void *arg) {
+    StateBase *state = static_cast<StateBase*>(arg);
+    state->Run();
+    state->Release();
+  }
+
+  threadPool *pool_;
+  threadTask task_;
+  std::atomic<uint32_t> state_;
+  StateBase *continuation_ = nullptr;
+};
+
+template <typename T>
+class ValueState : public StateBase {
+ public:
+  using StateBase::StateBase;
+
+  ~ValueState() override {
+    if (has_value_) {
+      using Value = Stored<T>;
+      reinterpret_cast<Value*>(storage_)->~Value();
+    }
+  }
+
+  template <typename... Args>
+  void SetValue(Args &&...args) {
+    new (storage_) Stored<T>(std::forward<Args>(args)...);
+    has_value_ = true;
+  }
+
+  void SetError(std::exception_ptr error) { error_ = std::move(error); }
+
+  bool HasError() const { return error_ != nullptr; }
+  std::exception_ptr Error() const { return error_; }
+
+  // 调用前必须已经就绪
+  Stored<T> &&TakeValue() {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    return std::move(*reinterpret_cast<Stored<T>*>(storage_));
+  }
+
+  // 执行func并保存结果或异常, 不负责Complete
+  template <typename F, typename... Args>
+  void Invoke(F &func, Args &&...args) {
+    try {
+      if constexpr (std::is_void_v<T>) {
+        func(std::forward<Args>(args)...);
+        SetValue();
+      } else {
+        SetValue(func(std::forward<Args>(args)...));
+      }
+    } catch (...) {
+      SetError(std::current_exception());
+    }
+  }
+
+ private:
+  alignas(Stored<T>) unsigned char storage_[sizeof(Stored<T>)];
+  bool has_value_ = false;
+  std::exception_ptr error_;
+};
+
+template <typename T, typename F>
+class AsyncState : public ValueState<T> {
+ public:
+  AsyncState(threadPool *pool, F &&func)
+      : ValueState<T>(pool), func_(std::move(func)) {}
+
+ protected:
+  void Run() override {
+    this->Invoke(func_);
+    this->Complete();
+  }
+
+ private:
+  F func_;
+};
+
+// 前驱就绪后在线程池中执行func(前驱的值), 前驱出错时直接传递异常
+template <typename T, typename R, typename F>
+class ThenState : public ValueState<R> {
+ public:
+  ThenState(threadPool *pool, ValueState<T> *parent, F &&func)
+      : ValueState<R>(pool), parent_(parent), func_(std::move(func)) {}
+
+  ~ThenState() override {
+    if (parent_) {
+      parent_->Release();
+    }
+  }
+
+ protected:
+  void Run() override {
+    if (parent_->HasError()) {
+      this->SetError(parent_->Error());
+    } else if constexpr (std::is_void_v<T>) {
+      this->Invoke(func_);
+    } else {
+      this->Invoke(func_, parent_->TakeValue());
+    }
+
+    parent_->Release();
+    parent_ = nullptr;
+    this->Complete();
+  }
+
+ private:
+  ValueState<T> *parent_;
+  F func_;
+};
+
+template <typename T>
+using WhenAllResult =
+    std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+
+// 所有前驱都挂在同一个状态上, 最后一个就绪的前驱把汇总任务提交到线程池
+template <typename T>
+class WhenAllState : public ValueState<WhenAllResult<T>> {
+ public:
+  WhenAllState(threadPool *pool, std::vector<ValueState<T>*> &&parents)
+      : ValueState<WhenAllResult<T>>(pool),
+        parents_(std::move(parents)),
+        remaining_(static_cast<int>(parents_.size())) {}
+
+  const std::vector<ValueState<T>*> &Parents() const { return parents_; }
+
+  ~WhenAllState() override {
+    for (ValueState<T> *parent : parents_) {
+      parent->Release();
+    }
+  }
+
+ protected:
+  // 所有前驱共用一个挂载引用, 由最后一个就绪的前驱接管
+  void OnDependencyReady() override {
+    if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      this->Submit();
+    }
+  }
+
+  void Run() override {
+    std::exception_ptr error;
+    if constexpr (!std::is_void_v<T>) {
+      results_.reserve(parents_.size());
+    }
+
+    for (ValueState<T> *parent : parents_) {
+      if (parent->HasError()) {
+        if (!error) {
+          error = parent->Error();
+        }
+      } else if constexpr (!std::is_void_v<T>) {
+        results_.push_back(std::move(parent->TakeValue()));
+      }
+    }
+
+    if (error) {
+      this->SetError(error);
+    } else if constexpr (std::is_void_v<T>) {
+      this->SetValue();
+    } else {
+      this->SetValue(std::move(results_));
+    }
+    this->Complete();
+  }
+
+ private:
+  std::vector<ValueState<T>*> parents_;
+  std::atomic<int> remaining_;
+  Stored<WhenAllResult<T>> results_;
+};
+
+} // namespace future_internal
+
+template <typename T>
+class Future {
+ public:
+  Future() = default;
+  explicit Future(future_internal::ValueState<T> *state) : state_(state) {}
+
+  ~Future() { Reset(); }
+
+  Future(Future &&other) noexcept : state_(other.state_) { other.state_ = nullptr; }
+  Future &operator=(Future &&other) noexcept {
+    if (this != &other) {
+      Reset();
+      state_ = other.state_;
+      other.state_ = nullptr;
+    }
+    return *this;
+  }
+
+  Future(const Future &) = delete;
+  Future &operator=(const Future &) = delete;
+
+  bool Valid() const { return state_ != nullptr; }
+  bool IsReady() const { return state_ && state_->IsReady(); }
+
+  /**
+   * @brief 阻塞等待结果就绪, 先短暂自旋再在状态字上futex休眠
+   */
+  void Wait() const {
+    if (!state_) {
+      throw std::logic_error("Wait on an invalid future");
+    }
+    state_->Wait();
+  }
+
+  /**
+   * @brief 等待并取出结果, 任务抛出的异常在此重新抛出, 调用后Future失效
+   */
+  T Get() {
+    Wait();
+    future_internal::ValueState<T> *state = state_;
+    state_ = nullptr;
+
+    struct Releaser {
+      future_internal::ValueState<T> *state;
+      ~Releaser() { state->Release(); }
+    } releaser{state};
+
+    if constexpr (std::is_void_v<T>) {
+      state->TakeValue();
+    } else {
+      return std::move(state->TakeValue());
+    }
+  }
+
+  /**
+   * @brief 挂上后续任务, 结果就绪后在线程池中以结果为参数执行func, 调用后Future失效
+   *
+   * @return Future<R> func返回值的Future, 前驱的异常会直接传递下去
+   */
+  template <typename F>
+  auto Then(F &&func) {
+    using Func = std::decay_t<F>;
+    using R = std::conditional_t<std::is_void_v<T>, std::invoke_result<Func>,
+                                 std::invoke_result<Func, T>>;
+    using Result = typename R::type;
+
+    if (!state_) {
+      throw std::logic_error("Then on an invalid future");
+    }
+
+    future_internal::ValueState<T> *parent = state_;
+    state_ = nullptr;
+
+    auto *next = new future_internal::ThenState<T, Result, Func>(
+        parent->pool(), parent, Func(std::forward<F>(func)));
+    // 返回的Future持有一个引用, 前驱通过continuation再持有一个
+    next->AddRef();
+    parent->SetContinuation(next);
+    return Future<Result>(next);
+  }
+
+  future_internal::ValueState<T> *Detach() {
+    future_internal::ValueState<T> *state = state_;
+    state_ = nullptr;
+    return state;
+  }
+
+ private:
+  void Reset() {
+    if (state_) {
+      state_->Release();
+      state_ = nullptr;
+    }
+  }
+
+  future_internal::ValueState<T> *state_ = nullptr;
+};
+
+/**
+ * @brief 在线程池中异步执行func
+ *
+ * @return Future<R> func返回值的Future
+ */
+template <typename F>
+auto Async(threadPool *pool, F &&func) {
+  using Func = std::decay_t<F>;
+  using Result = std::invoke_result_t<Func>;
+
+  if (!pool) {
+    throw std::invalid_argument("Async on a null thread pool");
+  }
+
+  auto *state = new future_internal::AsyncState<Result, Func>(pool, Func(std::forward<F>(func)));
+  state->Schedule();
+  return Future<Result>(state);
+}
+
+/**
+ * @brief 所有Future就绪后得到汇总结果, 汇总在线程池中完成, 不阻塞调用者
+ *
+ * @return Future<std::vector<T>> 按输入顺序排列的结果(T为void时为Future<void>),
+ *         任一输入出错时传递第一个异常
+ */
+template <typename T>
+Future<future_internal::WhenAllResult<T>> WhenAll(threadPool *pool,
+                                                  std::vector<Future<T>> futures) {
+  if (!pool) {
+    throw std::invalid_argument("WhenAll on a null thread pool");
+  }
+
+  std::vector<future_internal::ValueState<T>*> parents;
+  parents.reserve(futures.size());
+  for (auto &future : futures) {
+    if (!future.Valid()) {
+      throw std::logic_error("WhenAll on an invalid future");
+    }
+  }
+  for (auto &future : futures) {
+    parents.push_back(future.Detach());
+  }
+
+  auto *state = new future_internal::WhenAllState<T>(pool, std::move(parents));
+  Future<future_internal::WhenAllResult<T>> result(state);
+
+  const auto &inputs = state->Parents();
+  if (inputs.empty()) {
+    state->Schedule();
+    return result;
+  }
+
+  state->AddRef();
+  for (future_internal::ValueState<T> *parent : inputs) {
+    parent->SetContinuation(state);
+  }
+  return result;
+}
+
+#endif // THREADPOOL_FUTURE_H_
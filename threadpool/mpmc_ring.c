@@ -0,0 +1,92 @@
+#include "mpmc_ring.h"
+#include <stdlib.h>
+
+int mpmcRingInit(mpmcRing *ring, unsigned long capacity) {
+    unsigned long size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    ring->cells = (mpmcCell *)aligned_alloc(THREAD_POOL_CACHE_LINE,
+                                            size * sizeof(mpmcCell));
+    if (!ring->cells) {
+        return -1;
+    }
+
+    for (unsigned long i = 0; i < size; ++i) {
+        ring->cells[i].sequence = i;
+        ring->cells[i].task = NULL;
+    }
+
+    ring->mask = size - 1;
+    ring->enqueuePos = 0;
+    ring->dequeuePos = 0;
+    return 0;
+}
+
+void mpmcRingDestroy(mpmcRing *ring) {
+    free(ring->cells);
+    ring->cells = NULL;
+}
+
+int mpmcRingPush(mpmcRing *ring, threadTask *task) {
+    unsigned long pos = __atomic_load_n(&ring->enqueuePos, __ATOMIC_RELAXED);
+    mpmcCell *cell;
+
+    while (1) {
+        cell = &ring->cells[pos & ring->mask];
+        unsigned long seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)pos;
+
+        if (diff == 0) {
+            // 槽位空闲, 尝试占有
+            if (__atomic_compare_exchange_n(&ring->enqueuePos, &pos, pos + 1, 1,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // 槽位仍未被消费者取走, 队列已满
+            return -1;
+        } else {
+            pos = __atomic_load_n(&ring->enqueuePos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->task = task;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+threadTask *mpmcRingPop(mpmcRing *ring) {
+    unsigned long pos = __atomic_load_n(&ring->dequeuePos, __ATOMIC_RELAXED);
+    mpmcCell *cell;
+
+    while (1) {
+        cell = &ring->cells[pos & ring->mask];
+        unsigned long seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)(pos + 1);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->dequeuePos, &pos, pos + 1, 1,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // 槽位尚未写入, 队列为空
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&ring->dequeuePos, __ATOMIC_RELAXED);
+        }
+    }
+
+    threadTask *task = cell->task;
+    // 标记槽位可供下一轮生产者使用
+    __atomic_store_n(&cell->sequence, pos + ring->mask + 1, __ATOMIC_RELEASE);
+    return task;
+}
+
+unsigned long mpmcRingSize(mpmcRing *ring) {
+    unsigned long dequeuePos = __atomic_load_n(&ring->dequeuePos, __ATOMIC_RELAXED);
+    unsigned long enqueuePos = __atomic_load_n(&ring->enqueuePos, __ATOMIC_RELAXED);
+    return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file mpmc_ring.h
+ * @author Nick
+ * @brief 有界多生产者多消费者无锁环形队列
+ * @version 0.1
+ * @date 2023-05-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * 每个槽位带一个序号, 生产者和消费者分别CAS推进入队/出队位置,
+ * 参考 Dmitry Vyukov 的 bounded MPMC queue. 出队顺序与入队顺序一致(FIFO).
+ */
+
+#ifndef MPMC_RING_H_
+#define MPMC_RING_H_
+
+#include "threadpool.h"
+
+typedef struct mpmcCell {
+    unsigned long sequence;
+    threadTask *task;
+} mpmcCell;
+
+typedef struct mpmcRing {
+    mpmcCell *cells;
+    unsigned long mask;
+
+    // 入队和出队位置分别被生产者和消费者频繁修改, 各占一个cache line
+    unsigned long enqueuePos __attribute__((aligned(THREAD_POOL_CACHE_LINE)));
+    unsigned long dequeuePos __attribute__((aligned(THREAD_POOL_CACHE_LINE)));
+} mpmcRing;
+
+/**
+ * @brief 初始化环形队列, 容量向上取整为2的幂
+ *
+ * @return int 0表示成功, -1表示内存不足
+ */
+int mpmcRingInit(mpmcRing *ring, unsigned long capacity);
+void mpmcRingDestroy(mpmcRing *ring);
+
+/**
+ * @brief 入队
+ *
+ * @return int 0表示成功, -1表示队列已满
+ */
+int mpmcRingPush(mpmcRing *ring, threadTask *task);
+
+/**
+ * @brief 出队
+ *
+ * @return threadTask* 队列为空时返回NULL
+ */
+threadTask *mpmcRingPop(mpmcRing *ring);
+
+/**
+ * @brief 粗略的队列长度, 仅用于统计
+ */
+unsigned long mpmcRingSize(mpmcRing *ring);
+
+#endif // MPMC_RING_H_
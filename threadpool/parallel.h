@@ -0,0 +1,343 @@
+/**
+ * @file parallel.h
+ * @author Nick
+ * @brief 基于threadPool的并行循环和并行归约
+ * @version 0.1
+ * @date 2023-05-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * 区间按需递归二分: 执行区间的线程每处理完一个粒度的块就检查还有多少已提交但未开始的子任务,
+ * 少于worker数量时才把剩余区间的右半部分提交到线程池, 否则继续串行处理.
+ * 所有worker都在忙时几乎不产生额外任务, 有空闲worker时快速拆分 (lazy binary splitting).
+ *
+ * 调用线程自己执行根区间, 之后用tryRunThreadPoolTask帮忙执行排队的任务,
+ * 没有任务可执行时才在计数器上futex休眠, 因此可以在worker线程内嵌套调用.
+ *
+ * 归约时每个区间把自己处理的块累加到区间自己的结果上, 拆出的子区间挂在父区间下,
+ * 全部完成后由调用者按区间顺序合并, 执行过程中线程之间不共享任何部分结果.
+ */
+
+#ifndef THREADPOOL_PARALLEL_H_
+#define THREADPOOL_PARALLEL_H_
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace parallel_internal {
+
+constexpr uint32_t kWaiting = 1u;
+constexpr uint32_t kTaskOne = 2u;  // 计数器低位是等待标志, 高位是未完成的子任务数量
+constexpr int kWaitSpins = 128;
+constexpr long kAutoChunksPerThread = 16;
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+// 弹性模式下是worker数量的上限
+inline int WorkerCount(threadPool *pool) {
+  return pool->workerNum > 0 ? pool->workerNum : 1;
+}
+
+// grain为0时按线程数量自动选择, 保证每个线程平均能分到多个块
+template <typename Index>
+Index ChooseGrain(threadPool *pool, Index begin, Index end, Index grain) {
+  if (grain > 0) {
+    return grain;
+  }
+
+  Index chunks = static_cast<Index>((WorkerCount(pool) + 1) * kAutoChunksPerThread);
+  Index auto_grain = (end - begin) / chunks;
+  return auto_grain > 0 ? auto_grain : 1;
+}
+
+// 不需要归约结果的并行循环
+struct NoResult {};
+
+/**
+ * 一次并行调用的共享状态, 分配在调用者的栈上.
+ * Body(begin, end)处理一个子区间, 归约时是Body(begin, end, Result &acc), 累加到所在区间的结果上.
+ * 抛出异常后剩余的块不再执行
+ */
+template <typename Index, typename Body, typename Result = NoResult>
+class Job {
+ public:
+  Job(threadPool *pool, Index grain, Body &body, Result init = Result())
+      : pool_(pool), grain_(grain), split_limit_(WorkerCount(pool)), body_(body), init_(std::move(init)) {}
+
+  Job(const Job &) = delete;
+  Job &operator=(const Job &) = delete;
+
+  // 调用线程执行根区间, 然后帮忙执行排队任务直到所有子任务完成
+  void Run(Index begin, Index end) {
+    RangeTask root(this, begin, end);
+    Execute(&root);
+    Join();
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+  // 同Run, 之后按区间顺序合并所有区间的结果
+  template <typename Combine>
+  Result Reduce(Index begin, Index end, Combine &combine) {
+    RangeTask root(this, begin, end);
+    Execute(&root);
+    Join();
+
+    struct Cleanup {
+      RangeTask *root;
+      ~Cleanup() { FreeChildren(root); }
+    } cleanup{&root};
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    return Collect(&root, combine);
+  }
+
+ private:
+  static constexpr bool kReduce = !std::is_same_v<Result, NoResult>;
+
+  /**
+   * 区间从右往左拆分, 先拆出的子区间在右边. 子区间按拆出的先后挂在父区间下,
+   * last_child是最后拆出的, 也就是最靠左的, 沿prev_sibling依次向右.
+   * 归约时子区间执行完后保留到调用者合并, 否则执行完立即释放.
+   */
+  struct RangeTask {
+    RangeTask(Job *job, Index begin, Index end) : job(job), begin(begin), end(end), result(job->init_) {}
+
+    threadTask task = threadTask();
+    Job *job;
+    Index begin;
+    Index end;
+    Result result;
+    RangeTask *last_child = nullptr;
+    RangeTask *prev_sibling = nullptr;
+  };
+
+  // 区间自己的结果在左, 子区间在右
+  template <typename Combine>
+  static Result Collect(RangeTask *range, Combine &combine) {
+    Result result = std::move(range->result);
+    for (RangeTask *child = range->last_child; child != nullptr; child = child->prev_sibling) {
+      result = combine(std::move(result), Collect(child, combine));
+    }
+    return result;
+  }
+
+  static void FreeChildren(RangeTask *range) {
+    RangeTask *child = range->last_child;
+    while (child != nullptr) {
+      RangeTask *next = child->prev_sibling;
+      FreeChildren(child);
+      delete child;
+      child = next;
+    }
+    range->last_child = nullptr;
+  }
+
+  static void RunRange(void *arg) {
+    RangeTask *range = static_cast<RangeTask*>(arg);
+    Job *job = range->job;
+
+    job->unstarted_.fetch_sub(1, std::memory_order_relaxed);
+    job->Execute(range);
+    if constexpr (!kReduce) {
+      delete range;
+    }
+
+    // 计数器归零后调用者可能立即返回, 此后只能用futex唤醒, 不能再访问job的其他成员
+    uint32_t old = job->pending_.fetch_sub(kTaskOne, std::memory_order_acq_rel);
+    if ((old & ~kWaiting) == kTaskOne && (old & kWaiting)) {
+      syscall(SYS_futex, reinterpret_cast<uint32_t*>(&job->pending_), FUTEX_WAKE_PRIVATE,
+              INT32_MAX, nullptr, nullptr, 0);
+    }
+  }
+
+  void Spawn(RangeTask *parent, Index begin, Index end) {
+    RangeTask *range = new RangeTask(this, begin, end);
+    range->task.func = &Job::RunRange;
+    range->task.userData = range;
+    if constexpr (kReduce) {
+      range->prev_sibling = parent->last_child;
+      parent->last_child = range;
+    }
+
+    pending_.fetch_add(kTaskOne, std::memory_order_relaxed);
+    unstarted_.fetch_add(1, std::memory_order_relaxed);
+    if (addThreadPoolTask(pool_, &range->task) != 0) {
+      // 提交失败时由当前线程自己执行
+      unstarted_.fetch_sub(1, std::memory_order_relaxed);
+      pending_.fetch_sub(kTaskOne, std::memory_order_relaxed);
+      Execute(range);
+      if constexpr (!kReduce) {
+        delete range;
+      }
+    }
+  }
+
+  // 只由执行range的线程调用, 拆出的子区间也只由这个线程挂到range下
+  void Execute(RangeTask *range) {
+    Index begin = range->begin;
+    Index end = range->end;
+    while (begin < end && !failed_.load(std::memory_order_relaxed)) {
+      if (end - begin > grain_ &&
+          unstarted_.load(std::memory_order_relaxed) < split_limit_) {
+        Index mid = begin + (end - begin) / 2;
+        Spawn(range, mid, end);
+        end = mid;
+        continue;
+      }
+
+      Index chunk_end = end - begin > grain_ ? begin + grain_ : end;
+      try {
+        if constexpr (kReduce) {
+          body_(begin, chunk_end, range->result);
+        } else {
+          body_(begin, chunk_end);
+        }
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        if (!error_) {
+          error_ = std::current_exception();
+        }
+        failed_.store(true, std::memory_order_relaxed);
+      }
+      begin = chunk_end;
+    }
+  }
+
+  void Join() {
+    int spins = 0;
+    while (true) {
+      uint32_t pending = pending_.load(std::memory_order_acquire);
+      if ((pending & ~kWaiting) == 0) {
+        return;
+      }
+
+      if (tryRunThreadPoolTask(pool_) > 0) {
+        spins = 0;
+        continue;
+      }
+
+      if (++spins < kWaitSpins) {
+        CpuRelax();
+        continue;
+      }
+
+      // 剩下的子任务都在其他线程上执行, 休眠等待最后一个完成
+      if (!(pending & kWaiting)) {
+        if (!pending_.compare_exchange_weak(pending, pending | kWaiting,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+          continue;
+        }
+        pending |= kWaiting;
+      }
+      syscall(SYS_futex, reinterpret_cast<uint32_t*>(&pending_), FUTEX_WAIT_PRIVATE,
+              pending, nullptr, nullptr, 0);
+      spins = 0;
+    }
+  }
+
+  threadPool *pool_;
+  Index grain_;
+  int split_limit_;
+  Body &body_;
+  Result init_;
+
+  std::atomic<uint32_t> pending_{0};
+  std::atomic<int> unstarted_{0};
+  std::atomic<bool> failed_{false};
+  std::mutex error_mutex_;
+  std::exception_ptr error_;
+};
+
+} // namespace parallel_internal
+
+/**
+ * @brief 并行执行[begin, end)上的循环, 调用线程参与执行, 所有迭代完成后返回
+ *
+ * @param grain 最小块大小, 0表示按线程数量自动选择
+ * @param func 接受func(i)或func(blockBegin, blockEnd)两种形式
+ *
+ * 迭代中抛出的第一个异常在所有已开始的块结束后重新抛出, 尚未开始的块不再执行
+ */
+template <typename Index, typename F>
+void ParallelFor(threadPool *pool, Index begin, Index end, Index grain, F &&func) {
+  static_assert(std::is_integral_v<Index>, "ParallelFor needs an integral index");
+  if (!pool) {
+    throw std::invalid_argument("ParallelFor needs a thread pool");
+  }
+  if (begin >= end) {
+    return;
+  }
+
+  auto body = [&func](Index block_begin, Index block_end) {
+    if constexpr (std::is_invocable_v<F&, Index, Index>) {
+      func(block_begin, block_end);
+    } else {
+      for (Index i = block_begin; i < block_end; ++i) {
+        func(i);
+      }
+    }
+  };
+
+  Index chosen = parallel_internal::ChooseGrain(pool, begin, end, grain);
+  parallel_internal::Job<Index, decltype(body)> job(pool, chosen, body);
+  job.Run(begin, end);
+}
+
+/**
+ * @brief 并行归约[begin, end)
+ *
+ * @param identity combine的单位元, 每个连续子区间的累加都从它开始
+ * @param body T body(blockBegin, blockEnd, T init), 把区间内的元素累加到init上返回,
+ *             同一个子区间的各个块依次累加在同一个值上
+ * @param combine T combine(T left, T right), 必须满足结合律, 不要求交换律
+ *
+ * 各子区间的部分结果在全部完成后按区间顺序合并, 因此结果与串行执行的结合顺序一致
+ */
+template <typename Index, typename T, typename Body, typename Combine>
+T ParallelReduce(threadPool *pool, Index begin, Index end, Index grain, T identity,
+                 Body &&body, Combine &&combine) {
+  static_assert(std::is_integral_v<Index>, "ParallelReduce needs an integral index");
+  if (!pool) {
+    throw std::invalid_argument("ParallelReduce needs a thread pool");
+  }
+  if (begin >= end) {
+    return identity;
+  }
+
+  auto block = [&body](Index block_begin, Index block_end, T &acc) {
+    acc = body(block_begin, block_end, std::move(acc));
+  };
+
+  Index chosen = parallel_internal::ChooseGrain(pool, begin, end, grain);
+  parallel_internal::Job<Index, decltype(block), T> job(pool, chosen, block, std::move(identity));
+  return job.Reduce(begin, end, combine);
+}
+
+#endif // THREADPOOL_PARALLEL_H_
@@ -0,0 +1,142 @@
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "coroutine.h"
+
+namespace {
+  constexpr int kWorkerNum = 2;
+
+  class CoroutineTest : public testing::TestWithParam<threadPoolMode> {
+   protected:
+    void SetUp() override {
+      threadPoolAttr attr;
+      initThreadPoolAttr(&attr);
+      attr.poolNum = kWorkerNum;
+      attr.mode = GetParam();
+      ASSERT_EQ(createThreadPoolWithAttr(&pool_, &attr), 0);
+    }
+
+    void TearDown() override { destoryThreadPool(&pool_); }
+
+    threadPool pool_;
+  };
+
+  Task<int> AddOnPool(Scheduler scheduler, int a, int b) {
+    co_await scheduler.Schedule();
+    co_return a + b;
+  }
+
+  Task<int> Chain(Scheduler scheduler, int depth) {
+    if (depth == 0) {
+      co_return 0;
+    }
+    int value = co_await Chain(scheduler, depth - 1);
+    co_await scheduler.Schedule();
+    co_return value + 1;
+  }
+
+  Task<int> Throws(Scheduler scheduler) {
+    co_await scheduler.Schedule();
+    throw std::runtime_error("boom");
+  }
+} // namespace
+
+TEST_P(CoroutineTest, scheduleResumesOnWorker) {
+  Scheduler scheduler(&pool_);
+  std::thread::id caller = std::this_thread::get_id();
+  std::thread::id resumed;
+  SyncWait([](Scheduler scheduler, std::thread::id &resumed) -> Task<> {
+    co_await scheduler.Schedule();
+    resumed = std::this_thread::get_id();
+  }(scheduler, resumed));
+  EXPECT_NE(resumed, caller);
+}
+
+TEST_P(CoroutineTest, awaitOtherTasks) {
+  Scheduler scheduler(&pool_);
+  EXPECT_EQ(SyncWait(AddOnPool(scheduler, 20, 22)), 42);
+  // 深层的co_await链依赖对称转移, 不会耗尽栈
+  EXPECT_EQ(SyncWait(Chain(scheduler, 10000)), 10000);
+
+  auto gather = [](Scheduler scheduler) -> Task<int> {
+    int sum = 0;
+    for (int i = 0; i < 100; ++i) {
+      sum += co_await AddOnPool(scheduler, i, 1);
+    }
+    co_return sum;
+  };
+  EXPECT_EQ(SyncWait(gather(scheduler)), 100 * 99 / 2 + 100);
+}
+
+TEST_P(CoroutineTest, exceptionPropagates) {
+  Scheduler scheduler(&pool_);
+  EXPECT_THROW(SyncWait(Throws(scheduler)), std::runtime_error);
+
+  auto catcher = [](Scheduler scheduler) -> Task<bool> {
+    try {
+      co_await Throws(scheduler);
+    } catch (const std::runtime_error &) {
+      co_return true;
+    }
+    co_return false;
+  };
+  EXPECT_TRUE(SyncWait(catcher(scheduler)));
+}
+
+TEST_P(CoroutineTest, thousandsSuspendedOnEvent) {
+  // 少量worker同时挂起大量等待事件的协程, 挂起期间不占用worker
+  Scheduler scheduler(&pool_);
+  constexpr int kWaiters = 10000;
+  Event ready(scheduler);
+  std::atomic<int> suspended{0};
+  std::atomic<int> finished{0};
+
+  for (int i = 0; i < kWaiters; ++i) {
+    scheduler.Spawn([](Scheduler scheduler, Event &ready, std::atomic<int> &suspended,
+                       std::atomic<int> &finished) -> Task<> {
+      suspended.fetch_add(1);
+      co_await ready;
+      co_await scheduler.Schedule();
+      finished.fetch_add(1);
+    }(scheduler, ready, suspended, finished));
+  }
+
+  while (suspended.load() < kWaiters) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(finished.load(), 0);
+
+  // 挂起的协程不占用worker, 其他任务仍然可以执行
+  EXPECT_EQ(SyncWait(AddOnPool(scheduler, 1, 2)), 3);
+
+  ready.Set();
+  while (finished.load() < kWaiters) {
+    std::this_thread::yield();
+  }
+
+  // 已触发的事件不再挂起
+  EXPECT_TRUE(ready.IsSet());
+  SyncWait([](Event &ready) -> Task<> { co_await ready; }(ready));
+}
+
+TEST(coroutineTest, invalidUse) {
+  EXPECT_THROW(Scheduler(nullptr), std::invalid_argument);
+  auto awaitEmpty = []() -> Task<int> { co_return co_await Task<int>(); };
+  EXPECT_THROW(SyncWait(awaitEmpty()), std::logic_error);
+}
+
+INSTANTIATE_TEST_SUITE_P(allModes, CoroutineTest,
+                         testing::Values(THREAD_POOL_GLOBAL_QUEUE,
+                                         THREAD_POOL_WORK_STEALING,
+                                         THREAD_POOL_MPMC_RING));
+
+int main(int argc, char **argv) {
+  printf("Running main() from %s\n\n", __FILE__);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,138 @@
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "future.h"
+
+namespace {
+  constexpr int kWorkerNum = 4;
+
+  class FutureTest : public testing::TestWithParam<threadPoolMode> {
+   protected:
+    void SetUp() override {
+      threadPoolAttr attr;
+      initThreadPoolAttr(&attr);
+      attr.poolNum = kWorkerNum;
+      attr.mode = GetParam();
+      ASSERT_EQ(createThreadPoolWithAttr(&pool_, &attr), 0);
+    }
+
+    void TearDown() override { destoryThreadPool(&pool_); }
+
+    threadPool pool_;
+  };
+} // namespace
+
+TEST_P(FutureTest, asyncReturnsValue) {
+  Future<int> future = Async(&pool_, []() { return 42; });
+  EXPECT_TRUE(future.Valid());
+  EXPECT_EQ(future.Get(), 42);
+  EXPECT_FALSE(future.Valid());
+}
+
+TEST_P(FutureTest, asyncVoidAndWait) {
+  std::atomic<bool> ran{false};
+  Future<void> future = Async(&pool_, [&ran]() { ran = true; });
+  future.Wait();
+  EXPECT_TRUE(future.IsReady());
+  EXPECT_TRUE(ran.load());
+  future.Get();
+}
+
+TEST_P(FutureTest, exceptionPropagates) {
+  Future<int> future = Async(&pool_, []() -> int { throw std::runtime_error("boom"); });
+  EXPECT_THROW(future.Get(), std::runtime_error);
+
+  Future<int> chained = Async(&pool_, []() -> int { throw std::runtime_error("boom"); })
+                            .Then([](int value) { return value + 1; });
+  EXPECT_THROW(chained.Get(), std::runtime_error);
+}
+
+TEST_P(FutureTest, thenChainsOnPool) {
+  Future<std::string> future = Async(&pool_, []() { return 20; })
+                                   .Then([](int value) { return value + 1; })
+                                   .Then([](int value) { return value * 2; })
+                                   .Then([](int value) { return std::to_string(value); });
+  EXPECT_EQ(future.Get(), "42");
+
+  std::atomic<int> order{0};
+  Future<void> done = Async(&pool_, [&order]() { order = 1; })
+                          .Then([&order]() { order = order * 10 + 2; });
+  done.Get();
+  EXPECT_EQ(order.load(), 12);
+}
+
+TEST_P(FutureTest, thenAfterReady) {
+  Future<int> future = Async(&pool_, []() { return 1; });
+  future.Wait();
+  EXPECT_EQ(std::move(future).Then([](int value) { return value + 1; }).Get(), 2);
+}
+
+TEST_P(FutureTest, droppedFutureStillRuns) {
+  std::atomic<int> count{0};
+  {
+    Future<void> future = Async(&pool_, [&count]() { ++count; })
+                              .Then([&count]() { ++count; });
+  }
+
+  Future<void> fence = Async(&pool_, []() {});
+  fence.Get();
+  while (count.load() < 2) {
+    sched_yield();
+  }
+  EXPECT_EQ(count.load(), 2);
+}
+
+TEST_P(FutureTest, whenAllCollectsInOrder) {
+  constexpr int kNum = 1000;
+  std::vector<Future<int>> futures;
+  for (int i = 0; i < kNum; ++i) {
+    futures.push_back(Async(&pool_, [i]() { return i * i; }));
+  }
+
+  Future<std::vector<int>> all = WhenAll(&pool_, std::move(futures));
+  std::vector<int> values = all.Get();
+  ASSERT_EQ(static_cast<int>(values.size()), kNum);
+  for (int i = 0; i < kNum; ++i) {
+    EXPECT_EQ(values[i], i * i);
+  }
+
+  Future<std::vector<int>> empty = WhenAll(&pool_, std::vector<Future<int>>());
+  EXPECT_TRUE(empty.Get().empty());
+}
+
+TEST_P(FutureTest, whenAllVoidAndErrors) {
+  std::atomic<int> count{0};
+  std::vector<Future<void>> futures;
+  for (int i = 0; i < 100; ++i) {
+    futures.push_back(Async(&pool_, [&count]() { ++count; }));
+  }
+  WhenAll(&pool_, std::move(futures)).Get();
+  EXPECT_EQ(count.load(), 100);
+
+  std::vector<Future<int>> failing;
+  failing.push_back(Async(&pool_, []() { return 1; }));
+  failing.push_back(Async(&pool_, []() -> int { throw std::runtime_error("boom"); }));
+  EXPECT_THROW(WhenAll(&pool_, std::move(failing)).Get(), std::runtime_error);
+}
+
+TEST(futureTest, invalidUse) {
+  Future<int> future;
+  EXPECT_FALSE(future.Valid());
+  EXPECT_THROW(future.Wait(), std::logic_error);
+  EXPECT_THROW(Async(nullptr, []() { return 1; }), std::invalid_argument);
+}
+
+INSTANTIATE_TEST_SUITE_P(allModes, FutureTest,
+                         testing::Values(THREAD_POOL_GLOBAL_QUEUE,
+                                         THREAD_POOL_WORK_STEALING,
+                                         THREAD_POOL_MPMC_RING));
+
+int main(int argc, char **argv) {
+  printf("Running main() from %s\n\n", __FILE__);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,170 @@
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "parallel.h"
+
+namespace {
+  constexpr int kWorkerNum = 4;
+
+  class ParallelTest : public testing::TestWithParam<threadPoolMode> {
+   protected:
+    void SetUp() override {
+      threadPoolAttr attr;
+      initThreadPoolAttr(&attr);
+      attr.poolNum = kWorkerNum;
+      attr.mode = GetParam();
+      ASSERT_EQ(createThreadPoolWithAttr(&pool_, &attr), 0);
+    }
+
+    void TearDown() override { destoryThreadPool(&pool_); }
+
+    threadPool pool_;
+  };
+} // namespace
+
+TEST_P(ParallelTest, forVisitsEachIndexOnce) {
+  constexpr int kSize = 100000;
+  for (int grain : {0, 1, 7, 1000, kSize * 2}) {
+    std::vector<std::atomic<int>> visits(kSize);
+    ParallelFor(&pool_, 0, kSize, grain, [&visits](int i) {
+      visits[i].fetch_add(1, std::memory_order_relaxed);
+    });
+    for (int i = 0; i < kSize; ++i) {
+      ASSERT_EQ(visits[i].load(), 1) << "grain " << grain << " index " << i;
+    }
+  }
+}
+
+TEST_P(ParallelTest, forRangeForm) {
+  constexpr long kBegin = -5000;
+  constexpr long kEnd = 123457;
+  std::atomic<long> covered{0};
+  std::atomic<long> sum{0};
+  ParallelFor(&pool_, kBegin, kEnd, 0L, [&](long begin, long end) {
+    long local = 0;
+    for (long i = begin; i < end; ++i) {
+      local += i;
+    }
+    covered.fetch_add(end - begin);
+    sum.fetch_add(local);
+  });
+  EXPECT_EQ(covered.load(), kEnd - kBegin);
+  EXPECT_EQ(sum.load(), (kBegin + kEnd - 1) * (kEnd - kBegin) / 2);
+
+  bool ran = false;
+  ParallelFor(&pool_, 10, 10, 1, [&ran](int) { ran = true; });
+  EXPECT_FALSE(ran);
+}
+
+TEST_P(ParallelTest, reduceMatchesSerial) {
+  constexpr long kSize = 1000000;
+  long sum = ParallelReduce(&pool_, 0L, kSize, 0L, 0L,
+                            [](long begin, long end, long init) {
+                              for (long i = begin; i < end; ++i) {
+                                init += i;
+                              }
+                              return init;
+                            },
+                            [](long a, long b) { return a + b; });
+  EXPECT_EQ(sum, kSize * (kSize - 1) / 2);
+
+  EXPECT_EQ(ParallelReduce(&pool_, 5, 5, 1, 42,
+                           [](int, int, int init) { return init; },
+                           [](int a, int b) { return a + b; }), 42);
+}
+
+TEST_P(ParallelTest, reduceWithUnitGrain) {
+  // 每个元素一块, 块的累加不经过任何共享状态, 总耗时应该和串行同一量级
+  constexpr long kSize = 1L << 22;
+  auto start = std::chrono::steady_clock::now();
+  long sum = ParallelReduce(&pool_, 0L, kSize, 1L, 0L,
+                            [](long begin, long end, long init) {
+                              for (long i = begin; i < end; ++i) {
+                                init += i ^ 1;
+                              }
+                              return init;
+                            },
+                            [](long a, long b) { return a + b; });
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(sum, kSize * (kSize - 1) / 2);
+  EXPECT_LT(elapsed, std::chrono::seconds(2));
+}
+
+TEST_P(ParallelTest, reduceKeepsOrder) {
+  // 字符串拼接只满足结合律, 结果必须和串行拼接一致
+  constexpr int kSize = 5000;
+  std::string expected;
+  for (int i = 0; i < kSize; ++i) {
+    expected.push_back(static_cast<char>('a' + i % 26));
+  }
+
+  for (int grain : {0, 1, 64}) {
+    std::string result = ParallelReduce(
+        &pool_, 0, kSize, grain, std::string(),
+        [](int begin, int end, std::string init) {
+          for (int i = begin; i < end; ++i) {
+            init.push_back(static_cast<char>('a' + i % 26));
+          }
+          return init;
+        },
+        [](std::string a, std::string b) { return a + b; });
+    EXPECT_EQ(result, expected) << "grain " << grain;
+  }
+}
+
+TEST_P(ParallelTest, exceptionPropagates) {
+  std::atomic<int> visited{0};
+  EXPECT_THROW(ParallelFor(&pool_, 0, 10000, 10, [&visited](int i) {
+    visited.fetch_add(1);
+    if (i == 5000) {
+      throw std::runtime_error("boom");
+    }
+  }), std::runtime_error);
+  EXPECT_GT(visited.load(), 0);
+
+  // 异常之后线程池仍然可用
+  std::atomic<int> count{0};
+  ParallelFor(&pool_, 0, 1000, 1, [&count](int) { count.fetch_add(1); });
+  EXPECT_EQ(count.load(), 1000);
+}
+
+TEST_P(ParallelTest, nestedInsideWorkers) {
+  // 外层的每次迭代都在worker线程内再发起一次并行归约, 调用线程帮忙执行而不是阻塞worker
+  constexpr int kOuter = 16;
+  constexpr long kInner = 20000;
+  std::vector<long> sums(kOuter);
+  ParallelFor(&pool_, 0, kOuter, 1, [&](int outer) {
+    sums[outer] = ParallelReduce(&pool_, 0L, kInner, 0L, 0L,
+                                 [outer](long begin, long end, long init) {
+                                   for (long i = begin; i < end; ++i) {
+                                     init += i * outer;
+                                   }
+                                   return init;
+                                 },
+                                 [](long a, long b) { return a + b; });
+  });
+  for (int outer = 0; outer < kOuter; ++outer) {
+    EXPECT_EQ(sums[outer], outer * kInner * (kInner - 1) / 2);
+  }
+}
+
+TEST(parallelTest, invalidUse) {
+  EXPECT_THROW(ParallelFor(nullptr, 0, 10, 1, [](int) {}), std::invalid_argument);
+  EXPECT_EQ(tryRunThreadPoolTask(nullptr), -1);
+}
+
+INSTANTIATE_TEST_SUITE_P(allModes, ParallelTest,
+                         testing::Values(THREAD_POOL_GLOBAL_QUEUE,
+                                         THREAD_POOL_WORK_STEALING,
+                                         THREAD_POOL_MPMC_RING));
+
+int main(int argc, char **argv) {
+  printf("Running main() from %s\n\n", __FILE__);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
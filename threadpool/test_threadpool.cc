@@ -0,0 +1,847 @@
+#include <sched.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "threadpool.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+  constexpr int kTaskNum = 10000;
+  constexpr int kWorkerNum = 4;
+
+  struct Counter {
+    std::atomic<int> done{0};
+  };
+
+  void CountTask(void *arg) {
+    static_cast<Counter*>(arg)->done.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void WaitForCount(const Counter &counter, int expected) {
+    while (counter.done.load(std::memory_order_acquire) < expected) {
+      usleep(100);
+    }
+  }
+
+  // 以二叉树形式在worker线程内递归提交子任务
+  struct TreeContext {
+    threadPool *pool;
+    std::vector<threadTask> tasks;
+    Counter counter;
+  };
+
+  struct TreeNode {
+    TreeContext *ctx;
+    int index;
+  };
+
+  void TreeTask(void *arg) {
+    TreeNode *node = static_cast<TreeNode*>(arg);
+    TreeContext *ctx = node->ctx;
+    int size = static_cast<int>(ctx->tasks.size());
+    for (int child = node->index * 2 + 1;
+         child <= node->index * 2 + 2 && child < size; ++child) {
+      addThreadPoolTask(ctx->pool, &ctx->tasks[child]);
+    }
+    ctx->counter.done.fetch_add(1, std::memory_order_release);
+  }
+
+  void RunTree(threadPool *pool, int size) {
+    TreeContext ctx;
+    ctx.pool = pool;
+    ctx.tasks.resize(size);
+    std::vector<TreeNode> nodes(size);
+    for (int i = 0; i < size; ++i) {
+      nodes[i] = TreeNode{&ctx, i};
+      ctx.tasks[i].func = TreeTask;
+      ctx.tasks[i].userData = &nodes[i];
+    }
+
+    ASSERT_EQ(addThreadPoolTask(pool, &ctx.tasks[0]), 0);
+    WaitForCount(ctx.counter, size);
+    EXPECT_EQ(ctx.counter.done.load(), size);
+  }
+} // namespace
+
+TEST(threadPoolTest, invalidArgs) {
+  threadPool pool;
+  threadTask task;
+  EXPECT_EQ(createThreadPool(nullptr, kWorkerNum), -1);
+  EXPECT_EQ(createThreadPoolWithAttr(&pool, nullptr), -1);
+  EXPECT_EQ(addThreadPoolTask(nullptr, &task), -1);
+  EXPECT_EQ(destoryThreadPool(nullptr), -1);
+}
+
+TEST(threadPoolTest, globalQueueRunsAllTasks) {
+  threadPool pool;
+  ASSERT_EQ(createThreadPool(&pool, kWorkerNum), 0);
+
+  Counter counter;
+  std::vector<threadTask> tasks(kTaskNum);
+  for (auto &task : tasks) {
+    task.func = CountTask;
+    task.userData = &counter;
+    ASSERT_EQ(addThreadPoolTask(&pool, &task), 0);
+  }
+
+  WaitForCount(counter, kTaskNum);
+  EXPECT_EQ(destoryThreadPool(&pool), 0);
+  EXPECT_EQ(counter.done.load(), kTaskNum);
+}
+
+TEST(threadPoolTest, workStealingRunsExternalTasks) {
+  threadPoolAttr attr;
+  initThreadPoolAttr(&attr);
+  attr.poolNum = kWorkerNum;
+  attr.mode = THREAD_POOL_WORK_STEALING;
+
+  threadPool pool;
+  ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+
+  Counter counter;
+  std::vector<threadTask> tasks(kTaskNum);
+  for (auto &task : tasks) {
+    task.func = CountTask;
+    task.userData = &counter;
+    ASSERT_EQ(addThreadPoolTask(&pool, &task), 0);
+  }
+
+  WaitForCount(counter, kTaskNum);
+  EXPECT_EQ(destoryThreadPool(&pool), 0);
+  EXPECT_EQ(counter.done.load(), kTaskNum);
+}
+
+TEST(threadPoolTest, mpmcRingRunsExternalTasks) {
+  threadPoolAttr attr;
+  initThreadPoolAttr(&attr);
+  attr.poolNum = kWorkerNum;
+  attr.mode = THREAD_POOL_MPMC_RING;
+  // 容量远小于任务数量, 覆盖队列已满时的等待路径
+  attr.ringCapacity = 64;
+
+  threadPool pool;
+  ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+
+  Counter counter;
+  std::vector<threadTask> tasks(kTaskNum);
+  for (auto &task : tasks) {
+    task.func = CountTask;
+    task.userData = &counter;
+    ASSERT_EQ(addThreadPoolTask(&pool, &task), 0);
+  }
+
+  WaitForCount(counter, kTaskNum);
+  EXPECT_EQ(destoryThreadPool(&pool), 0);
+  EXPECT_EQ(counter.done.load(), kTaskNum);
+}
+
+TEST(threadPoolTest, mpmcRingIsFifo) {
+  threadPoolAttr attr;
+  initThreadPoolAttr(&attr);
+  attr.poolNum = 1;
+  attr.mode = THREAD_POOL_MPMC_RING;
+
+  threadPool pool;
+  ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+
+  struct Order {
+    std::vector<int> seen;
+    Counter counter;
+  } order;
+  struct Item {
+    Order *order;
+    int value;
+  };
+
+  constexpr int kItemNum = 1000;
+  std::vector<Item> items(kItemNum);
+  std::vector<threadTask> tasks(kItemNum);
+  for (int i = 0; i < kItemNum; ++i) {
+    items[i] = Item{&order, i};
+    tasks[i].userData = &items[i];
+    tasks[i].func = [](void *arg) {
+      Item *item = static_cast<Item*>(arg);
+      item->order->seen.push_back(item->value);
+      item->order->counter.done.fetch_add(1, std::memory_order_release);
+    };
+    ASSERT_EQ(addThreadPoolTask(&pool, &tasks[i]), 0);
+  }
+
+  WaitForCount(order.counter, kItemNum);
+  EXPECT_EQ(destoryThreadPool(&pool), 0);
+  ASSERT_EQ(static_cast<int>(order.seen.size()), kItemNum);
+  for (int i = 0; i < kItemNum; ++i) {
+    EXPECT_EQ(order.seen[i], i);
+  }
+}
+
+TEST(threadPoolTest, nestedSubmitInAllModes) {
+  threadPoolMode modes[] = {THREAD_POOL_GLOBAL_QUEUE, THREAD_POOL_WORK_STEALING,
+                            THREAD_POOL_MPMC_RING};
+  for (threadPoolMode mode : modes) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = kWorkerNum;
+    attr.mode = mode;
+
+    threadPool pool;
+    ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+    RunTree(&pool, kTaskNum);
+    EXPECT_EQ(destoryThreadPool(&pool), 0);
+  }
+}
+
+TEST(threadPoolTest, workStealingDequeGrows) {
+  threadPoolAttr attr;
+  initThreadPoolAttr(&attr);
+  attr.poolNum = kWorkerNum;
+  attr.mode = THREAD_POOL_WORK_STEALING;
+
+  threadPool pool;
+  ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+
+  // 单个任务在worker线程内一次性提交大量子任务, 超过双端队列的初始容量
+  struct FanOut {
+    threadPool *pool;
+    std::vector<threadTask> children;
+    Counter counter;
+  } fan_out;
+  fan_out.pool = &pool;
+  fan_out.children.resize(kTaskNum);
+  for (auto &task : fan_out.children) {
+    task.func = CountTask;
+    task.userData = &fan_out.counter;
+  }
+
+  threadTask root;
+  root.func = [](void *arg) {
+    FanOut *ctx = static_cast<FanOut*>(arg);
+    for (auto &task : ctx->children) {
+      addThreadPoolTask(ctx->pool, &task);
+    }
+  };
+  root.userData = &fan_out;
+  ASSERT_EQ(addThreadPoolTask(&pool, &root), 0);
+
+  WaitForCount(fan_out.counter, kTaskNum);
+  EXPECT_EQ(destoryThreadPool(&pool), 0);
+  EXPECT_EQ(fan_out.counter.done.load(), kTaskNum);
+}
+
+TEST(threadPoolTest, batchSubmitInAllModes) {
+  threadPoolMode modes[] = {THREAD_POOL_GLOBAL_QUEUE, THREAD_POOL_WORK_STEALING,
+                            THREAD_POOL_MPMC_RING};
+  for (threadPoolMode mode : modes) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = kWorkerNum;
+    attr.mode = mode;
+    attr.ringCapacity = 256;
+
+    threadPool pool;
+    ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+    EXPECT_EQ(addThreadPoolTasks(&pool, nullptr, 1), -1);
+    EXPECT_EQ(addThreadPoolTasks(&pool, nullptr, 0), -1);
+
+    // 外部线程批量提交
+    Counter counter;
+    std::vector<threadTask> tasks(kTaskNum);
+    for (auto &task : tasks) {
+      task.func = CountTask;
+      task.userData = &counter;
+    }
+    constexpr int kBatch = 1000;
+    for (int i = 0; i < kTaskNum; i += kBatch) {
+      ASSERT_EQ(addThreadPoolTasks(&pool, &tasks[i], kBatch), 0);
+    }
+    WaitForCount(counter, kTaskNum);
+
+    // worker线程内批量提交
+    struct Batch {
+      threadPool *pool;
+      std::vector<threadTask> children;
+      Counter counter;
+    } batch;
+    batch.pool = &pool;
+    batch.children.resize(kTaskNum);
+    for (auto &task : batch.children) {
+      task.func = CountTask;
+      task.userData = &batch.counter;
+    }
+
+    threadTask root;
+    root.func = [](void *arg) {
+      Batch *ctx = static_cast<Batch*>(arg);
+      addThreadPoolTasks(ctx->pool, ctx->children.data(),
+                         static_cast<int>(ctx->children.size()));
+    };
+    root.userData = &batch;
+    ASSERT_EQ(addThreadPoolTask(&pool, &root), 0);
+    WaitForCount(batch.counter, kTaskNum);
+
+    EXPECT_EQ(destoryThreadPool(&pool), 0);
+    EXPECT_EQ(counter.done.load(), kTaskNum);
+    EXPECT_EQ(batch.counter.done.load(), kTaskNum);
+  }
+}
+
+TEST(threadPoolTest, submitRecyclesTaskNodes) {
+  threadPoolMode modes[] = {THREAD_POOL_GLOBAL_QUEUE, THREAD_POOL_WORK_STEALING,
+                            THREAD_POOL_MPMC_RING};
+  for (threadPoolMode mode : modes) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = kWorkerNum;
+    attr.mode = mode;
+
+    threadPool pool;
+    ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+    EXPECT_EQ(submitThreadPoolTask(nullptr, CountTask, nullptr), -1);
+    EXPECT_EQ(submitThreadPoolTask(&pool, nullptr, nullptr), -1);
+
+    // 外部线程提交, 多轮提交复用同一批节点
+    Counter counter;
+    for (int round = 1; round <= 3; ++round) {
+      for (int i = 0; i < kTaskNum; ++i) {
+        ASSERT_EQ(submitThreadPoolTask(&pool, CountTask, &counter), 0);
+      }
+      WaitForCount(counter, kTaskNum * round);
+    }
+
+    // worker线程内提交, 节点来自worker本地缓存
+    struct Spawner {
+      threadPool *pool;
+      Counter counter;
+    } spawner;
+    spawner.pool = &pool;
+    auto spawn = [](void *arg) {
+      Spawner *ctx = static_cast<Spawner*>(arg);
+      for (int i = 0; i < 100; ++i) {
+        submitThreadPoolTask(ctx->pool, CountTask, &ctx->counter);
+      }
+    };
+    for (int i = 0; i < kTaskNum / 100; ++i) {
+      ASSERT_EQ(submitThreadPoolTask(&pool, spawn, &spawner), 0);
+    }
+    WaitForCount(spawner.counter, kTaskNum);
+
+    EXPECT_EQ(destoryThreadPool(&pool), 0);
+    EXPECT_EQ(counter.done.load(), kTaskNum * 3);
+    EXPECT_EQ(spawner.counter.done.load(), kTaskNum);
+  }
+}
+
+TEST(threadPoolTest, elasticGrowsAndShrinks) {
+  threadPoolAttr attr;
+  initThreadPoolAttr(&attr);
+  attr.poolNum = 1;
+  attr.minPoolNum = 1;
+  attr.maxPoolNum = 4;
+  attr.spawnWaitUs = 1000;
+  attr.idleTimeoutMs = 50;
+
+  attr.mode = THREAD_POOL_WORK_STEALING;
+  threadPool pool;
+  EXPECT_EQ(createThreadPoolWithAttr(&pool, &attr), -1);
+
+  attr.mode = THREAD_POOL_GLOBAL_QUEUE;
+  ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+
+  // 阻塞型任务让唯一的worker一直忙, 排队时间超过阈值后应当扩容
+  Counter counter;
+  auto sleepy = [](void *arg) {
+    usleep(5000);
+    CountTask(arg);
+  };
+  constexpr int kSleepyNum = 40;
+  for (int i = 0; i < kSleepyNum; ++i) {
+    ASSERT_EQ(submitThreadPoolTask(&pool, sleepy, &counter), 0);
+    usleep(500);
+  }
+  WaitForCount(counter, kSleepyNum);
+
+  threadPoolStats stats;
+  ASSERT_EQ(getThreadPoolStats(&pool, &stats), 0);
+  EXPECT_GT(stats.spawnedWorkers, 0ul);
+  EXPECT_LE(stats.liveWorkers, 4);
+  EXPECT_EQ(stats.dequeuedTasks, static_cast<unsigned long>(kSleepyNum));
+  EXPECT_GT(stats.queueWaitNs, 0ul);
+  EXPECT_GT(stats.busyNs, 0ul);
+  EXPECT_LE(stats.busyNs, stats.aliveNs);
+
+  // 空闲超时后缩容到最小数量
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (std::chrono::steady_clock::now() < deadline) {
+    ASSERT_EQ(getThreadPoolStats(&pool, &stats), 0);
+    if (stats.liveWorkers == 1) {
+      break;
+    }
+    usleep(10000);
+  }
+  EXPECT_EQ(stats.liveWorkers, 1);
+  EXPECT_EQ(stats.retiredWorkers, stats.spawnedWorkers);
+  EXPECT_EQ(stats.completedTasks, static_cast<unsigned long>(kSleepyNum));
+
+  // 缩容后仍然可以正常执行任务并再次扩容
+  for (int i = 0; i < kSleepyNum; ++i) {
+    ASSERT_EQ(submitThreadPoolTask(&pool, sleepy, &counter), 0);
+  }
+  WaitForCount(counter, kSleepyNum * 2);
+  EXPECT_EQ(destoryThreadPool(&pool), 0);
+}
+
+TEST(threadPoolTest, priorityLanesAndDeadlines) {
+  threadPoolAttr attr;
+  initThreadPoolAttr(&attr);
+  attr.poolNum = 1;
+  attr.normalWeight = 2;
+
+  threadPool pool;
+  ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+  EXPECT_EQ(submitThreadPoolTaskWithPriority(&pool, CountTask, nullptr,
+                                             THREAD_TASK_PRIORITY_NUM, 0), -1);
+
+  // 先用一个闸门任务占住唯一的worker, 保证后面的任务全部排队后再统一出队
+  std::atomic<bool> open{false};
+  std::atomic<bool> started{false};
+  struct Gate {
+    std::atomic<bool> *open;
+    std::atomic<bool> *started;
+  } gate{&open, &started};
+  // 闸门走延迟敏感通道, 不占用普通通道的加权额度
+  ASSERT_EQ(submitThreadPoolTaskWithPriority(&pool, [](void *arg) {
+    Gate *gate = static_cast<Gate*>(arg);
+    gate->started->store(true);
+    while (!gate->open->load()) {
+      usleep(100);
+    }
+  }, &gate, THREAD_TASK_PRIORITY_LATENCY, 0), 0);
+  while (!started.load()) {
+    usleep(100);
+  }
+
+  struct Order {
+    std::vector<int> seen;
+    Counter counter;
+  } order;
+  struct Item {
+    Order *order;
+    int value;
+  };
+  auto record = [](void *arg) {
+    Item *item = static_cast<Item*>(arg);
+    item->order->seen.push_back(item->value);
+    item->order->counter.done.fetch_add(1, std::memory_order_release);
+  };
+
+  // 编号: 1xx批量, 2xx普通, 3xx延迟敏感, 400已超时的截止任务, 500未超时的截止任务(仍在批量通道中排第一)
+  std::vector<Item> items;
+  items.reserve(16);
+  auto submit = [&](int value, threadTaskPriority priority, unsigned long deadlineUs) {
+    items.push_back(Item{&order, value});
+    ASSERT_EQ(submitThreadPoolTaskWithPriority(&pool, record, &items.back(),
+                                               priority, deadlineUs), 0);
+  };
+  submit(500, THREAD_TASK_PRIORITY_BULK, 60ul * 1000 * 1000);
+  for (int i = 0; i < 3; ++i) {
+    submit(100 + i, THREAD_TASK_PRIORITY_BULK, 0);
+  }
+  for (int i = 0; i < 4; ++i) {
+    submit(200 + i, THREAD_TASK_PRIORITY_NORMAL, 0);
+  }
+  for (int i = 0; i < 2; ++i) {
+    submit(300 + i, THREAD_TASK_PRIORITY_LATENCY, 0);
+  }
+  submit(400, THREAD_TASK_PRIORITY_BULK, 1);
+  usleep(1000);
+
+  open.store(true);
+  WaitForCount(order.counter, static_cast<int>(items.size()));
+  EXPECT_EQ(destoryThreadPool(&pool), 0);
+
+  std::vector<int> expected = {400, 300, 301, 200, 201, 500, 202, 203, 100, 101, 102};
+  EXPECT_EQ(order.seen, expected);
+}
+
+TEST(threadPoolTest, farDeadlineKeepsLatencyPriority) {
+  threadPoolAttr attr;
+  initThreadPoolAttr(&attr);
+  attr.poolNum = 1;
+
+  threadPool pool;
+  ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+
+  std::atomic<bool> open{false};
+  std::atomic<bool> started{false};
+  struct Gate {
+    std::atomic<bool> *open;
+    std::atomic<bool> *started;
+  } gate{&open, &started};
+  ASSERT_EQ(submitThreadPoolTaskWithPriority(&pool, [](void *arg) {
+    Gate *gate = static_cast<Gate*>(arg);
+    gate->started->store(true);
+    while (!gate->open->load()) {
+      usleep(100);
+    }
+  }, &gate, THREAD_TASK_PRIORITY_LATENCY, 0), 0);
+  while (!started.load()) {
+    usleep(100);
+  }
+
+  struct Order {
+    std::vector<int> seen;
+    Counter counter;
+  } order;
+  struct Item {
+    Order *order;
+    int value;
+  };
+  auto record = [](void *arg) {
+    Item *item = static_cast<Item*>(arg);
+    item->order->seen.push_back(item->value);
+    item->order->counter.done.fetch_add(1, std::memory_order_release);
+  };
+
+  // 先压满批量通道, 再提交一个截止时间很远的延迟敏感任务, 它不能被截止时间推到批量任务之后
+  constexpr int kBulkNum = 2000;
+  std::vector<Item> items;
+  items.reserve(kBulkNum + 1);
+  for (int i = 0; i < kBulkNum; ++i) {
+    items.push_back(Item{&order, i});
+    ASSERT_EQ(submitThreadPoolTaskWithPriority(&pool, record, &items.back(),
+                                               THREAD_TASK_PRIORITY_BULK, 0), 0);
+  }
+  items.push_back(Item{&order, -1});
+  ASSERT_EQ(submitThreadPoolTaskWithPriority(&pool, record, &items.back(),
+                                             THREAD_TASK_PRIORITY_LATENCY, 60ul * 1000 * 1000), 0);
+
+  open.store(true);
+  WaitForCount(order.counter, static_cast<int>(items.size()));
+  EXPECT_EQ(destoryThreadPool(&pool), 0);
+
+  ASSERT_EQ(order.seen.size(), items.size());
+  EXPECT_EQ(order.seen[0], -1);
+  for (int i = 0; i < kBulkNum; ++i) {
+    EXPECT_EQ(order.seen[i + 1], i);
+  }
+}
+
+TEST(threadPoolTest, numaPlacementPinsWorkers) {
+  threadPoolAttr attr;
+  initThreadPoolAttr(&attr);
+  int bad_cpus[] = {-1};
+  attr.cpus = bad_cpus;
+  attr.cpuNum = 1;
+  threadPool pool;
+  EXPECT_EQ(createThreadPoolWithAttr(&pool, &attr), -1);
+
+  threadPoolMode modes[] = {THREAD_POOL_GLOBAL_QUEUE, THREAD_POOL_WORK_STEALING,
+                            THREAD_POOL_MPMC_RING};
+  for (threadPoolMode mode : modes) {
+    int cpus[] = {0};
+    initThreadPoolAttr(&attr);
+    attr.poolNum = 2;
+    attr.mode = mode;
+    attr.cpus = cpus;
+    attr.cpuNum = 1;
+    attr.pinWorkers = 1;
+    attr.numaAware = 1;
+    ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+
+    int nodes[64];
+    int node_num = getThreadPoolNodes(&pool, nodes, 64);
+    ASSERT_EQ(node_num, 1);
+    EXPECT_EQ(getThreadPoolCurrentNode(), -1);
+
+    struct Placement {
+      int node;
+      Counter counter;
+      std::atomic<int> wrong{0};
+    } placement;
+    placement.node = nodes[0];
+    auto check = [](void *arg) {
+      Placement *placement = static_cast<Placement*>(arg);
+      if (sched_getcpu() != 0 || getThreadPoolCurrentNode() != placement->node) {
+        placement->wrong.fetch_add(1);
+      }
+      placement->counter.done.fetch_add(1, std::memory_order_release);
+    };
+
+    // 不属于线程池的节点编号按没有指定节点处理
+    constexpr int kCheckNum = 1000;
+    for (int i = 0; i < kCheckNum; ++i) {
+      int hint = i % 3 == 0 ? nodes[0] : (i % 3 == 1 ? -1 : 12345);
+      ASSERT_EQ(submitThreadPoolTaskOnNode(&pool, check, &placement, hint), 0);
+    }
+    WaitForCount(placement.counter, kCheckNum);
+    EXPECT_EQ(destoryThreadPool(&pool), 0);
+    EXPECT_EQ(placement.wrong.load(), 0);
+  }
+}
+
+TEST(threadPoolTest, taskStatsHistograms) {
+  threadPool pool;
+  ASSERT_EQ(createThreadPool(&pool, 1), 0);
+  threadWorkerStats merged;
+  EXPECT_EQ(getThreadPoolTaskStats(&pool, &merged), -1);
+  EXPECT_EQ(destoryThreadPool(&pool), 0);
+
+  threadPoolMode modes[] = {THREAD_POOL_GLOBAL_QUEUE, THREAD_POOL_WORK_STEALING,
+                            THREAD_POOL_MPMC_RING};
+  for (threadPoolMode mode : modes) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = 2;
+    attr.mode = mode;
+    attr.enableStats = 1;
+    ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+
+    constexpr int kFastNum = 200;
+    constexpr int kSlowNum = 10;
+    constexpr unsigned long kSlowNs = 2000000;
+    Counter counter;
+    for (int i = 0; i < kFastNum; ++i) {
+      ASSERT_EQ(submitThreadPoolTask(&pool, CountTask, &counter), 0);
+    }
+    for (int i = 0; i < kSlowNum; ++i) {
+      ASSERT_EQ(submitThreadPoolTask(&pool, [](void *arg) {
+        usleep(kSlowNs / 1000);
+        CountTask(arg);
+      }, &counter), 0);
+    }
+    WaitForCount(counter, kFastNum + kSlowNum);
+
+    // 统计在任务返回之后才记录
+    constexpr unsigned long kTotal = kFastNum + kSlowNum;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    do {
+      ASSERT_EQ(getThreadPoolTaskStats(&pool, &merged), 0);
+    } while (merged.tasks < kTotal && std::chrono::steady_clock::now() < deadline);
+
+    EXPECT_EQ(merged.tasks, kTotal);
+    EXPECT_EQ(merged.queueWait.count, kTotal);
+    EXPECT_EQ(merged.runTime.count, kTotal);
+    EXPECT_GE(merged.runTime.maxNs, kSlowNs);
+    EXPECT_GE(merged.busyNs, kSlowNs * kSlowNum);
+    EXPECT_LT(getThreadPoolHistogramPercentile(&merged.runTime, 50), kSlowNs);
+    EXPECT_GE(getThreadPoolHistogramPercentile(&merged.runTime, 100), kSlowNs);
+    EXPECT_LE(getThreadPoolHistogramPercentile(&merged.runTime, 100), merged.runTime.maxNs);
+    EXPECT_GT(getThreadPoolHistogramPercentile(&merged.queueWait, 99), 0ul);
+
+    threadWorkerStats workers[2];
+    ASSERT_EQ(getThreadPoolWorkerStats(&pool, workers, 2), 2);
+    EXPECT_EQ(workers[0].tasks + workers[1].tasks, kTotal);
+    EXPECT_EQ(workers[0].queueWait.count + workers[1].queueWait.count, kTotal);
+
+    threadPoolStats stats;
+    ASSERT_EQ(getThreadPoolStats(&pool, &stats), 0);
+    EXPECT_EQ(stats.queuedTasks, 0);
+    EXPECT_EQ(destoryThreadPool(&pool), 0);
+  }
+}
+
+TEST(threadPoolTest, boundedQueuePolicies) {
+  constexpr long kMaxQueued = 4;
+  for (threadPoolMode mode : {THREAD_POOL_GLOBAL_QUEUE, THREAD_POOL_WORK_STEALING,
+                              THREAD_POOL_MPMC_RING}) {
+    for (threadPoolFullPolicy policy : {THREAD_POOL_FULL_BLOCK, THREAD_POOL_FULL_FAIL,
+                                        THREAD_POOL_FULL_CALLER_RUNS}) {
+      threadPoolAttr attr;
+      initThreadPoolAttr(&attr);
+      attr.poolNum = 1;
+      attr.mode = mode;
+      attr.maxQueuedTasks = kMaxQueued;
+      attr.fullPolicy = policy;
+
+      threadPool pool;
+      ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+
+      // 闸门任务开始执行后归还名额, 之后的任务正好填满队列
+      std::atomic<bool> open{false};
+      std::atomic<bool> started{false};
+      struct Gate {
+        std::atomic<bool> *open;
+        std::atomic<bool> *started;
+      } gate{&open, &started};
+      ASSERT_EQ(submitThreadPoolTask(&pool, [](void *arg) {
+        Gate *gate = static_cast<Gate*>(arg);
+        gate->started->store(true);
+        while (!gate->open->load()) {
+          usleep(100);
+        }
+      }, &gate), 0);
+      while (!started.load()) {
+        usleep(100);
+      }
+
+      Counter counter;
+      for (long i = 0; i < kMaxQueued; ++i) {
+        ASSERT_EQ(submitThreadPoolTask(&pool, CountTask, &counter), 0);
+      }
+      threadPoolStats stats;
+      ASSERT_EQ(getThreadPoolStats(&pool, &stats), 0);
+      EXPECT_EQ(stats.queuedTasks, kMaxQueued);
+
+      int expected = static_cast<int>(kMaxQueued);
+      if (policy == THREAD_POOL_FULL_FAIL) {
+        EXPECT_EQ(submitThreadPoolTask(&pool, CountTask, &counter), -2);
+      } else if (policy == THREAD_POOL_FULL_CALLER_RUNS) {
+        EXPECT_EQ(submitThreadPoolTask(&pool, CountTask, &counter), 0);
+        EXPECT_EQ(counter.done.load(), 1);
+        ++expected;
+      } else {
+        std::atomic<bool> submitted{false};
+        std::thread producer([&] {
+          EXPECT_EQ(submitThreadPoolTask(&pool, CountTask, &counter), 0);
+          submitted.store(true);
+        });
+        usleep(20 * 1000);
+        EXPECT_FALSE(submitted.load());
+        open.store(true);
+        producer.join();
+        ++expected;
+      }
+
+      open.store(true);
+      WaitForCount(counter, expected);
+      EXPECT_EQ(counter.done.load(), expected);
+      EXPECT_EQ(destoryThreadPool(&pool), 0);
+    }
+  }
+}
+
+TEST(threadPoolTest, shutdownDrainsQueuedTasks) {
+  constexpr int kRootNum = 2000;
+  for (threadPoolMode mode : {THREAD_POOL_GLOBAL_QUEUE, THREAD_POOL_WORK_STEALING,
+                              THREAD_POOL_MPMC_RING}) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = kWorkerNum;
+    attr.mode = mode;
+
+    threadPool pool;
+    ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+
+    // 每个根任务在worker线程内再提交一个子任务, 排空时子任务也要执行完
+    struct Context {
+      threadPool *pool;
+      Counter counter;
+    } ctx{&pool, {}};
+    for (int i = 0; i < kRootNum; ++i) {
+      ASSERT_EQ(submitThreadPoolTask(&pool, [](void *arg) {
+        Context *ctx = static_cast<Context*>(arg);
+        usleep(10);
+        submitThreadPoolTask(ctx->pool, CountTask, &ctx->counter);
+        ctx->counter.done.fetch_add(1, std::memory_order_relaxed);
+      }, &ctx), 0);
+    }
+
+    EXPECT_EQ(shutdownThreadPool(&pool), 0);
+    EXPECT_EQ(ctx.counter.done.load(), kRootNum * 2);
+  }
+
+  // 排空开始后外部线程的提交被拒绝, 阻塞在有界队列上的提交者也返回
+  threadPoolAttr attr;
+  initThreadPoolAttr(&attr);
+  attr.maxQueuedTasks = 1;
+
+  threadPool pool;
+  ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+  std::atomic<bool> open{false};
+  ASSERT_EQ(submitThreadPoolTask(&pool, [](void *arg) {
+    while (!static_cast<std::atomic<bool>*>(arg)->load()) {
+      usleep(100);
+    }
+  }, &open), 0);
+
+  Counter counter;
+  std::atomic<int> blockedRet{0};
+  std::thread producer([&] {
+    // 第一个任务可能还在排队, 最多占满名额后阻塞
+    submitThreadPoolTask(&pool, CountTask, &counter);
+    blockedRet.store(submitThreadPoolTask(&pool, CountTask, &counter));
+  });
+  usleep(20 * 1000);
+
+  std::thread closer([&] { EXPECT_EQ(shutdownThreadPool(&pool), 0); });
+  while (!__atomic_load_n(&pool.draining, __ATOMIC_ACQUIRE)) {
+    usleep(100);
+  }
+  producer.join();
+  EXPECT_EQ(blockedRet.load(), -1);
+  EXPECT_EQ(submitThreadPoolTask(&pool, CountTask, &counter), -1);
+
+  open.store(true);
+  closer.join();
+  EXPECT_EQ(counter.done.load(), 1);
+}
+
+TEST(threadPoolTest, idleSpinYieldPark) {
+  constexpr int kPingNum = 20;
+  struct Strategy {
+    unsigned long spinUs;
+    int yields;
+    threadPoolIdlePhase expected;
+  };
+  // 自旋和让出的时间远长于两次提交的间隔, 空闲的worker不会进入休眠; 单核机器上不自旋
+  bool multiCore = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+  const Strategy strategies[] = {
+    {0, 0, THREAD_POOL_IDLE_PARK},
+    {200 * 1000, 0, multiCore ? THREAD_POOL_IDLE_SPIN : THREAD_POOL_IDLE_PARK},
+    {0, 1 << 20, THREAD_POOL_IDLE_YIELD},
+  };
+
+  for (threadPoolMode mode : {THREAD_POOL_GLOBAL_QUEUE, THREAD_POOL_WORK_STEALING,
+                              THREAD_POOL_MPMC_RING}) {
+    for (const Strategy &strategy : strategies) {
+      threadPoolAttr attr;
+      initThreadPoolAttr(&attr);
+      attr.poolNum = 1;
+      attr.mode = mode;
+      attr.idleSpinUs = strategy.spinUs;
+      attr.idleYields = strategy.yields;
+
+      threadPool pool;
+      ASSERT_EQ(createThreadPoolWithAttr(&pool, &attr), 0);
+
+      Counter counter;
+      for (int i = 0; i < kPingNum; ++i) {
+        usleep(1000);
+        ASSERT_EQ(submitThreadPoolTask(&pool, CountTask, &counter), 0);
+        WaitForCount(counter, i + 1);
+      }
+
+      threadPoolStats stats;
+      ASSERT_EQ(getThreadPoolStats(&pool, &stats), 0);
+      unsigned long total = 0;
+      for (int phase = 0; phase < THREAD_POOL_IDLE_PHASE_NUM; ++phase) {
+        total += stats.idleWakeups[phase];
+        if (phase != strategy.expected) {
+          EXPECT_EQ(stats.idleWakeups[phase], 0ul) << "mode " << mode << " phase " << phase;
+        }
+      }
+      EXPECT_GT(stats.idleWakeups[strategy.expected], 0ul);
+      EXPECT_LE(total, static_cast<unsigned long>(kPingNum));
+      EXPECT_EQ(destoryThreadPool(&pool), 0);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  printf("Running main() from %s\n\n", __FILE__);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
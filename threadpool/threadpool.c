@@ -1,6 +1,20 @@
+#define _GNU_SOURCE
 #include "threadpool.h"
+#include "work_steal_deque.h"
+#include "mpmc_ring.h"
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
 
 #define LL_ADD(item, list) do {         \
         item->prev = NULL;              \
@@ -17,116 +31,2057 @@
         item->next = NULL;                              \
 } while(0)
 
+#define WS_DEQUE_INIT_CAPACITY 256
+#define TASK_SLAB_SIZE 256          // 每次向系统申请的任务节点数量
+#define WORKER_TASK_CACHE_BATCH 32  // worker本地缓存与全局空闲链表之间一次转移的节点数量
+#define WORKER_TASK_CACHE_MAX 256   // worker本地缓存的节点数量上限
+#define DRAIN_POLL_US 100           // 排空时检查任务是否全部完成的间隔
+#define IDLE_SPIN_BATCH 64          // 自旋时每隔多少次pause读一次时钟
+#define STEAL_RETRY_MAX 8           // 休眠前窃取失败但仍有可窃取任务时, 放开锁重试的次数
+
+typedef struct taskSlab {
+    struct taskSlab *next;
+    threadTask tasks[TASK_SLAB_SIZE];
+} taskSlab;
+
+// 当前线程所属的worker, 非worker线程为NULL
+static __thread threadWorker *currentWorker = NULL;
+
+static void *workerLoop(void *arg);
+
+static unsigned long nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000ul + (unsigned long)ts.tv_nsec;
+}
+
+/*
+ * 任务统计使用的时钟. 内核以TSC作为时钟源时(TSC恒定速率且各核同步)直接读TSC,
+ * 按启动时校准的倍率换算为ns, 开销约为clock_gettime的一半; 否则退化为nowNs.
+ * 换算结果只用于计算差值, 不能和nowNs的读数比较.
+ */
+static pthread_once_t tscOnce = PTHREAD_ONCE_INIT;
+static int tscUsable = 0;
+static unsigned long tscMult = 0;  // ns = ticks * tscMult >> 32
+
+static void calibrateTsc(void) {
+#if defined(__x86_64__)
+    char buf[32];
+    FILE *file = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+    if (!file) {
+        return;
+    }
+    char *line = fgets(buf, sizeof(buf), file);
+    fclose(file);
+    if (!line || strncmp(line, "tsc", 3) != 0) {
+        return;
+    }
+
+    unsigned long startNs = nowNs();
+    unsigned long startTicks = __rdtsc();
+    struct timespec interval = {0, 10 * 1000 * 1000};
+    nanosleep(&interval, NULL);
+    unsigned long ns = nowNs() - startNs;
+    unsigned long ticks = __rdtsc() - startTicks;
+    if (ns == 0 || ticks == 0) {
+        return;
+    }
+
+    tscMult = (unsigned long)(((unsigned __int128)ns << 32) / ticks);
+    tscUsable = 1;
+#endif
+}
+
+static unsigned long fastNowNs(void) {
+#if defined(__x86_64__)
+    if (tscUsable) {
+        return (unsigned long)(((unsigned __int128)__rdtsc() * tscMult) >> 32);
+    }
+#endif
+    return nowNs();
+}
+
+// 任务入队和执行的时间戳, 弹性模式要和nowNs比较排队时间, 只能使用nowNs
+static unsigned long taskClockNs(threadPool *pool) {
+    return pool->elastic ? nowNs() : fastNowNs();
+}
+
+static void futexWait(unsigned int *addr, unsigned int expected) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futexWake(unsigned int *addr, int num) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+}
+
+// 申请一块新的slab挂到全局空闲链表, 调用时必须持有freeMutex
+static int growTaskSlab(threadPool *pool) {
+    taskSlab *slab = (taskSlab *)malloc(sizeof(taskSlab));
+    if (!slab) {
+        return -1;
+    }
+
+    for (int i = 0; i < TASK_SLAB_SIZE; ++i) {
+        slab->tasks[i].next = pool->freeTasks;
+        pool->freeTasks = &slab->tasks[i];
+    }
+
+    slab->next = pool->taskSlabs;
+    pool->taskSlabs = slab;
+    return 0;
+}
+
+/*
+ * worker线程优先使用自己的本地缓存, 缓存为空时从全局空闲链表一次取一批;
+ * 外部线程直接从全局空闲链表取. 只有空闲节点耗尽时才会调用malloc.
+ */
+static threadTask *allocTaskNode(threadPool *pool) {
+    threadWorker *self = currentWorker;
+    if (self && self->pool == pool && self->freeTasks) {
+        threadTask *task = self->freeTasks;
+        self->freeTasks = task->next;
+        --self->freeTaskNum;
+        return task;
+    }
+
+    int batch = (self && self->pool == pool) ? WORKER_TASK_CACHE_BATCH : 1;
+    threadTask *task = NULL;
+
+    pthread_mutex_lock(&pool->freeMutex);
+    for (int i = 0; i < batch; ++i) {
+        if (!pool->freeTasks && growTaskSlab(pool) != 0) {
+            break;
+        }
+
+        threadTask *node = pool->freeTasks;
+        pool->freeTasks = node->next;
+        if (!task) {
+            task = node;
+        } else {
+            node->next = self->freeTasks;
+            self->freeTasks = node;
+            ++self->freeTaskNum;
+        }
+    }
+    pthread_mutex_unlock(&pool->freeMutex);
+
+    return task;
+}
+
+// worker线程归还到本地缓存, 缓存超过上限时把一批节点还给全局空闲链表
+static void releaseTaskNode(threadPool *pool, threadTask *task) {
+    threadWorker *self = currentWorker;
+    if (self && self->pool == pool) {
+        task->next = self->freeTasks;
+        self->freeTasks = task;
+        if (++self->freeTaskNum <= WORKER_TASK_CACHE_MAX) {
+            return;
+        }
+
+        threadTask *head = self->freeTasks;
+        threadTask *tail = head;
+        for (int i = 1; i < WORKER_TASK_CACHE_BATCH; ++i) {
+            tail = tail->next;
+        }
+        self->freeTasks = tail->next;
+        self->freeTaskNum -= WORKER_TASK_CACHE_BATCH;
+
+        pthread_mutex_lock(&pool->freeMutex);
+        tail->next = pool->freeTasks;
+        pool->freeTasks = head;
+        pthread_mutex_unlock(&pool->freeMutex);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->freeMutex);
+    task->next = pool->freeTasks;
+    pool->freeTasks = task;
+    pthread_mutex_unlock(&pool->freeMutex);
+}
+
+// 外部线程在线程池开始排空或销毁后不能再提交任务
+static int submitClosed(threadPool *pool) {
+    return __atomic_load_n(&pool->draining, __ATOMIC_SEQ_CST) ||
+           __atomic_load_n(&pool->terminating, __ATOMIC_SEQ_CST);
+}
+
+// 预留num个有界队列名额, 队列为空时整批任务即使超过上限也可以进入, 否则大批量提交永远无法成功
+static int reserveQueueSlots(threadPool *pool, long num) {
+    long queued = __atomic_load_n(&pool->boundedTasks, __ATOMIC_RELAXED);
+    do {
+        if (queued > 0 && queued + num > pool->maxQueuedTasks) {
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&pool->boundedTasks, &queued, queued + num, 1,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return 0;
+}
+
+/*
+ * 等待者先记下spaceEpoch并增加spaceWaiters, 再尝试预留;
+ * 归还者减少计数后发现spaceWaiters不为0就推进spaceEpoch并唤醒一个等待者,
+ * 与waitRingTask相同, 推进发生在记录之后时futexWait会立即返回, 不会丢失唤醒.
+ * 每次归还都会唤醒一个, 队列归零时被唤醒的等待者一定能预留成功, 因此不会永远阻塞
+ */
+static int waitQueueSlots(threadPool *pool, long num) {
+    while (1) {
+        unsigned int epoch = __atomic_load_n(&pool->spaceEpoch, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&pool->spaceWaiters, 1, __ATOMIC_SEQ_CST);
+
+        int ret = reserveQueueSlots(pool, num);
+        if (ret != 0 && submitClosed(pool)) {
+            ret = -1;
+        } else if (ret != 0) {
+            futexWait(&pool->spaceEpoch, epoch);
+        }
+
+        __atomic_sub_fetch(&pool->spaceWaiters, 1, __ATOMIC_SEQ_CST);
+        if (ret == 0 || submitClosed(pool)) {
+            return ret;
+        }
+    }
+}
+
+static void wakeQueueWaiters(threadPool *pool, int num) {
+    if (__atomic_load_n(&pool->spaceWaiters, __ATOMIC_SEQ_CST) > 0) {
+        __atomic_add_fetch(&pool->spaceEpoch, 1, __ATOMIC_SEQ_CST);
+        futexWake(&pool->spaceEpoch, num);
+    }
+}
+
+// 执行任务, 有界队列的名额在开始执行时归还, 由线程池分配的节点在func返回后回收
+static void runTask(threadPool *pool, threadTask *task) {
+    int flags = task->flags;
+    if (flags & THREAD_TASK_BOUNDED) {
+        __atomic_sub_fetch(&pool->boundedTasks, 1, __ATOMIC_SEQ_CST);
+        wakeQueueWaiters(pool, 1);
+    }
+
+    task->func(task->userData);
+
+    if (flags & THREAD_TASK_POOLED) {
+        releaseTaskNode(pool, task);
+    }
+}
+
+/*
+ * 任务统计只由所属worker写入, 用普通的读加原子写代替带lock前缀的原子加,
+ * 快照线程用原子读取, 读到的可能是稍旧的值但不会读到撕裂的值.
+ */
+static void statAdd(unsigned long *counter, unsigned long value) {
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static int histBucket(unsigned long value) {
+    if (value >= (1ul << THREAD_POOL_HIST_MAX_BITS)) {
+        value = (1ul << THREAD_POOL_HIST_MAX_BITS) - 1;
+    }
+    if (value < (1ul << THREAD_POOL_HIST_SUB_BITS)) {
+        return (int)value;
+    }
+
+    int shift = 63 - __builtin_clzl(value) - THREAD_POOL_HIST_SUB_BITS;
+    unsigned long sub = (value >> shift) & ((1ul << THREAD_POOL_HIST_SUB_BITS) - 1);
+    return ((shift + 1) << THREAD_POOL_HIST_SUB_BITS) + (int)sub;
+}
+
+// 桶内的最大值
+static unsigned long histBucketUpper(int bucket) {
+    if (bucket < (1 << THREAD_POOL_HIST_SUB_BITS)) {
+        return (unsigned long)bucket;
+    }
+
+    int shift = (bucket >> THREAD_POOL_HIST_SUB_BITS) - 1;
+    unsigned long sub = (unsigned long)bucket & ((1ul << THREAD_POOL_HIST_SUB_BITS) - 1);
+    unsigned long lower = ((1ul << THREAD_POOL_HIST_SUB_BITS) + sub) << shift;
+    return lower + (1ul << shift) - 1;
+}
+
+static void histRecord(threadPoolHistogram *hist, unsigned long value) {
+    statAdd(&hist->count, 1);
+    statAdd(&hist->sumNs, value);
+    statAdd(&hist->buckets[histBucket(value)], 1);
+    if (value > hist->maxNs) {
+        __atomic_store_n(&hist->maxNs, value, __ATOMIC_RELAXED);
+    }
+}
+
+static void histMerge(threadPoolHistogram *dst, threadPoolHistogram *src) {
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sumNs += __atomic_load_n(&src->sumNs, __ATOMIC_RELAXED);
+    unsigned long maxNs = __atomic_load_n(&src->maxNs, __ATOMIC_RELAXED);
+    if (maxNs > dst->maxNs) {
+        dst->maxNs = maxNs;
+    }
+    for (int i = 0; i < THREAD_POOL_HIST_BUCKETS; ++i) {
+        dst->buckets[i] += __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+static void workerStatsMerge(threadWorkerStats *dst, threadWorkerStats *src) {
+    dst->tasks += __atomic_load_n(&src->tasks, __ATOMIC_RELAXED);
+    dst->busyNs += __atomic_load_n(&src->busyNs, __ATOMIC_RELAXED);
+    histMerge(&dst->queueWait, &src->queueWait);
+    histMerge(&dst->runTime, &src->runTime);
+}
+
+static threadWorkerStats *newWorkerStats(void) {
+    threadWorkerStats *stats = (threadWorkerStats *)aligned_alloc(THREAD_POOL_CACHE_LINE,
+                                                                  sizeof(threadWorkerStats));
+    if (stats) {
+        memset(stats, 0, sizeof(threadWorkerStats));
+    }
+    return stats;
+}
+
+// worker执行任务, 弹性模式下记录忙碌时间, 开启统计时还记录排队和执行时间的分布
+static void runWorkerTask(threadWorker *worker, threadTask *task) {
+    threadPool *pool = worker->pool;
+    if (!pool->elastic && !worker->stats) {
+        runTask(pool, task);
+        // release: 读到完成数的线程也能看到任务执行期间提交子任务时增加的计数
+        __atomic_store_n(&worker->completedTasks, worker->completedTasks + 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    // 线程池分配的任务节点执行后会被回收, 先取出入队时间
+    unsigned long enqueueNs = task->enqueueNs;
+    unsigned long start = taskClockNs(pool);
+    runTask(pool, task);
+    unsigned long end = taskClockNs(pool);
+
+    if (pool->elastic) {
+        __atomic_add_fetch(&worker->busyNs, end - start, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&worker->completedTasks, worker->completedTasks + 1, __ATOMIC_RELEASE);
+
+    threadWorkerStats *stats = worker->stats;
+    if (stats) {
+        statAdd(&stats->tasks, 1);
+        statAdd(&stats->busyNs, end - start);
+        histRecord(&stats->queueWait, start > enqueueNs ? start - enqueueNs : 0);
+        histRecord(&stats->runTime, end - start);
+    }
+}
+
+/*
+ * 全局队列按优先级分为多条FIFO通道(双向链表), 带截止时间的任务同样在自己的通道中排队,
+ * 另外由按截止时间排序的小顶堆索引, 任务记录自己在堆中的下标, 从任意一边出队时同时从另一边摘除.
+ * 出队顺序: 已超时的截止任务 > 延迟敏感通道 > 普通/批量通道按normalWeight:1加权轮转.
+ * 截止时间只会让任务提前出队, 不会让它排到自己的通道之后.
+ * 开启numaAware时每个节点各有一个这样的队列.
+ * 以下函数调用时都必须持有所在队列的mutex.
+ */
+static void pushLaneLocked(threadPool *pool, threadTaskQueue *queue, int priority,
+                           threadTask *head, threadTask *tail, int num) {
+    threadTaskLane *lane = &queue->lanes[priority];
+    head->prev = lane->tail;
+    tail->next = NULL;
+    if (lane->tail) {
+        lane->tail->next = head;
+    } else {
+        lane->head = head;
+    }
+    lane->tail = tail;
+    __atomic_add_fetch(&queue->queuedTasks, num, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->queuedTasks, num, __ATOMIC_RELAXED);
+}
+
+static void unlinkLaneLocked(threadTaskQueue *queue, threadTask *task) {
+    threadTaskLane *lane = &queue->lanes[task->priority];
+    if (task->prev) {
+        task->prev->next = task->next;
+    } else {
+        lane->head = task->next;
+    }
+    if (task->next) {
+        task->next->prev = task->prev;
+    } else {
+        lane->tail = task->prev;
+    }
+    task->prev = NULL;
+    task->next = NULL;
+}
+
+static void placeDeadlineLocked(threadTaskQueue *queue, int i, threadTask *task) {
+    queue->deadlineHeap[i] = task;
+    task->heapIndex = i;
+}
+
+static void siftDeadlineUpLocked(threadTaskQueue *queue, int i, threadTask *task) {
+    threadTask **heap = queue->deadlineHeap;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (heap[parent]->deadlineNs <= task->deadlineNs) {
+            break;
+        }
+        placeDeadlineLocked(queue, i, heap[parent]);
+        i = parent;
+    }
+    placeDeadlineLocked(queue, i, task);
+}
+
+static void siftDeadlineDownLocked(threadTaskQueue *queue, int i, threadTask *task) {
+    threadTask **heap = queue->deadlineHeap;
+    int size = queue->deadlineHeapSize;
+    while (1) {
+        int child = i * 2 + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && heap[child + 1]->deadlineNs < heap[child]->deadlineNs) {
+            ++child;
+        }
+        if (task->deadlineNs <= heap[child]->deadlineNs) {
+            break;
+        }
+        placeDeadlineLocked(queue, i, heap[child]);
+        i = child;
+    }
+    placeDeadlineLocked(queue, i, task);
+}
+
+// 任务已经在通道中, 这里只建立截止时间的索引
+static int pushDeadlineLocked(threadTaskQueue *queue, threadTask *task) {
+    if (queue->deadlineHeapSize == queue->deadlineHeapCap) {
+        int cap = queue->deadlineHeapCap ? queue->deadlineHeapCap * 2 : 64;
+        threadTask **heap = (threadTask **)realloc(queue->deadlineHeap, cap * sizeof(threadTask *));
+        if (!heap) {
+            return -1;
+        }
+        queue->deadlineHeap = heap;
+        queue->deadlineHeapCap = cap;
+    }
+
+    siftDeadlineUpLocked(queue, queue->deadlineHeapSize++, task);
+    return 0;
+}
+
+static void removeDeadlineLocked(threadTaskQueue *queue, threadTask *task) {
+    int i = task->heapIndex;
+    task->heapIndex = -1;
+    threadTask *last = queue->deadlineHeap[--queue->deadlineHeapSize];
+    if (last == task) {
+        return;
+    }
+
+    // 用最后一个元素填补空位, 按它和父节点的关系向上或向下调整
+    if (i > 0 && queue->deadlineHeap[(i - 1) / 2]->deadlineNs > last->deadlineNs) {
+        siftDeadlineUpLocked(queue, i, last);
+    } else {
+        siftDeadlineDownLocked(queue, i, last);
+    }
+}
+
+static threadTask *popLaneLocked(threadTaskQueue *queue, int priority) {
+    threadTask *task = queue->lanes[priority].head;
+    if (!task) {
+        return NULL;
+    }
+
+    unlinkLaneLocked(queue, task);
+    if (task->heapIndex >= 0) {
+        removeDeadlineLocked(queue, task);
+    }
+    return task;
+}
+
+// 从一个非空的节点队列中取出任务
+static threadTask *popQueueTaskLocked(threadPool *pool, threadTaskQueue *queue) {
+    threadTask *task = NULL;
+    if (queue->deadlineHeapSize > 0 && queue->deadlineHeap[0]->deadlineNs <= nowNs()) {
+        task = queue->deadlineHeap[0];
+        removeDeadlineLocked(queue, task);
+        unlinkLaneLocked(queue, task);
+    }
+
+    if (!task) {
+        task = popLaneLocked(queue, THREAD_TASK_PRIORITY_LATENCY);
+    }
+
+    if (!task) {
+        int hasNormal = queue->lanes[THREAD_TASK_PRIORITY_NORMAL].head != NULL;
+        int hasBulk = queue->lanes[THREAD_TASK_PRIORITY_BULK].head != NULL;
+        if (hasNormal && (!hasBulk || queue->normalCredit < pool->normalWeight)) {
+            task = popLaneLocked(queue, THREAD_TASK_PRIORITY_NORMAL);
+            ++queue->normalCredit;
+        } else if (hasBulk) {
+            task = popLaneLocked(queue, THREAD_TASK_PRIORITY_BULK);
+            queue->normalCredit = 0;
+        }
+    }
+
+    __atomic_sub_fetch(&queue->queuedTasks, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&pool->queuedTasks, 1, __ATOMIC_RELAXED);
+    return task;
+}
+
+// 优先取node节点的任务, 为空时依次取其他节点的任务. 只加要访问的那个节点的锁, 不持有锁返回
+static threadTask *popGlobalTask(threadPool *pool, int node) {
+    if (__atomic_load_n(&pool->queuedTasks, __ATOMIC_RELAXED) == 0) {
+        return NULL;
+    }
+
+    for (int i = 0; i < pool->nodeNum; ++i) {
+        threadTaskQueue *queue = &pool->queues[(node + i) % pool->nodeNum];
+        if (__atomic_load_n(&queue->queuedTasks, __ATOMIC_RELAXED) == 0) {
+            continue;
+        }
+
+        threadTask *task = NULL;
+        pthread_mutex_lock(&queue->mutex);
+        if (queue->queuedTasks > 0) {
+            task = popQueueTaskLocked(pool, queue);
+        }
+        pthread_mutex_unlock(&queue->mutex);
+        if (task) {
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+// 丢弃所有节点排队的任务, 并唤醒所有等待的worker让它们看到terminate
+static void clearGlobalQueues(threadPool *pool) {
+    for (int i = 0; i < pool->nodeNum && pool->queues; ++i) {
+        threadTaskQueue *queue = &pool->queues[i];
+        pthread_mutex_lock(&queue->mutex);
+        memset(queue->lanes, 0, sizeof(queue->lanes));
+        queue->deadlineHeapSize = 0;
+        __atomic_store_n(&queue->queuedTasks, 0, __ATOMIC_RELAXED);
+        pthread_cond_broadcast(&queue->cond);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+    __atomic_store_n(&pool->queuedTasks, 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * worker在自己节点的队列上等待任务: 持有队列的mutex时先增加idleWorkers再检查队列,
+ * 提交者入队后检查各节点的idleWorkers, 两侧都有seq_cst屏障,
+ * 因此要么worker看到新任务, 要么提交者看到空闲worker并加这个节点的锁唤醒它.
+ * 提交者在锁内重新读取idleWorkers, worker离开空闲状态也在锁内, 不会唤醒已经离开的worker.
+ */
+static void enterIdleLocked(threadPool *pool, threadTaskQueue *queue) {
+    __atomic_add_fetch(&queue->idleWorkers, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&pool->idleWorkers, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void leaveIdleLocked(threadPool *pool, threadTaskQueue *queue) {
+    __atomic_sub_fetch(&queue->idleWorkers, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&pool->idleWorkers, 1, __ATOMIC_SEQ_CST);
+}
+
+// 入队之后调用, 唤醒最多num个空闲worker, 先唤醒node节点的, 不够时再唤醒其他节点的
+static void wakeIdleWorkers(threadPool *pool, int node, int num) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->idleWorkers, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+
+    for (int i = 0; i < pool->nodeNum && num > 0; ++i) {
+        threadTaskQueue *queue = &pool->queues[(node + i) % pool->nodeNum];
+        if (__atomic_load_n(&queue->idleWorkers, __ATOMIC_RELAXED) == 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&queue->mutex);
+        int wake = queue->idleWorkers < num ? queue->idleWorkers : num;
+        for (int j = 0; j < wake; ++j) {
+            pthread_cond_signal(&queue->cond);
+        }
+        pthread_mutex_unlock(&queue->mutex);
+        num -= wake;
+    }
+}
+
+/*
+ * worker的CPU分配. 可用CPU按所在节点排序, 同一节点的CPU在cpus中连续存放,
+ * 第i个worker属于第i % nodeNum个节点. 节点信息从sysfs读取, 不依赖libnuma.
+ */
+typedef struct threadPoolPlacement {
+    int pin;
+    int nodeNum;
+    int *nodeIds;    // 节点下标到系统节点编号, 未开启numaAware时为-1
+    int *nodeFirst;  // 节点的第一个CPU在cpus中的位置
+    int *nodeCount;
+    int *cpus;
+} threadPoolPlacement;
+
+// 解析"0-3,8,10-11"格式的列表
+static void parseCpuList(const char *str, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*str) {
+        char *end;
+        long first = strtol(str, &end, 10);
+        if (end == str) {
+            break;
+        }
+
+        long last = first;
+        str = end;
+        if (*str == '-') {
+            last = strtol(str + 1, &end, 10);
+            str = end;
+        }
+        for (long i = first; i <= last && i < CPU_SETSIZE; ++i) {
+            CPU_SET(i, set);
+        }
+
+        if (*str != ',') {
+            break;
+        }
+        ++str;
+    }
+}
+
+static int readCpuListFile(const char *path, cpu_set_t *set) {
+    char buf[4096];
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+
+    char *line = fgets(buf, sizeof(buf), file);
+    fclose(file);
+    if (!line) {
+        return -1;
+    }
+
+    parseCpuList(line, set);
+    return 0;
+}
+
+// 读取每个CPU所在的节点, 没有节点信息的CPU视为节点0
+static void readCpuNodes(int *cpuNode) {
+    memset(cpuNode, 0, CPU_SETSIZE * sizeof(int));
+
+    cpu_set_t nodes;
+    if (readCpuListFile("/sys/devices/system/node/online", &nodes) != 0) {
+        return;
+    }
+
+    for (int node = 0; node < CPU_SETSIZE; ++node) {
+        if (!CPU_ISSET(node, &nodes)) {
+            continue;
+        }
+
+        char path[64];
+        cpu_set_t cpus;
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (readCpuListFile(path, &cpus) != 0) {
+            continue;
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &cpus)) {
+                cpuNode[cpu] = node;
+            }
+        }
+    }
+}
+
+static void freePlacement(threadPoolPlacement *placement) {
+    if (!placement) {
+        return;
+    }
+
+    free(placement->nodeIds);
+    free(placement->nodeFirst);
+    free(placement->nodeCount);
+    free(placement->cpus);
+    free(placement);
+}
+
+static threadPoolPlacement *createPlacement(const threadPoolAttr *attr) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (attr->cpus) {
+        for (int i = 0; i < attr->cpuNum; ++i) {
+            if (attr->cpus[i] >= 0 && attr->cpus[i] < CPU_SETSIZE) {
+                CPU_SET(attr->cpus[i], &allowed);
+            }
+        }
+    } else if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) {
+        return NULL;
+    }
+
+    int cpuNum = CPU_COUNT(&allowed);
+    if (cpuNum == 0) {
+        return NULL;
+    }
+
+    int *nodeOf = NULL;
+    if (attr->numaAware) {
+        nodeOf = (int *)malloc(CPU_SETSIZE * sizeof(int));
+        if (!nodeOf) {
+            return NULL;
+        }
+        readCpuNodes(nodeOf);
+    }
+
+    threadPoolPlacement *placement = (threadPoolPlacement *)calloc(1, sizeof(threadPoolPlacement));
+    if (placement) {
+        placement->pin = attr->pinWorkers;
+        placement->nodeIds = (int *)malloc(cpuNum * sizeof(int));
+        placement->nodeFirst = (int *)malloc(cpuNum * sizeof(int));
+        placement->nodeCount = (int *)malloc(cpuNum * sizeof(int));
+        placement->cpus = (int *)malloc(cpuNum * sizeof(int));
+    }
+    if (!placement || !placement->nodeIds || !placement->nodeFirst ||
+        !placement->nodeCount || !placement->cpus) {
+        freePlacement(placement);
+        free(nodeOf);
+        return NULL;
+    }
+
+    // 按节点插入排序, 同一节点内保持CPU编号升序
+    int num = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+
+        int node = nodeOf ? nodeOf[cpu] : -1;
+        int i = num++;
+        while (i > 0 && (nodeOf ? nodeOf[placement->cpus[i - 1]] : -1) > node) {
+            placement->cpus[i] = placement->cpus[i - 1];
+            --i;
+        }
+        placement->cpus[i] = cpu;
+    }
+
+    for (int i = 0; i < num; ++i) {
+        int node = nodeOf ? nodeOf[placement->cpus[i]] : -1;
+        if (placement->nodeNum == 0 || placement->nodeIds[placement->nodeNum - 1] != node) {
+            placement->nodeIds[placement->nodeNum] = node;
+            placement->nodeFirst[placement->nodeNum] = i;
+            placement->nodeCount[placement->nodeNum] = 0;
+            ++placement->nodeNum;
+        }
+        ++placement->nodeCount[placement->nodeNum - 1];
+    }
+
+    free(nodeOf);
+    return placement;
+}
+
+static void workerAffinity(threadPool *pool, threadWorker *worker, cpu_set_t *set) {
+    threadPoolPlacement *placement = pool->placement;
+    int first = placement->nodeFirst[worker->node];
+    int count = placement->nodeCount[worker->node];
+
+    CPU_ZERO(set);
+    if (placement->pin) {
+        CPU_SET(placement->cpus[first + (worker->index / placement->nodeNum) % count], set);
+        return;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        CPU_SET(placement->cpus[first + i], set);
+    }
+}
+
+// 系统节点编号对应的节点下标, 不属于线程池时返回-1
+static int nodeIndexOf(threadPool *pool, int node) {
+    if (!pool->placement || node < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < pool->placement->nodeNum; ++i) {
+        if (pool->placement->nodeIds[i] == node) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// 线程在创建时就带上亲和性, 保证worker之后分配的内存都在所属节点上
+static int startWorker(threadPool *pool, threadWorker *worker) {
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) != 0) {
+        return -1;
+    }
+
+    if (pool->placement) {
+        cpu_set_t set;
+        workerAffinity(pool, worker, &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set);
+    }
+
+    int ret = pthread_create(&worker->workId, &attr, workerLoop, worker);
+    pthread_attr_destroy(&attr);
+    return ret;
+}
+
+static threadWorker *newWorker(threadPool *pool, int index) {
+    threadWorker *worker = (threadWorker*) malloc(sizeof(threadWorker));
+    if (!worker) {
+        return NULL;
+    }
+
+    memset(worker, 0, sizeof(threadWorker));
+    worker->pool = pool;
+    worker->terminate = NOT_EXIT;
+    worker->index = index;
+    worker->node = index % pool->nodeNum;
+    worker->seed = (unsigned int)index * 2654435761u + 1;
+    worker->startNs = nowNs();
+
+    if (pool->statsEnabled) {
+        worker->stats = newWorkerStats();
+        if (!worker->stats) {
+            free(worker);
+            return NULL;
+        }
+    }
+    return worker;
+}
+
+// 回收已经退出的worker, 把计数并入线程池, 调用时必须持有poolMutex
+static void reapRetiredWorkersLocked(threadPool *pool) {
+    while (pool->retiredWorkers) {
+        threadWorker *worker = pool->retiredWorkers;
+        LL_REMOVE(worker, pool->retiredWorkers);
+        pthread_join(worker->workId, NULL);
+
+        pool->reapedBusyNs += worker->busyNs;
+        pool->reapedAliveNs += worker->exitNs - worker->startNs;
+        pool->reapedTasks += worker->completedTasks;
+        pool->reapedSubmitted += worker->submittedTasks;
+        for (int i = 0; i < THREAD_POOL_IDLE_PHASE_NUM; ++i) {
+            pool->reapedIdleWakeups[i] += worker->idleWakeups[i];
+        }
+        if (worker->stats) {
+            workerStatsMerge(pool->reapedStats, worker->stats);
+            free(worker->stats);
+        }
+        pool->workerArray[worker->index] = NULL;
+        free(worker);
+    }
+}
+
+// 弹性模式下新增一个worker, 调用时必须持有poolMutex
+static void spawnWorkerLocked(threadPool *pool, unsigned long now) {
+    if (pool->terminating || pool->liveWorkers >= pool->maxWorkers ||
+        now - pool->lastSpawnNs < pool->spawnWaitNs) {
+        return;
+    }
+
+    reapRetiredWorkersLocked(pool);
+
+    int index = 0;
+    while (index < pool->workerNum && pool->workerArray[index]) {
+        ++index;
+    }
+    if (index == pool->workerNum) {
+        return;
+    }
+
+    threadWorker *worker = newWorker(pool, index);
+    if (!worker) {
+        return;
+    }
+
+    if (startWorker(pool, worker) != 0) {
+        free(worker->stats);
+        free(worker);
+        return;
+    }
+
+    pool->workerArray[index] = worker;
+    LL_ADD(worker, pool->workers);
+    ++pool->liveWorkers;
+    ++pool->spawnedWorkers;
+    pool->lastSpawnNs = now;
+}
+
+// 空闲超时的worker从注册表移到退出链表, 由后续的spawn或销毁回收, 调用时必须持有poolMutex
+static void retireWorkerLocked(threadWorker *worker) {
+    threadPool *pool = worker->pool;
+    LL_REMOVE(worker, pool->workers);
+    LL_ADD(worker, pool->retiredWorkers);
+    worker->exitNs = nowNs();
+
+    // 本地缓存的任务节点还给全局空闲链表
+    if (worker->freeTasks) {
+        threadTask *tail = worker->freeTasks;
+        while (tail->next) {
+            tail = tail->next;
+        }
+
+        pthread_mutex_lock(&pool->freeMutex);
+        tail->next = pool->freeTasks;
+        pool->freeTasks = worker->freeTasks;
+        pthread_mutex_unlock(&pool->freeMutex);
+
+        worker->freeTasks = NULL;
+        worker->freeTaskNum = 0;
+    }
+    --pool->liveWorkers;
+    ++pool->retiredWorkerNum;
+}
+
+// 在节点队列上等待任务, 调用时必须持有queue->mutex. 弹性模式下等待超过idleTimeoutNs返回ETIMEDOUT
+static int waitGlobalTask(threadPool *pool, threadTaskQueue *queue) {
+    if (!pool->elastic) {
+        return pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    unsigned long nsec = (unsigned long)deadline.tv_nsec + pool->idleTimeoutNs;
+    deadline.tv_sec += nsec / 1000000000ul;
+    deadline.tv_nsec = nsec % 1000000000ul;
+    return pthread_cond_timedwait(&queue->cond, &queue->mutex, &deadline);
+}
+
+static int hasGlobalTask(threadPool *pool) {
+    return __atomic_load_n(&pool->queuedTasks, __ATOMIC_RELAXED) > 0;
+}
+
+// 弹性模式下记录排队时间, 排队过久且没有空闲worker时扩容, 调用时必须持有poolMutex
+static void onGlobalTaskDequeuedLocked(threadPool *pool, threadTask *task) {
+    unsigned long now = nowNs();
+    unsigned long wait = now - task->enqueueNs;
+    pool->lastDequeueNs = now;
+    pool->queueWaitNs += wait;
+    ++pool->dequeuedTasks;
+    if (wait > pool->maxQueueWaitNs) {
+        pool->maxQueueWaitNs = wait;
+    }
+
+    if (wait > pool->spawnWaitNs && __atomic_load_n(&pool->idleWorkers, __ATOMIC_RELAXED) == 0 &&
+        hasGlobalTask(pool)) {
+        spawnWorkerLocked(pool, now);
+    }
+}
+
+static void cpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/*
+ * 队列为空时先自旋再让出CPU, 期间只读队列长度, 不加锁也不计入空闲worker,
+ * 提交者因此不需要唤醒. hasWork由各模式提供, 只做粗略检查
+ *
+ * @return int 1表示在自旋或让出阶段发现了任务或需要退出, 0表示调用者应该休眠
+ */
+static int idleWait(threadWorker *worker, int (*hasWork)(threadPool *pool)) {
+    threadPool *pool = worker->pool;
+    if (pool->idleSpinNs) {
+        unsigned long start = fastNowNs();
+        do {
+            for (int i = 0; i < IDLE_SPIN_BATCH; ++i) {
+                cpuRelax();
+                if (__atomic_load_n(&worker->terminate, __ATOMIC_RELAXED) == EXIT) {
+                    return 1;
+                }
+                if (hasWork(pool)) {
+                    statAdd(&worker->idleWakeups[THREAD_POOL_IDLE_SPIN], 1);
+                    return 1;
+                }
+            }
+        } while (fastNowNs() - start < pool->idleSpinNs);
+    }
+
+    for (int i = 0; i < pool->idleYields; ++i) {
+        sched_yield();
+        if (__atomic_load_n(&worker->terminate, __ATOMIC_RELAXED) == EXIT) {
+            return 1;
+        }
+        if (hasWork(pool)) {
+            statAdd(&worker->idleWakeups[THREAD_POOL_IDLE_YIELD], 1);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int workerExiting(threadWorker *worker) {
+    return __atomic_load_n(&worker->terminate, __ATOMIC_RELAXED) == EXIT;
+}
+
+// 弹性模式下空闲超时, worker数量多于下限时退出, 调用时持有所在节点队列的mutex
+static int tryRetireWorker(threadWorker *worker) {
+    threadPool *pool = worker->pool;
+    int retire = 0;
+    pthread_mutex_lock(&pool->poolMutex);
+    if (pool->liveWorkers > pool->minWorkers) {
+        retireWorkerLocked(worker);
+        retire = 1;
+    }
+    pthread_mutex_unlock(&pool->poolMutex);
+    return retire;
+}
+
+static void *globalWorkerLoop(threadWorker *worker) {
+    threadPool *pool = worker->pool;
+    threadTaskQueue *queue = &pool->queues[worker->node];
+
+    int idle = pool->idleSpinNs || pool->idleYields;
+    while (!workerExiting(worker)) {
+        int parked = 0;
+        if (idle && !hasGlobalTask(pool)) {
+            idleWait(worker, hasGlobalTask);
+        }
+
+        threadTask *task = popGlobalTask(pool, worker->node);
+        while (!task) {
+            int ret = 0;
+            int retire = 0;
+            pthread_mutex_lock(&queue->mutex);
+            enterIdleLocked(pool, queue);
+            while (!hasGlobalTask(pool) && !workerExiting(worker) && ret != ETIMEDOUT) {
+                ret = waitGlobalTask(pool, queue);
+                parked = 1;
+            }
+            leaveIdleLocked(pool, queue);
+            if (ret == ETIMEDOUT && !hasGlobalTask(pool) && !workerExiting(worker)) {
+                retire = tryRetireWorker(worker);
+            }
+            pthread_mutex_unlock(&queue->mutex);
+
+            if (retire || workerExiting(worker)) {
+                return NULL;
+            }
+            task = popGlobalTask(pool, worker->node);
+        }
+
+        if (pool->elastic) {
+            pthread_mutex_lock(&pool->poolMutex);
+            onGlobalTaskDequeuedLocked(pool, task);
+            pthread_mutex_unlock(&pool->poolMutex);
+        }
+
+        if (parked) {
+            statAdd(&worker->idleWakeups[THREAD_POOL_IDLE_PARK], 1);
+        }
+        runWorkerTask(worker, task);
+    }
+
+    return NULL;
+}
+
+static threadTask *stealTask(threadWorker *worker) {
+    threadPool *pool = worker->pool;
+    int num = pool->workerNum;
+    if (num <= 1) {
+        return NULL;
+    }
+
+    // 从随机位置开始遍历, 避免所有空闲worker同时窃取同一个对象.
+    // 多个节点时先窃取同节点的worker, 再跨节点窃取
+    int start = rand_r(&worker->seed) % num;
+    int passes = pool->nodeNum > 1 ? 2 : 1;
+    for (int pass = 0; pass < passes; ++pass) {
+        for (int i = 0; i < num; ++i) {
+            threadWorker *victim = pool->workerArray[(start + i) % num];
+            if (victim == worker) {
+                continue;
+            }
+            if (passes > 1 && (victim->node == worker->node) != (pass == 0)) {
+                continue;
+            }
+
+            threadTask *task = wsDequeSteal(victim->deque);
+            if (task) {
+                return task;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int hasStealableTask(threadPool *pool) {
+    for (int i = 0; i < pool->workerNum; ++i) {
+        if (!wsDequeEmpty(pool->workerArray[i]->deque)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int hasStealingTask(threadPool *pool) {
+    return hasGlobalTask(pool) || hasStealableTask(pool);
+}
+
+static threadTask *findStealingTask(threadWorker *worker) {
+    threadTask *task = wsDequeTake(worker->deque);
+    if (task) {
+        return task;
+    }
+
+    // 外部线程提交的任务
+    task = popGlobalTask(worker->pool, worker->node);
+    if (task) {
+        return task;
+    }
+
+    return stealTask(worker);
+}
+
+/*
+ * 在自己节点的队列上休眠, 与提交者的配合见enterIdleLocked.
+ * 检查只在锁内进行, 取任务在放开锁之后, 不会同时持有两个节点的锁.
+ *
+ * 窃取输给队列所有者的take时队列看起来仍然非空, 这时让出CPU后在锁外重试,
+ * 不在锁内空转挡住提交者和其他worker. 重试次数用完就休眠: 非空队列的所有者一定醒着, 会自己执行这些任务.
+ */
+static threadTask *waitStealingTask(threadWorker *worker) {
+    threadPool *pool = worker->pool;
+    threadTaskQueue *queue = &pool->queues[worker->node];
+    int parked = 0;
+    int retries = 0;
+
+    while (!workerExiting(worker)) {
+        int yield = 0;
+        pthread_mutex_lock(&queue->mutex);
+        enterIdleLocked(pool, queue);
+        if (hasGlobalTask(pool)) {
+            // 直接去取
+        } else if (retries < STEAL_RETRY_MAX && hasStealableTask(pool)) {
+            ++retries;
+            yield = 1;
+        } else if (!workerExiting(worker)) {
+            pthread_cond_wait(&queue->cond, &queue->mutex);
+            parked = 1;
+            retries = 0;
+        }
+        leaveIdleLocked(pool, queue);
+        pthread_mutex_unlock(&queue->mutex);
+
+        if (yield) {
+            sched_yield();
+        }
+        threadTask *task = findStealingTask(worker);
+        if (task) {
+            if (parked) {
+                statAdd(&worker->idleWakeups[THREAD_POOL_IDLE_PARK], 1);
+            }
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+static void *stealingWorkerLoop(threadWorker *worker) {
+    threadPool *pool = worker->pool;
+    int idle = pool->idleSpinNs || pool->idleYields;
+    while (__atomic_load_n(&worker->terminate, __ATOMIC_RELAXED) != EXIT) {
+        threadTask *task = findStealingTask(worker);
+        if (!task && idle && idleWait(worker, hasStealingTask)) {
+            continue;
+        }
+        if (!task) {
+            task = waitStealingTask(worker);
+            if (!task) {
+                break;
+            }
+        }
+
+        runWorkerTask(worker, task);
+    }
+
+    return NULL;
+}
+
+/*
+ * 休眠前先记下wakeEpoch并增加sleepers, 再检查一次队列;
+ * 提交者入队后发现sleepers不为0就推进wakeEpoch并唤醒,
+ * 若推进发生在记录之后futexWait会立即返回, 因此不会丢失唤醒.
+ */
+static threadTask *waitRingTask(threadWorker *worker) {
+    threadPool *pool = worker->pool;
+
+    while (1) {
+        unsigned int epoch = __atomic_load_n(&pool->wakeEpoch, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+
+        threadTask *task = mpmcRingPop(pool->ring);
+        if (!task && __atomic_load_n(&worker->terminate, __ATOMIC_RELAXED) != EXIT) {
+            futexWait(&pool->wakeEpoch, epoch);
+            task = mpmcRingPop(pool->ring);
+            if (task) {
+                statAdd(&worker->idleWakeups[THREAD_POOL_IDLE_PARK], 1);
+            }
+        }
+
+        __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (task || __atomic_load_n(&worker->terminate, __ATOMIC_RELAXED) == EXIT) {
+            return task;
+        }
+    }
+}
+
+static void wakeRingWorkers(threadPool *pool, int num) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleepers, __ATOMIC_RELAXED) > 0) {
+        __atomic_add_fetch(&pool->wakeEpoch, 1, __ATOMIC_SEQ_CST);
+        futexWake(&pool->wakeEpoch, num);
+    }
+}
+
+static int hasRingTask(threadPool *pool) {
+    return mpmcRingSize(pool->ring) > 0;
+}
+
+static void *ringWorkerLoop(threadWorker *worker) {
+    int idle = worker->pool->idleSpinNs || worker->pool->idleYields;
+    while (__atomic_load_n(&worker->terminate, __ATOMIC_RELAXED) != EXIT) {
+        threadTask *task = mpmcRingPop(worker->pool->ring);
+        if (!task && idle && idleWait(worker, hasRingTask)) {
+            continue;
+        }
+        if (!task) {
+            task = waitRingTask(worker);
+            if (!task) {
+                break;
+            }
+        }
+
+        runWorkerTask(worker, task);
+    }
+
+    return NULL;
+}
+
 static void *workerLoop(void *arg) {
     threadWorker *worker = (threadWorker *)arg;
+    currentWorker = worker;
+
+    if (worker->pool->mode == THREAD_POOL_WORK_STEALING) {
+        stealingWorkerLoop(worker);
+    } else if (worker->pool->mode == THREAD_POOL_MPMC_RING) {
+        ringWorkerLoop(worker);
+    } else {
+        globalWorkerLoop(worker);
+    }
+
+    currentWorker = NULL;
+    pthread_exit(NULL);
+}
+
+// 通知已启动的worker退出并等待其结束, 然后释放所有worker
+static void cleanupWorkers(threadPool *pool) {
+    pthread_mutex_lock(&pool->poolMutex);
+    __atomic_store_n(&pool->terminating, 1, __ATOMIC_SEQ_CST);
+    for (threadWorker *tmp = pool->workers; tmp; tmp = tmp->next) {
+        __atomic_store_n(&tmp->terminate, EXIT, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&pool->poolMutex);
+    clearGlobalQueues(pool);
+
+    // 阻塞在有界队列上的提交者看到terminating后返回
+    wakeQueueWaiters(pool, INT_MAX);
+
+    if (pool->ring) {
+        __atomic_add_fetch(&pool->wakeEpoch, 1, __ATOMIC_SEQ_CST);
+        futexWake(&pool->wakeEpoch, pool->workerNum);
+    }
+
+    for (threadWorker *tmp = pool->workers; tmp; tmp = tmp->next) {
+        pthread_join(tmp->workId, NULL);
+    }
+    pool->workers = NULL;
+
+    for (threadWorker *tmp = pool->retiredWorkers; tmp; tmp = tmp->next) {
+        pthread_join(tmp->workId, NULL);
+    }
+    pool->retiredWorkers = NULL;
+    pool->liveWorkers = 0;
+
+    for (int i = 0; i < pool->workerNum; ++i) {
+        threadWorker *worker = pool->workerArray[i];
+        if (!worker) {
+            continue;
+        }
+
+        if (worker->deque) {
+            wsDequeDestroy(worker->deque);
+            free(worker->deque);
+        }
+        free(worker->stats);
+        free(worker);
+    }
+
+    free(pool->workerArray);
+    pool->workerArray = NULL;
+    pool->workerNum = 0;
+
+    while (pool->taskSlabs) {
+        taskSlab *slab = pool->taskSlabs;
+        pool->taskSlabs = slab->next;
+        free(slab);
+    }
+    pool->freeTasks = NULL;
+
+    if (pool->ring) {
+        mpmcRingDestroy(pool->ring);
+        free(pool->ring);
+        pool->ring = NULL;
+    }
+
+    for (int i = 0; i < pool->nodeNum && pool->queues; ++i) {
+        free(pool->queues[i].deadlineHeap);
+    }
+    free(pool->queues);
+    pool->queues = NULL;
+
+    freePlacement(pool->placement);
+    pool->placement = NULL;
+
+    free(pool->reapedStats);
+    pool->reapedStats = NULL;
+}
+
+void initThreadPoolAttr(threadPoolAttr *attr) {
+    if (!attr) {
+        return;
+    }
+
+    memset(attr, 0, sizeof(threadPoolAttr));
+    attr->poolNum = 1;
+    attr->mode = THREAD_POOL_GLOBAL_QUEUE;
+    attr->ringCapacity = THREAD_POOL_DEFAULT_RING_CAPACITY;
+    attr->spawnWaitUs = THREAD_POOL_DEFAULT_SPAWN_WAIT_US;
+    attr->idleTimeoutMs = THREAD_POOL_DEFAULT_IDLE_TIMEOUT_MS;
+    attr->normalWeight = THREAD_POOL_DEFAULT_NORMAL_WEIGHT;
+}
+
+int createThreadPool(threadPool *pool, int poolNum) {
+    threadPoolAttr attr;
+    initThreadPoolAttr(&attr);
+    attr.poolNum = poolNum;
+
+    return createThreadPoolWithAttr(pool, &attr);
+}
+
+int createThreadPoolWithAttr(threadPool *pool, const threadPoolAttr *attr) {
+    if (!pool || !attr) {
+        return -1;
+    }
+
+    int poolNum = attr->poolNum;
+    if (poolNum < 1) {
+        poolNum = 1;
+    }
+
+    // 弹性模式只支持全局队列, 工作窃取和环形队列的worker集合是固定的
+    int elastic = attr->maxPoolNum > 0;
+    int minWorkers = poolNum;
+    int maxWorkers = poolNum;
+    if (elastic) {
+        if (attr->mode != THREAD_POOL_GLOBAL_QUEUE) {
+            return -1;
+        }
+
+        minWorkers = attr->minPoolNum > 0 ? attr->minPoolNum : 1;
+        maxWorkers = attr->maxPoolNum;
+        if (minWorkers > maxWorkers) {
+            return -1;
+        }
+        if (poolNum < minWorkers) {
+            poolNum = minWorkers;
+        }
+        if (poolNum > maxWorkers) {
+            poolNum = maxWorkers;
+        }
+    }
+
+    memset(pool, 0, sizeof(threadPool));
+
+    pthread_cond_t blankCond = PTHREAD_COND_INITIALIZER;
+    pthread_mutex_t blankMutex = PTHREAD_MUTEX_INITIALIZER;
+    memcpy(&pool->poolMutex, &blankMutex, sizeof(pthread_mutex_t));
+    memcpy(&pool->freeMutex, &blankMutex, sizeof(pthread_mutex_t));
+
+    pool->mode = attr->mode;
+    pool->elastic = elastic;
+    pool->minWorkers = minWorkers;
+    pool->maxWorkers = maxWorkers;
+    pool->spawnWaitNs = attr->spawnWaitUs * 1000ul;
+    pool->idleTimeoutNs = attr->idleTimeoutMs * 1000000ul;
+    pool->normalWeight = attr->normalWeight > 0 ? attr->normalWeight : 1;
+    pool->maxQueuedTasks = attr->maxQueuedTasks > 0 ? attr->maxQueuedTasks : 0;
+    pool->fullPolicy = attr->fullPolicy;
+    // 单核机器上自旋只会挡住要提交任务的线程, 只保留让出阶段
+    pool->idleSpinNs = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? attr->idleSpinUs * 1000ul : 0;
+    pool->idleYields = attr->idleYields > 0 ? attr->idleYields : 0;
+    if (pool->idleSpinNs) {
+        pthread_once(&tscOnce, calibrateTsc);
+    }
+    pool->createNs = nowNs();
+    pool->lastDequeueNs = pool->createNs;
+
+    pool->statsEnabled = attr->enableStats;
+    if (pool->statsEnabled) {
+        pthread_once(&tscOnce, calibrateTsc);
+        pool->reapedStats = newWorkerStats();
+        if (!pool->reapedStats) {
+            return -1;
+        }
+    }
+
+    pool->nodeNum = 1;
+    if (attr->cpus || attr->pinWorkers || attr->numaAware) {
+        pool->placement = createPlacement(attr);
+        if (!pool->placement) {
+            cleanupWorkers(pool);
+            return -1;
+        }
+        pool->nodeNum = pool->placement->nodeNum;
+    }
+
+    pool->queues = (threadTaskQueue *)aligned_alloc(THREAD_POOL_CACHE_LINE,
+                                                    pool->nodeNum * sizeof(threadTaskQueue));
+    if (!pool->queues) {
+        cleanupWorkers(pool);
+        return -1;
+    }
+    memset(pool->queues, 0, pool->nodeNum * sizeof(threadTaskQueue));
+    for (int i = 0; i < pool->nodeNum; ++i) {
+        memcpy(&pool->queues[i].mutex, &blankMutex, sizeof(pthread_mutex_t));
+        memcpy(&pool->queues[i].cond, &blankCond, sizeof(pthread_cond_t));
+    }
 
-    while (1) {
-        pthread_mutex_lock(&worker->pool->poolMutex);
-        while (!worker->pool->tasks) {
-            if (worker->terminate == EXIT) {
-                break;
+    // 弹性模式下按最大数量预留槽位
+    pool->workerArray = (threadWorker **)calloc(maxWorkers, sizeof(threadWorker *));
+    if (!pool->workerArray) {
+        cleanupWorkers(pool);
+        return -1;
+    }
+    pool->workerNum = maxWorkers;
+
+    if (pool->mode == THREAD_POOL_MPMC_RING) {
+        pool->ring = (mpmcRing *)aligned_alloc(THREAD_POOL_CACHE_LINE, sizeof(mpmcRing));
+        if (!pool->ring) {
+            cleanupWorkers(pool);
+            return -1;
+        }
+
+        if (mpmcRingInit(pool->ring, attr->ringCapacity) != 0) {
+            free(pool->ring);
+            pool->ring = NULL;
+            cleanupWorkers(pool);
+            return -1;
+        }
+    }
+
+    // 先准备好所有worker再启动线程, 保证窃取时看到的workerArray已经完整
+    for (int i = 0; i < poolNum; ++i) {
+        threadWorker *worker = newWorker(pool, i);
+        if (!worker) {
+            cleanupWorkers(pool);
+            return -1;
+        }
+        pool->workerArray[i] = worker;
+
+        if (pool->mode == THREAD_POOL_WORK_STEALING) {
+            worker->deque = (wsDeque *)aligned_alloc(THREAD_POOL_CACHE_LINE, sizeof(wsDeque));
+            if (!worker->deque) {
+                cleanupWorkers(pool);
+                return -1;
+            }
+
+            if (wsDequeInit(worker->deque, WS_DEQUE_INIT_CAPACITY) != 0) {
+                free(worker->deque);
+                worker->deque = NULL;
+                cleanupWorkers(pool);
+                return -1;
             }
-            pthread_cond_wait(&worker->pool->poolCond, &worker->pool->poolMutex);
         }
+    }
 
-        if (worker->terminate == EXIT) {
-            pthread_mutex_unlock(&worker->pool->poolMutex);
-            break;
+    for (int i = 0; i < poolNum; ++i) {
+        threadWorker *worker = pool->workerArray[i];
+        int ret = startWorker(pool, worker);
+        if (ret != 0) {
+            cleanupWorkers(pool);
+            return -1;
         }
 
-        // 取出任务并从链表中移除
-        threadTask *task = worker->pool->tasks;
-        LL_REMOVE(task, worker->pool->tasks);
-        pthread_mutex_unlock(&worker->pool->poolMutex);
+        pthread_mutex_lock(&pool->poolMutex);
+        LL_ADD(worker, pool->workers);
+        ++pool->liveWorkers;
+        pthread_mutex_unlock(&pool->poolMutex);
+    }
+
+    return 0;
+}
 
-        task->func(task->userData);
+int destoryThreadPool(threadPool *pool) {
+    if (!pool) {
+        return -1;
     }
 
-    free(worker);
-    pthread_exit(NULL);
+    cleanupWorkers(pool);
+
+    return 0;
 }
 
-void cleanupWorkers(threadPool *pool) {
+/*
+ * 所有已提交的任务都已执行完成, 调用时必须持有poolMutex.
+ * 计数都只增不减, 先读完成数再读提交数: 两者相等说明读完成数时所有任务都已完成,
+ * 没有正在执行的任务也就不会再有worker提交新任务, 外部线程的提交已被draining拒绝
+ */
+static int drainedLocked(threadPool *pool) {
+    unsigned long completed = pool->reapedTasks;
+    completed += __atomic_load_n(&pool->externalCompleted, __ATOMIC_SEQ_CST);
+    for (threadWorker *tmp = pool->workers; tmp; tmp = tmp->next) {
+        completed += __atomic_load_n(&tmp->completedTasks, __ATOMIC_ACQUIRE);
+    }
+    for (threadWorker *tmp = pool->retiredWorkers; tmp; tmp = tmp->next) {
+        completed += tmp->completedTasks;
+    }
+
+    unsigned long submitted = pool->reapedSubmitted;
+    submitted += __atomic_load_n(&pool->externalSubmitted, __ATOMIC_SEQ_CST);
     for (threadWorker *tmp = pool->workers; tmp; tmp = tmp->next) {
-        tmp->terminate = EXIT;
+        submitted += __atomic_load_n(&tmp->submittedTasks, __ATOMIC_ACQUIRE);
     }
+    for (threadWorker *tmp = pool->retiredWorkers; tmp; tmp = tmp->next) {
+        submitted += tmp->submittedTasks;
+    }
+
+    return completed == submitted;
 }
 
-int createThreadPool(threadPool *pool, int poolNum) {
+int shutdownThreadPool(threadPool *pool) {
     if (!pool) {
         return -1;
     }
 
-    if (poolNum < 1) {
-        poolNum = 1;
+    __atomic_store_n(&pool->draining, 1, __ATOMIC_SEQ_CST);
+    wakeQueueWaiters(pool, INT_MAX);
+
+    // 调用线程不帮忙执行任务: 它是外部线程, 执行的任务再提交子任务会被draining拒绝
+    while (1) {
+        pthread_mutex_lock(&pool->poolMutex);
+        int drained = drainedLocked(pool);
+        pthread_mutex_unlock(&pool->poolMutex);
+        if (drained) {
+            break;
+        }
+
+        // 排空只发生在关闭时, 轮询即可
+        usleep(DRAIN_POLL_US);
     }
 
-    pool = (threadPool *)malloc(sizeof(threadPool));
-    if (!pool) {
+    cleanupWorkers(pool);
+
+    return 0;
+}
+
+static int addRingTasks(threadPool *pool, threadTask *tasks, int num, int flags) {
+    threadWorker *self = currentWorker;
+    int pushed = 0;
+
+    for (int i = 0; i < num; ++i) {
+        int ranInline = 0;
+        tasks[i].flags = flags;
+        while (mpmcRingPush(pool->ring, &tasks[i]) != 0) {
+            // 队列已满, 先唤醒已入队任务对应的worker腾出空间
+            wakeRingWorkers(pool, pushed > 0 ? pushed : 1);
+            pushed = 0;
+            if (self && self->pool == pool) {
+                // worker自己执行任务, 避免所有worker都在等待队列空间而死锁
+                runWorkerTask(self, &tasks[i]);
+                ranInline = 1;
+                break;
+            }
+            sched_yield();
+        }
+
+        if (!ranInline) {
+            ++pushed;
+        }
+    }
+
+    if (pushed > 0) {
+        wakeRingWorkers(pool, pushed);
+    }
+    return 0;
+}
+
+/*
+ * 记录提交的任务数量, 必须在任务对worker可见之前完成.
+ * 外部线程先增加计数再检查draining, shutdownThreadPool先设置draining再读计数,
+ * 因此要么提交者被拒绝, 要么排空时能看到这次提交
+ */
+static int beginSubmit(threadPool *pool, threadWorker *self, int num) {
+    if (self) {
+        __atomic_store_n(&self->submittedTasks, self->submittedTasks + num, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    __atomic_add_fetch(&pool->externalSubmitted, num, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->draining, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&pool->externalCompleted, num, __ATOMIC_SEQ_CST);
         return -1;
     }
+    return 0;
+}
 
-    memset(pool, 0, sizeof(threadPool));
+// 没有进入队列的任务(被拒绝或已在调用线程中执行)计为完成
+static void endSubmit(threadPool *pool, threadWorker *self, int num) {
+    if (self) {
+        __atomic_store_n(&self->completedTasks, self->completedTasks + num, __ATOMIC_RELEASE);
+    } else {
+        __atomic_add_fetch(&pool->externalCompleted, num, __ATOMIC_SEQ_CST);
+    }
+}
 
-    pthread_cond_t blankCond = PTHREAD_COND_INITIALIZER;
-    memcpy(&pool->poolCond, &blankCond, sizeof(pthread_cond_t));
+/*
+ * 预留有界队列的名额, 队列已满时按fullPolicy处理
+ *
+ * @return int 0表示可以入队, 1表示任务已在调用线程中执行, -1表示线程池正在关闭, -2表示队列已满
+ */
+static int admitBoundedTasks(threadPool *pool, threadWorker *self, threadTask *tasks, int num,
+                             int flags) {
+    if (reserveQueueSlots(pool, num) == 0) {
+        return 0;
+    }
 
-    pthread_mutex_t blankMutex = PTHREAD_MUTEX_INITIALIZER;
-    memcpy(&pool->poolMutex, &blankMutex, sizeof(pthread_mutex_t));
+    if (pool->fullPolicy == THREAD_POOL_FULL_FAIL) {
+        return -2;
+    }
 
-    for (int i = 0; i < poolNum; ++i) {
-        threadWorker *worker = (threadWorker*) malloc(sizeof(threadWorker));
-        memset(worker, 0, sizeof(threadWorker));
+    // worker线程内提交时不能阻塞, 所有worker都在等待队列空间时就没有线程能腾出空间
+    if (pool->fullPolicy == THREAD_POOL_FULL_BLOCK && !self) {
+        return waitQueueSlots(pool, num);
+    }
 
-        if (!worker) {
-            cleanupWorkers(pool);
-            return -1;
-        }
+    for (int i = 0; i < num; ++i) {
+        tasks[i].flags = flags;
+        runTask(pool, &tasks[i]);
+    }
+    return 1;
+}
+
+/*
+ * 把num个任务加入队列, flags标记任务节点的归属.
+ * 优先级和截止时间只对全局队列生效, 工作窃取的本地队列和环形队列按提交顺序执行.
+ */
+static int enqueueTasks(threadPool *pool, threadTask *tasks, int num, int flags,
+                        threadTaskPriority priority, unsigned long deadlineNs, int node) {
+    threadWorker *self = currentWorker;
+    if (self && self->pool != pool) {
+        self = NULL;
+    }
 
-        worker->pool = pool;
-        worker->terminate = NOT_EXIT;
+    if (beginSubmit(pool, self, num) != 0) {
+        return -1;
+    }
 
-        int ret = pthread_create(&worker->workId, NULL, workerLoop, worker);
+    if (pool->maxQueuedTasks > 0) {
+        int ret = admitBoundedTasks(pool, self, tasks, num, flags);
         if (ret != 0) {
-            cleanupWorkers(pool);
-            return -1;
+            endSubmit(pool, self, num);
+            return ret > 0 ? 0 : ret;
         }
+        flags |= THREAD_TASK_BOUNDED;
+    }
 
-        LL_ADD(worker, pool->workers);
+    if (pool->elastic || pool->statsEnabled) {
+        unsigned long now = taskClockNs(pool);
+        for (int i = 0; i < num; ++i) {
+            tasks[i].enqueueNs = now;
+        }
+    }
+
+    if (pool->mode == THREAD_POOL_MPMC_RING) {
+        return addRingTasks(pool, tasks, num, flags);
+    }
+
+    int first = 0;
+    if (pool->mode == THREAD_POOL_WORK_STEALING && self) {
+        // worker线程内提交的任务压入自己的队列, 不需要加锁
+        while (first < num) {
+            tasks[first].flags = flags;
+            if (wsDequePush(self->deque, &tasks[first]) != 0) {
+                break;
+            }
+            ++first;
+        }
+
+        wakeIdleWorkers(pool, self->node, first);
+
+        if (first == num) {
+            return 0;
+        }
+        // 扩容失败时剩余任务退回全局链表
+    }
+
+    // 在锁外把整批任务串成链表, 临界区内只需要一次拼接
+    for (int i = first; i < num; ++i) {
+        tasks[i].flags = flags;
+        tasks[i].priority = priority;
+        tasks[i].deadlineNs = deadlineNs;
+        tasks[i].heapIndex = -1;
+        tasks[i].prev = i > first ? &tasks[i - 1] : NULL;
+        tasks[i].next = i + 1 < num ? &tasks[i + 1] : NULL;
+    }
+
+    threadTask *head = &tasks[first];
+    threadTask *tail = &tasks[num - 1];
+
+    // 已有任务排队且超过阈值没有worker取任务, 说明worker都在忙
+    if (pool->elastic && hasGlobalTask(pool) && __atomic_load_n(&pool->idleWorkers, __ATOMIC_RELAXED) == 0) {
+        pthread_mutex_lock(&pool->poolMutex);
+        unsigned long now = nowNs();
+        if (now - pool->lastDequeueNs > pool->spawnWaitNs) {
+            spawnWorkerLocked(pool, now);
+        }
+        pthread_mutex_unlock(&pool->poolMutex);
+    }
+
+    // 没有指定节点时, worker提交到自己的节点, 外部线程轮流选择节点
+    if (node < 0) {
+        if (self) {
+            node = self->node;
+        } else {
+            node = __atomic_fetch_add(&pool->nextNode, 1, __ATOMIC_RELAXED) % pool->nodeNum;
+        }
+    }
+
+    threadTaskQueue *queue = &pool->queues[node];
+    pthread_mutex_lock(&queue->mutex);
+    pushLaneLocked(pool, queue, priority, head, tail, num - first);
+    if (deadlineNs) {
+        for (int i = first; i < num; ++i) {
+            // 堆扩容失败时只是没有截止时间, 仍按通道顺序执行
+            if (pushDeadlineLocked(queue, &tasks[i]) != 0) {
+                break;
+            }
+        }
     }
+    pthread_mutex_unlock(&queue->mutex);
 
+    wakeIdleWorkers(pool, node, num - first);
     return 0;
 }
 
-int destoryThreadPool(threadPool *pool) {
+int addThreadPoolTasks(threadPool *pool, threadTask *tasks, int num) {
+    if (!pool || !tasks || num < 0) {
+        return -1;
+    }
+
+    if (num == 0) {
+        return 0;
+    }
+
+    return enqueueTasks(pool, tasks, num, 0, THREAD_TASK_PRIORITY_NORMAL, 0, -1);
+}
+
+int addThreadPoolTask(threadPool *pool, threadTask *task) {
+    return addThreadPoolTasks(pool, task, 1);
+}
+
+int submitThreadPoolTask(threadPool *pool, void (*func)(void *arg), void *arg) {
+    if (!pool || !func) {
+        return -1;
+    }
+
+    threadTask *task = allocTaskNode(pool);
+    if (!task) {
+        return -1;
+    }
+
+    task->func = func;
+    task->userData = arg;
+    int ret = enqueueTasks(pool, task, 1, THREAD_TASK_POOLED, THREAD_TASK_PRIORITY_NORMAL, 0, -1);
+    if (ret != 0) {
+        releaseTaskNode(pool, task);
+    }
+    return ret;
+}
+
+static unsigned long deadlineFromNow(unsigned long deadlineUs) {
+    return deadlineUs ? nowNs() + deadlineUs * 1000ul : 0;
+}
+
+int addThreadPoolTaskWithPriority(threadPool *pool, threadTask *task,
+                                  threadTaskPriority priority, unsigned long deadlineUs) {
+    if (!pool || !task || priority < 0 || priority >= THREAD_TASK_PRIORITY_NUM) {
+        return -1;
+    }
+
+    return enqueueTasks(pool, task, 1, 0, priority, deadlineFromNow(deadlineUs), -1);
+}
+
+int submitThreadPoolTaskWithPriority(threadPool *pool, void (*func)(void *arg), void *arg,
+                                     threadTaskPriority priority, unsigned long deadlineUs) {
+    if (!pool || !func || priority < 0 || priority >= THREAD_TASK_PRIORITY_NUM) {
+        return -1;
+    }
+
+    threadTask *task = allocTaskNode(pool);
+    if (!task) {
+        return -1;
+    }
+
+    task->func = func;
+    task->userData = arg;
+    int ret = enqueueTasks(pool, task, 1, THREAD_TASK_POOLED, priority,
+                           deadlineFromNow(deadlineUs), -1);
+    if (ret != 0) {
+        releaseTaskNode(pool, task);
+    }
+    return ret;
+}
+
+int addThreadPoolTaskOnNode(threadPool *pool, threadTask *task, int node) {
+    if (!pool || !task) {
+        return -1;
+    }
+
+    return enqueueTasks(pool, task, 1, 0, THREAD_TASK_PRIORITY_NORMAL, 0, nodeIndexOf(pool, node));
+}
+
+int submitThreadPoolTaskOnNode(threadPool *pool, void (*func)(void *arg), void *arg, int node) {
+    if (!pool || !func) {
+        return -1;
+    }
+
+    threadTask *task = allocTaskNode(pool);
+    if (!task) {
+        return -1;
+    }
+
+    task->func = func;
+    task->userData = arg;
+    int ret = enqueueTasks(pool, task, 1, THREAD_TASK_POOLED, THREAD_TASK_PRIORITY_NORMAL, 0,
+                           nodeIndexOf(pool, node));
+    if (ret != 0) {
+        releaseTaskNode(pool, task);
+    }
+    return ret;
+}
+
+int getThreadPoolNodes(threadPool *pool, int *nodes, int maxNum) {
+    if (!pool || (!nodes && maxNum > 0)) {
+        return -1;
+    }
+
+    int num = 0;
+    threadPoolPlacement *placement = pool->placement;
+    for (int i = 0; placement && i < placement->nodeNum; ++i) {
+        if (placement->nodeIds[i] < 0) {
+            continue;
+        }
+        if (num < maxNum) {
+            nodes[num] = placement->nodeIds[i];
+        }
+        ++num;
+    }
+
+    return num;
+}
+
+int getThreadPoolCurrentNode(void) {
+    threadWorker *self = currentWorker;
+    if (!self || !self->pool->placement) {
+        return -1;
+    }
+
+    return self->pool->placement->nodeIds[self->node];
+}
+
+// 外部线程从worker的本地队列窃取任务, 从上次成功的位置继续遍历
+static threadTask *stealTaskExternal(threadPool *pool) {
+    static __thread unsigned int start = 0;
+    int num = pool->workerNum;
+    for (int i = 0; i < num; ++i) {
+        threadWorker *victim = pool->workerArray[(start + i) % num];
+        threadTask *task = wsDequeSteal(victim->deque);
+        if (task) {
+            start = (start + i) % num;
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+int tryRunThreadPoolTask(threadPool *pool) {
     if (!pool) {
         return -1;
     }
 
-    cleanupWorkers(pool);
+    threadWorker *self = currentWorker;
+    if (self && self->pool != pool) {
+        self = NULL;
+    }
+
+    threadTask *task = NULL;
+    if (pool->mode == THREAD_POOL_MPMC_RING) {
+        task = mpmcRingPop(pool->ring);
+    } else if (pool->mode == THREAD_POOL_WORK_STEALING && self) {
+        task = findStealingTask(self);
+    } else {
+        task = popGlobalTask(pool, self ? self->node : 0);
+        if (task && pool->elastic) {
+            pthread_mutex_lock(&pool->poolMutex);
+            onGlobalTaskDequeuedLocked(pool, task);
+            pthread_mutex_unlock(&pool->poolMutex);
+        }
+
+        if (!task && pool->mode == THREAD_POOL_WORK_STEALING) {
+            task = stealTaskExternal(pool);
+        }
+    }
+
+    if (!task) {
+        return 0;
+    }
+
+    if (self) {
+        runWorkerTask(self, task);
+    } else {
+        runTask(pool, task);
+        __atomic_add_fetch(&pool->externalCompleted, 1, __ATOMIC_SEQ_CST);
+    }
+    return 1;
+}
+
+// 粗略的排队任务数量, 调用时必须持有poolMutex
+static long queueDepthLocked(threadPool *pool) {
+    long depth = __atomic_load_n(&pool->queuedTasks, __ATOMIC_RELAXED);
+    if (pool->ring) {
+        depth += (long)mpmcRingSize(pool->ring);
+    }
+
+    for (threadWorker *tmp = pool->workers; tmp; tmp = tmp->next) {
+        if (tmp->deque) {
+            depth += wsDequeSize(tmp->deque);
+        }
+    }
+    return depth;
+}
+
+int getThreadPoolStats(threadPool *pool, threadPoolStats *stats) {
+    if (!pool || !stats) {
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(threadPoolStats));
+    unsigned long now = nowNs();
 
     pthread_mutex_lock(&pool->poolMutex);
+    stats->liveWorkers = pool->liveWorkers;
+    stats->idleWorkers = __atomic_load_n(&pool->idleWorkers, __ATOMIC_RELAXED);
+    stats->spawnedWorkers = pool->spawnedWorkers;
+    stats->retiredWorkers = pool->retiredWorkerNum;
+    stats->dequeuedTasks = pool->dequeuedTasks;
+    stats->queueWaitNs = pool->queueWaitNs;
+    stats->maxQueueWaitNs = pool->maxQueueWaitNs;
+    stats->completedTasks = pool->reapedTasks;
+    stats->busyNs = pool->reapedBusyNs;
+    stats->aliveNs = pool->reapedAliveNs;
+    for (int i = 0; i < THREAD_POOL_IDLE_PHASE_NUM; ++i) {
+        stats->idleWakeups[i] = pool->reapedIdleWakeups[i];
+    }
 
-    pool->tasks = NULL;
-    pool->workers = NULL;
-    pthread_cond_broadcast(&pool->poolCond);
+    for (threadWorker *tmp = pool->workers; tmp; tmp = tmp->next) {
+        stats->completedTasks += __atomic_load_n(&tmp->completedTasks, __ATOMIC_RELAXED);
+        stats->busyNs += __atomic_load_n(&tmp->busyNs, __ATOMIC_RELAXED);
+        stats->aliveNs += now - tmp->startNs;
+        for (int i = 0; i < THREAD_POOL_IDLE_PHASE_NUM; ++i) {
+            stats->idleWakeups[i] += __atomic_load_n(&tmp->idleWakeups[i], __ATOMIC_RELAXED);
+        }
+    }
 
+    for (threadWorker *tmp = pool->retiredWorkers; tmp; tmp = tmp->next) {
+        stats->completedTasks += tmp->completedTasks;
+        stats->busyNs += tmp->busyNs;
+        stats->aliveNs += tmp->exitNs - tmp->startNs;
+        for (int i = 0; i < THREAD_POOL_IDLE_PHASE_NUM; ++i) {
+            stats->idleWakeups[i] += tmp->idleWakeups[i];
+        }
+    }
+    stats->queuedTasks = queueDepthLocked(pool);
     pthread_mutex_unlock(&pool->poolMutex);
 
+    stats->elapsedNs = now - pool->createNs;
     return 0;
 }
 
-int addThreadPoolTask(threadPool *pool, threadTask *task) {
-    if (!pool || !task) {
+int getThreadPoolTaskStats(threadPool *pool, threadWorkerStats *stats) {
+    if (!pool || !stats || !pool->statsEnabled) {
         return -1;
     }
 
+    memset(stats, 0, sizeof(threadWorkerStats));
     pthread_mutex_lock(&pool->poolMutex);
+    workerStatsMerge(stats, pool->reapedStats);
+    for (threadWorker *tmp = pool->workers; tmp; tmp = tmp->next) {
+        workerStatsMerge(stats, tmp->stats);
+    }
+    for (threadWorker *tmp = pool->retiredWorkers; tmp; tmp = tmp->next) {
+        workerStatsMerge(stats, tmp->stats);
+    }
+    pthread_mutex_unlock(&pool->poolMutex);
+
+    return 0;
+}
 
-    LL_ADD(task, pool->tasks);
-    pthread_cond_signal(&pool->poolCond);
+int getThreadPoolWorkerStats(threadPool *pool, threadWorkerStats *stats, int maxNum) {
+    if (!pool || (!stats && maxNum > 0) || !pool->statsEnabled) {
+        return -1;
+    }
+
+    int num = 0;
+    pthread_mutex_lock(&pool->poolMutex);
+    for (int i = 0; i < pool->workerNum; ++i) {
+        threadWorker *worker = pool->workerArray[i];
+        if (!worker || worker->exitNs) {
+            continue;
+        }
 
+        if (num < maxNum) {
+            memset(&stats[num], 0, sizeof(threadWorkerStats));
+            workerStatsMerge(&stats[num], worker->stats);
+        }
+        ++num;
+    }
     pthread_mutex_unlock(&pool->poolMutex);
 
-    return 0;
+    return num;
+}
+
+unsigned long getThreadPoolHistogramPercentile(const threadPoolHistogram *hist, double percentile) {
+    if (!hist || hist->count == 0) {
+        return 0;
+    }
+
+    if (percentile < 0) {
+        percentile = 0;
+    }
+    if (percentile > 100) {
+        percentile = 100;
+    }
+
+    unsigned long rank = (unsigned long)(hist->count * percentile / 100.0 + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    unsigned long seen = 0;
+    for (int i = 0; i < THREAD_POOL_HIST_BUCKETS; ++i) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            unsigned long upper = histBucketUpper(i);
+            return upper < hist->maxNs ? upper : hist->maxNs;
+        }
+    }
+
+    return hist->maxNs;
 }
@@ -14,15 +14,178 @@
 
 #include <pthread.h>
 
+#define THREAD_POOL_CACHE_LINE 64
+#define THREAD_POOL_DEFAULT_RING_CAPACITY 4096
+#define THREAD_POOL_DEFAULT_SPAWN_WAIT_US 1000
+#define THREAD_POOL_DEFAULT_IDLE_TIMEOUT_MS 10000
+#define THREAD_POOL_DEFAULT_NORMAL_WEIGHT 4
+
+// 延迟直方图: 每个2的幂区间再均分为2^SUB_BITS个桶, 相对误差不超过1/2^SUB_BITS,
+// 不小于2^MAX_BITS ns(约18分钟)的值都记入最后一个桶
+#define THREAD_POOL_HIST_SUB_BITS 3
+#define THREAD_POOL_HIST_MAX_BITS 40
+#define THREAD_POOL_HIST_BUCKETS \
+    ((THREAD_POOL_HIST_MAX_BITS - THREAD_POOL_HIST_SUB_BITS + 1) << THREAD_POOL_HIST_SUB_BITS)
+
+#define THREAD_TASK_POOLED 0x1   // 任务节点由线程池分配, 执行完成后回收
+#define THREAD_TASK_BOUNDED 0x2  // 任务占用了有界队列的名额, 开始执行时归还
+
 typedef enum exitStatus {
     NOT_EXIT = 0,
     EXIT
 } exitStatus;
 
+/**
+ * @brief 任务优先级通道
+ *
+ * 延迟敏感通道严格优先; 普通通道和批量通道按normalWeight:1加权轮转
+ */
+typedef enum threadTaskPriority {
+    THREAD_TASK_PRIORITY_LATENCY = 0,
+    THREAD_TASK_PRIORITY_NORMAL,
+    THREAD_TASK_PRIORITY_BULK,
+    THREAD_TASK_PRIORITY_NUM
+} threadTaskPriority;
+
+/**
+ * @brief 线程池的调度模式
+ *
+ * THREAD_POOL_GLOBAL_QUEUE: 所有任务进入加锁保护的全局队列, 开启numaAware时每个节点一个
+ * THREAD_POOL_WORK_STEALING: 每个worker拥有一个无锁双端队列, worker线程内提交的任务
+ *                            压入自己的队列, 空闲的worker从其他worker的队列窃取任务.
+ *                            外部线程提交的任务进入全局队列, 由worker取出
+ * THREAD_POOL_MPMC_RING: 任务进入有界无锁环形队列(FIFO), 提交时不加锁,
+ *                        只有队列为空时worker才通过futex休眠
+ */
+typedef enum threadPoolMode {
+    THREAD_POOL_GLOBAL_QUEUE = 0,
+    THREAD_POOL_WORK_STEALING,
+    THREAD_POOL_MPMC_RING
+} threadPoolMode;
+
+/**
+ * @brief 空闲worker等待任务的阶段: 先自旋, 再让出CPU, 最后休眠
+ */
+typedef enum threadPoolIdlePhase {
+    THREAD_POOL_IDLE_SPIN = 0,
+    THREAD_POOL_IDLE_YIELD,
+    THREAD_POOL_IDLE_PARK,
+    THREAD_POOL_IDLE_PHASE_NUM
+} threadPoolIdlePhase;
+
+/**
+ * @brief 有界队列已满时提交任务的处理方式
+ */
+typedef enum threadPoolFullPolicy {
+    THREAD_POOL_FULL_BLOCK = 0,   // 阻塞等待队列空间; worker线程内提交时改为由自己执行, 避免worker互相等待
+    THREAD_POOL_FULL_FAIL,        // 立即返回-2
+    THREAD_POOL_FULL_CALLER_RUNS  // 在提交线程中直接执行
+} threadPoolFullPolicy;
+
+/**
+ * @brief 线程池创建参数, 使用前先调用initThreadPoolAttr填充默认值
+ *
+ * maxPoolNum大于0时启用弹性模式(仅支持THREAD_POOL_GLOBAL_QUEUE):
+ * 以poolNum个worker启动, 任务排队超过spawnWaitUs且没有空闲worker时增加worker,
+ * 直到maxPoolNum; worker空闲超过idleTimeoutMs后退出, 直到剩下minPoolNum个
+ */
+typedef struct threadPoolAttr {
+    int poolNum;
+    threadPoolMode mode;
+    unsigned long ringCapacity;  // THREAD_POOL_MPMC_RING模式下环形队列的容量
+
+    int minPoolNum;
+    int maxPoolNum;
+    unsigned long spawnWaitUs;
+    unsigned long idleTimeoutMs;
+
+    int normalWeight;  // 普通通道相对批量通道的出队权重
+
+    // CPU亲和性, 三项都为默认值时worker不设置亲和性
+    const int *cpus;  // worker可以运行的CPU编号, NULL表示进程当前允许的全部CPU
+    int cpuNum;
+    int pinWorkers;   // 每个worker绑定到其中一个CPU, 否则可以在所属节点的CPU之间迁移
+    int numaAware;    // 按NUMA节点分组worker, 每个节点拥有自己的全局队列
+
+    int enableStats;  // 每个worker记录执行任务数, 忙碌时间和排队/执行时间的直方图
+
+    // 已提交但尚未开始执行的任务数量上限, 0表示不限制. 队列为空时超过上限的整批任务也可以进入
+    long maxQueuedTasks;
+    threadPoolFullPolicy fullPolicy;
+
+    // 队列为空时worker先用pause自旋idleSpinUs微秒, 再调用idleYields次sched_yield, 仍然没有任务才休眠.
+    // 都为0时直接休眠; 自旋和让出期间提交任务不需要唤醒, 但空闲的worker会占用CPU. 单核机器上不自旋
+    unsigned long idleSpinUs;
+    int idleYields;
+} threadPoolAttr;
+
+/**
+ * @brief 线程池运行统计, 排队时间和忙碌时间只在弹性模式下记录
+ *
+ * 利用率 = busyNs / aliveNs, 平均排队时间 = queueWaitNs / dequeuedTasks
+ */
+typedef struct threadPoolStats {
+    int liveWorkers;
+    int idleWorkers;
+    long queuedTasks;               // 全局队列, 本地队列和环形队列中排队的任务数量
+    unsigned long spawnedWorkers;   // 弹性模式下新增的worker数量
+    unsigned long retiredWorkers;   // 因空闲超时退出的worker数量
+    unsigned long dequeuedTasks;
+    unsigned long completedTasks;
+    unsigned long queueWaitNs;      // 任务从入队到被取出的累计时间
+    unsigned long maxQueueWaitNs;
+    unsigned long busyNs;           // 所有worker执行任务的累计时间
+    unsigned long aliveNs;          // 所有worker存活的累计时间
+    unsigned long elapsedNs;        // 线程池创建至今的时间
+    unsigned long idleWakeups[THREAD_POOL_IDLE_PHASE_NUM];  // 空闲worker在各阶段等到任务的次数
+} threadPoolStats;
+
+/**
+ * @brief 对数线性直方图, 单位ns
+ */
+typedef struct threadPoolHistogram {
+    unsigned long count;
+    unsigned long sumNs;
+    unsigned long maxNs;
+    unsigned long buckets[THREAD_POOL_HIST_BUCKETS];
+} threadPoolHistogram;
+
+/**
+ * @brief 单个worker的任务统计, 开启enableStats时记录
+ *
+ * 只由worker自己写入, 单独按cache line对齐分配, 记录时不需要加锁或原子加;
+ * 快照时逐字段原子读取后合并. 外部线程通过tryRunThreadPoolTask执行的任务不计入
+ */
+typedef struct threadWorkerStats {
+    unsigned long tasks;
+    unsigned long busyNs;
+    threadPoolHistogram queueWait;  // 入队到开始执行
+    threadPoolHistogram runTime;
+} __attribute__((aligned(THREAD_POOL_CACHE_LINE))) threadWorkerStats;
+
 typedef struct threadWorker {
     pthread_t workId;
     exitStatus terminate;
+    int index;
+    unsigned int seed;  // 选择窃取对象的随机数种子
+
+    // 本地缓存的空闲任务节点, 只由worker自己访问
+    struct threadTask *freeTasks;
+    int freeTaskNum;
 
+    unsigned long startNs;
+    unsigned long exitNs;
+    unsigned long busyNs;
+
+    // 只由worker自己写入, 与外部线程的计数一起判断线程池是否已经排空
+    unsigned long submittedTasks;  // worker线程内提交的任务数量
+    unsigned long completedTasks;
+    unsigned long idleWakeups[THREAD_POOL_IDLE_PHASE_NUM];
+
+    int node;  // 所属节点在threadPool::queues中的下标
+    threadWorkerStats *stats;  // 未开启统计时为NULL
+
+    struct wsDeque *deque;  // 仅在THREAD_POOL_WORK_STEALING模式下使用
     struct threadPool *pool;
     struct threadWorker *prev;
     struct threadWorker *next;
@@ -31,21 +194,224 @@ typedef struct threadWorker {
 typedef struct threadTask {
     void (*func)(void *arg);
     void *userData;
+    int flags;  // 由线程池在提交时设置
+    unsigned long enqueueNs;  // 入队时间, 仅在弹性模式或开启统计时记录
+    threadTaskPriority priority;
+    unsigned long deadlineNs;  // 截止时间(CLOCK_MONOTONIC), 0表示没有截止时间
+    int heapIndex;  // 在截止时间堆中的下标, 不在堆中时为-1
 
     struct threadTask *prev;
     struct threadTask *next;
 } threadTask;
 
+typedef struct threadTaskLane {
+    struct threadTask *head;
+    struct threadTask *tail;
+} threadTaskLane;
+
+/*
+ * 一个节点的全局队列, 由自己的mutex保护, 按cache line对齐, 不同节点的提交和出队不争用同一把锁.
+ * 所属节点的worker空闲时在cond上等待
+ */
+typedef struct threadTaskQueue {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int idleWorkers;  // 正在cond上等待的worker数量
+    int queuedTasks;  // 在锁内修改, 可以在锁外原子读取
+    threadTaskLane lanes[THREAD_TASK_PRIORITY_NUM];
+    struct threadTask **deadlineHeap;  // 通道中带截止时间的任务, 按截止时间排序的小顶堆
+    int deadlineHeapSize;
+    int deadlineHeapCap;
+    int normalCredit;  // 普通通道连续出队的次数
+} __attribute__((aligned(THREAD_POOL_CACHE_LINE))) threadTaskQueue;
+
 typedef struct threadPool {
     struct threadWorker *workers;
-    struct threadTask *tasks;
 
-    pthread_cond_t poolCond;
+    // 全局队列, 每个NUMA节点一个, 未开启numaAware时只有一个.
+    // worker优先从自己节点的队列取任务, 为空时再加对方的锁取其他节点的任务
+    threadTaskQueue *queues;
+    int nodeNum;
+    unsigned int nextNode;  // 外部线程提交且没有指定节点时轮流选择节点
+    int queuedTasks;        // 所有节点排队任务的总数, 原子读写
+    int normalWeight;
+    struct threadPoolPlacement *placement;  // worker的CPU分配, 未设置亲和性时为NULL
+
+    // 保护worker注册表, 弹性模式的状态和统计, 不保护任务队列
     pthread_mutex_t poolMutex;
+
+    threadPoolMode mode;
+    unsigned long idleSpinNs;
+    int idleYields;
+    int workerNum;    // workerArray的槽位数量
+    int idleWorkers;  // 所有节点上等待任务的worker总数, 原子读写
+    int liveWorkers;
+    int terminating;
+    struct threadWorker **workerArray;  // 按index索引的worker, 用于选择窃取对象
+
+    // 弹性模式, 以下字段都由poolMutex保护
+    int elastic;
+    int minWorkers;
+    int maxWorkers;
+    unsigned long spawnWaitNs;
+    unsigned long idleTimeoutNs;
+    unsigned long createNs;
+    unsigned long lastSpawnNs;
+    unsigned long lastDequeueNs;
+    struct threadWorker *retiredWorkers;  // 已退出等待回收的worker
+    unsigned long spawnedWorkers;
+    unsigned long retiredWorkerNum;
+    unsigned long dequeuedTasks;
+    unsigned long queueWaitNs;
+    unsigned long maxQueueWaitNs;
+    unsigned long reapedTasks;  // 已回收worker的计数
+    unsigned long reapedBusyNs;
+    unsigned long reapedAliveNs;
+    unsigned long reapedIdleWakeups[THREAD_POOL_IDLE_PHASE_NUM];
+
+    int statsEnabled;
+    threadWorkerStats *reapedStats;  // 已回收worker的任务统计, 由poolMutex保护
+
+    // submitThreadPoolTask使用的任务节点, 按slab申请, 线程池销毁时统一释放
+    struct taskSlab *taskSlabs;
+    struct threadTask *freeTasks;
+    pthread_mutex_t freeMutex;
+
+    // THREAD_POOL_MPMC_RING模式使用, 休眠的worker在wakeEpoch上futex等待.
+    // threadPool由调用者分配, 不能保证对齐, 用填充把这两个字段和poolMutex隔开
+    struct mpmcRing *ring;
+    char ringPad[THREAD_POOL_CACHE_LINE];
+    unsigned int wakeEpoch;
+    int sleepers;
+
+    // 有界队列, 提交时预留名额, 任务开始执行时归还; 阻塞的提交者在spaceEpoch上futex等待
+    long maxQueuedTasks;
+    threadPoolFullPolicy fullPolicy;
+    int draining;  // shutdownThreadPool开始后拒绝外部线程提交的任务
+    unsigned long reapedSubmitted;  // 已回收worker提交的任务数量, 由poolMutex保护
+    char boundPad[THREAD_POOL_CACHE_LINE];
+    long boundedTasks;
+    unsigned int spaceEpoch;
+    int spaceWaiters;
+    unsigned long externalSubmitted;  // 外部线程提交的任务数量, 包括被拒绝的
+    unsigned long externalCompleted;  // 外部线程执行完成和被拒绝的任务数量
 } threadPool;
 
+void initThreadPoolAttr(threadPoolAttr *attr);
 int createThreadPool(threadPool *pool, int poolNum);
+int createThreadPoolWithAttr(threadPool *pool, const threadPoolAttr *attr);
+
+/**
+ * @brief 立即销毁线程池, 尚未开始执行的任务被丢弃
+ */
 int destoryThreadPool(threadPool *pool);
+
+/**
+ * @brief 排空后销毁线程池: 拒绝外部线程提交的新任务, 等待已提交的任务
+ *        (包括它们在worker线程内提交的子任务)全部执行完成, 然后回收worker
+ *
+ * 阻塞在有界队列上的外部提交者返回-1. 不能在worker线程内调用
+ *
+ * @return int 0表示成功, -1表示参数错误
+ */
+int shutdownThreadPool(threadPool *pool);
+
+/**
+ * @brief 提交任务. 开启maxQueuedTasks时, 队列已满按fullPolicy阻塞, 失败或在调用线程中执行
+ *
+ * 以下所有提交接口的返回值相同:
+ * @return int 0表示成功, -1表示参数错误, 内存不足或线程池正在关闭, -2表示队列已满(THREAD_POOL_FULL_FAIL)
+ */
 int addThreadPoolTask(threadPool *pool, threadTask *task);
 
+/**
+ * @brief 批量提交任务, 整批任务在一次临界区内加入队列, 并唤醒min(num, 空闲worker数量)个worker
+ *
+ * @param tasks 连续存放的num个任务, 由调用者分配并保证在执行完成前有效
+ */
+int addThreadPoolTasks(threadPool *pool, threadTask *tasks, int num);
+
+/**
+ * @brief 提交任务, 任务节点由线程池分配并在func返回后回收, 调用者不需要管理threadTask
+ *
+ * worker线程使用自己的空闲节点缓存, 外部线程使用全局空闲链表,
+ * 稳定运行后不再调用malloc/free
+ */
+int submitThreadPoolTask(threadPool *pool, void (*func)(void *arg), void *arg);
+
+/**
+ * @brief 按优先级提交任务, 只对全局队列(包括工作窃取模式下外部线程提交的任务)生效
+ *
+ * @param deadlineUs 相对当前时间的截止时间(微秒), 超时未执行的任务会排到所有通道之前, 0表示没有截止时间
+ */
+int addThreadPoolTaskWithPriority(threadPool *pool, threadTask *task,
+                                  threadTaskPriority priority, unsigned long deadlineUs);
+int submitThreadPoolTaskWithPriority(threadPool *pool, void (*func)(void *arg), void *arg,
+                                     threadTaskPriority priority, unsigned long deadlineUs);
+
+/**
+ * @brief 提交任务并指定期望执行的NUMA节点, 通常是任务数据所在的节点
+ *
+ * 任务进入该节点的全局队列, 由该节点的worker优先执行, 其他节点的worker只在自己的队列为空时才会取走.
+ * node为-1或不属于线程池时, worker线程内提交的任务进入自己节点的队列, 外部线程提交的任务轮流分配到各节点.
+ * 只对THREAD_POOL_GLOBAL_QUEUE和THREAD_POOL_WORK_STEALING模式下外部线程提交的任务生效
+ *
+ * @param node 系统的NUMA节点编号
+ */
+int addThreadPoolTaskOnNode(threadPool *pool, threadTask *task, int node);
+int submitThreadPoolTaskOnNode(threadPool *pool, void (*func)(void *arg), void *arg, int node);
+
+/**
+ * @brief 获取线程池使用的NUMA节点编号
+ *
+ * @param nodes 输出最多maxNum个节点编号, 未开启numaAware时为空
+ * @return int 节点数量, -1表示参数错误
+ */
+int getThreadPoolNodes(threadPool *pool, int *nodes, int maxNum);
+
+/**
+ * @brief 当前worker所属的NUMA节点编号
+ *
+ * @return int 不是worker线程或线程池未开启numaAware时返回-1
+ */
+int getThreadPoolCurrentNode(void);
+
+/**
+ * @brief 在调用线程中取出并执行一个排队的任务, 供等待子任务完成的线程帮忙执行, 避免阻塞
+ *
+ * 可以由worker线程或外部线程调用; 执行的可能是任意已提交的任务
+ *
+ * @return int 1表示执行了一个任务, 0表示当前没有可执行的任务, -1表示参数错误
+ */
+int tryRunThreadPoolTask(threadPool *pool);
+
+/**
+ * @brief 获取线程池运行统计的快照
+ *
+ * @return int 0表示成功, -1表示参数错误
+ */
+int getThreadPoolStats(threadPool *pool, threadPoolStats *stats);
+
+/**
+ * @brief 合并所有worker(包括已退出的worker)的任务统计
+ *
+ * @return int 0表示成功, -1表示参数错误或未开启enableStats
+ */
+int getThreadPoolTaskStats(threadPool *pool, threadWorkerStats *stats);
+
+/**
+ * @brief 按槽位顺序获取每个存活worker的任务统计
+ *
+ * @param stats 输出最多maxNum个worker的统计
+ * @return int 存活worker的数量, -1表示参数错误或未开启enableStats
+ */
+int getThreadPoolWorkerStats(threadPool *pool, threadWorkerStats *stats, int maxNum);
+
+/**
+ * @brief 直方图的百分位数, 返回所在桶的上界(不超过记录到的最大值)
+ *
+ * @param percentile 取值[0, 100]
+ */
+unsigned long getThreadPoolHistogramPercentile(const threadPoolHistogram *hist, double percentile);
+
 #endif // THREADPOOL_H_
@@ -0,0 +1,134 @@
+#include "work_steal_deque.h"
+#include <stdlib.h>
+
+static wsArray *wsArrayCreate(long size) {
+    wsArray *array = (wsArray *)malloc(sizeof(wsArray) + size * sizeof(threadTask *));
+    if (!array) {
+        return NULL;
+    }
+
+    array->size = size;
+    array->retired = NULL;
+    return array;
+}
+
+static threadTask *wsArrayGet(wsArray *array, long index) {
+    return __atomic_load_n(&array->buf[index & (array->size - 1)], __ATOMIC_RELAXED);
+}
+
+static void wsArrayPut(wsArray *array, long index, threadTask *task) {
+    __atomic_store_n(&array->buf[index & (array->size - 1)], task, __ATOMIC_RELAXED);
+}
+
+int wsDequeInit(wsDeque *deque, long capacity) {
+    long size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    deque->top = 0;
+    deque->bottom = 0;
+    deque->array = wsArrayCreate(size);
+    return deque->array ? 0 : -1;
+}
+
+void wsDequeDestroy(wsDeque *deque) {
+    wsArray *array = deque->array;
+    while (array) {
+        wsArray *retired = array->retired;
+        free(array);
+        array = retired;
+    }
+
+    deque->array = NULL;
+}
+
+// 仅由拥有者线程调用, 旧数组挂在新数组上延迟释放
+static wsArray *wsDequeGrow(wsDeque *deque, wsArray *array, long top, long bottom) {
+    wsArray *bigger = wsArrayCreate(array->size << 1);
+    if (!bigger) {
+        return NULL;
+    }
+
+    for (long i = top; i < bottom; ++i) {
+        wsArrayPut(bigger, i, wsArrayGet(array, i));
+    }
+
+    bigger->retired = array;
+    __atomic_store_n(&deque->array, bigger, __ATOMIC_RELEASE);
+    return bigger;
+}
+
+int wsDequePush(wsDeque *deque, threadTask *task) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    wsArray *array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+
+    if (bottom - top > array->size - 1) {
+        array = wsDequeGrow(deque, array, top, bottom);
+        if (!array) {
+            return -1;
+        }
+    }
+
+    wsArrayPut(array, bottom, task);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+threadTask *wsDequeTake(wsDeque *deque) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    wsArray *array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+        // 队列为空, 恢复bottom
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    threadTask *task = wsArrayGet(array, bottom);
+    if (top == bottom) {
+        // 只剩最后一个任务, 需要和窃取者竞争
+        if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            task = NULL;
+        }
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+
+    return task;
+}
+
+threadTask *wsDequeSteal(wsDeque *deque) {
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    wsArray *array = __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+    threadTask *task = wsArrayGet(array, top);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+
+    return task;
+}
+
+int wsDequeEmpty(wsDeque *deque) {
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    return top >= bottom;
+}
+
+long wsDequeSize(wsDeque *deque) {
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    return bottom > top ? bottom - top : 0;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file work_steal_deque.h
+ * @author Nick
+ * @brief Chase-Lev无锁工作窃取双端队列
+ * @version 0.1
+ * @date 2023-05-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * 队列只有拥有者线程可以在底部push/take, 其他线程只能从顶部steal.
+ * 内存序参考 Lê et al. "Correct and Efficient Work-Stealing for Weak
+ * Memory Models" (PPoPP 2013).
+ */
+
+#ifndef WORK_STEAL_DEQUE_H_
+#define WORK_STEAL_DEQUE_H_
+
+#include "threadpool.h"
+
+typedef struct wsArray {
+    long size;  // 容量, 必须是2的幂
+    struct wsArray *retired;  // 扩容后被替换的旧数组, 窃取者可能仍在读取, 销毁时统一释放
+    threadTask *buf[];
+} wsArray;
+
+typedef struct wsDeque {
+    // top由窃取者CAS修改, bottom只由拥有者修改, 分开放置避免伪共享
+    long top __attribute__((aligned(THREAD_POOL_CACHE_LINE)));
+    long bottom __attribute__((aligned(THREAD_POOL_CACHE_LINE)));
+    wsArray *array;
+} wsDeque;
+
+int wsDequeInit(wsDeque *deque, long capacity);
+void wsDequeDestroy(wsDeque *deque);
+
+/**
+ * @brief 拥有者线程在底部压入任务, 容量不足时自动扩容
+ *
+ * @return int 0表示成功, -1表示扩容时内存不足
+ */
+int wsDequePush(wsDeque *deque, threadTask *task);
+
+/**
+ * @brief 拥有者线程从底部取出任务(LIFO)
+ *
+ * @return threadTask* 队列为空时返回NULL
+ */
+threadTask *wsDequeTake(wsDeque *deque);
+
+/**
+ * @brief 其他线程从顶部窃取任务(FIFO)
+ *
+ * @return threadTask* 队列为空或与其他线程竞争失败时返回NULL
+ */
+threadTask *wsDequeSteal(wsDeque *deque);
+
+/**
+ * @brief 粗略判断队列是否为空, 仅用于休眠前的检查
+ */
+int wsDequeEmpty(wsDeque *deque);
+
+/**
+ * @brief 粗略的队列长度, 仅用于统计
+ */
+long wsDequeSize(wsDeque *deque);
+
+#endif // WORK_STEAL_DEQUE_H_